@@ -4,14 +4,18 @@
 #include "InstructionParts.h"
 #include "Controller.h"
 
-// unique ALU operations that we just need
+// unique ALU operations needed for RV32I
 enum ALUOperation {
     ALU_ADD,
     ALU_SUB,
     ALU_AND,
     ALU_OR,
-    ALU_SLTU,
+    ALU_XOR,
+    ALU_SLL,
+    ALU_SRL,
     ALU_SRA,
+    ALU_SLT,
+    ALU_SLTU,
     ALU_COPY_IMM,
     ALU_INVALID,
 };
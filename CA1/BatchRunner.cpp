@@ -0,0 +1,166 @@
+#include "BatchRunner.h"
+#include "ThreadPool.h"
+#include "LaneEngine.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+using namespace std;
+
+BatchRunner::BatchRunner(Engine engine, unsigned threads) : engine(engine), threads(threads) {
+    if (engine == ENGINE_LANES && !LaneEngine::WORTHWHILE) {
+        this->engine = ENGINE_THREADED; // built without avx2, where lockstep lanes are slower
+    }
+}
+
+// read program paths, skipping blank lines and comments. relative paths are
+// taken relative to the manifest's directory
+bool BatchRunner::readManifest(const char *path) {
+    ifstream manifest(path);
+    if (!manifest.is_open()) {
+        return false;
+    }
+    string directory = path;
+    size_t slash = directory.rfind('/');
+    directory = slash == string::npos ? "" : directory.substr(0, slash + 1);
+
+    string line;
+    while (getline(manifest, line)) {
+        size_t hash = line.find('#');
+        if (hash != string::npos) {
+            line.erase(hash);
+        }
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == string::npos) {
+            continue;
+        }
+        line = line.substr(first, line.find_last_not_of(" \t\r") - first + 1);
+        programs.push_back(line[0] == '/' ? line : directory + line);
+    }
+    return true;
+}
+
+// load a program and map the -M files over it
+bool BatchRunner::load(const string &path, CPU &cpu, Program &program) {
+    if (!Loader::load(path.c_str(), cpu.getMemory(), program)) {
+        return false;
+    }
+    string error;
+    for (const string &map : maps) {
+        if (!Loader::mapSpec(map, cpu.getMemory(), error)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// load and run one program on a fresh cpu
+void BatchRunner::runOne(size_t index) {
+    BatchResult &result = results[index];
+    result.path = programs[index];
+    result.instructions = 0;
+    result.seconds = 0;
+
+    auto start = chrono::steady_clock::now();
+    CPU cpu;
+    Program program;
+    result.loaded = load(result.path, cpu, program);
+    if (result.loaded) {
+        cpu.setPC(program.entry);
+        Simulator simulator(cpu, engine);
+        result.instructions = simulator.run(program);
+    }
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    for (int i = 0; i < 32; i++) {
+        result.registers[i] = cpu.readRegister(i);
+    }
+    result.pc = cpu.readPC();
+}
+
+// load and run count programs from first together in lockstep. each result
+// gets the time the whole group took
+void BatchRunner::runLanes(size_t first, size_t count) {
+    auto start = chrono::steady_clock::now();
+    vector<unique_ptr<CPU>> cpus;
+    LaneEngine lanes(ENGINE_THREADED);
+    vector<int> lane(count, -1); // program to lane, -1 if it didn't load
+    int lanesUsed = 0;
+    for (size_t i = 0; i < count; i++) {
+        BatchResult &result = results[first + i];
+        result.path = programs[first + i];
+        result.instructions = 0;
+        cpus.emplace_back(new CPU());
+        Program program;
+        result.loaded = load(result.path, *cpus[i], program);
+        if (result.loaded) {
+            cpus[i]->setPC(program.entry);
+            lanes.addLane(*cpus[i], program);
+            lane[i] = lanesUsed++;
+        }
+    }
+    lanes.run();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    for (size_t i = 0; i < count; i++) {
+        BatchResult &result = results[first + i];
+        result.seconds = seconds;
+        if (lane[i] >= 0) {
+            result.instructions = lanes.getRetired(lane[i]);
+        }
+        for (int r = 0; r < 32; r++) {
+            result.registers[r] = cpus[i]->readRegister(r);
+        }
+        result.pc = cpus[i]->readPC();
+    }
+}
+
+// run the whole manifest, printing each result once all earlier ones are printed
+void BatchRunner::run(ostream &out) {
+    results.assign(programs.size(), BatchResult());
+    vector<bool> finished(programs.size(), false);
+    mutex outputLock;
+    size_t nextToPrint = 0;
+
+    ThreadPool pool(threads);
+    size_t group = engine == ENGINE_LANES ? LaneEngine::LANES : 1;
+    for (size_t i = 0; i < programs.size(); i += group) {
+        size_t count = min(group, programs.size() - i);
+        pool.submit([this, i, count, &finished, &outputLock, &nextToPrint, &out] {
+            if (engine == ENGINE_LANES) {
+                runLanes(i, count);
+            } else {
+                runOne(i);
+            }
+            lock_guard<mutex> guard(outputLock);
+            fill(finished.begin() + i, finished.begin() + i + count, true);
+            while (nextToPrint < finished.size() && finished[nextToPrint]) {
+                writeResult(out, results[nextToPrint++]);
+            }
+        });
+    }
+    pool.wait();
+    out.flush();
+}
+
+// one JSON object per line
+void BatchRunner::writeResult(ostream &out, const BatchResult &result) {
+    out << "{\"program\":\"";
+    for (char c : result.path) {
+        if (c == '"' || c == '\\') {
+            out << '\\';
+        }
+        out << c;
+    }
+    out << "\",\"status\":\"" << (result.loaded ? "ok" : "load_error") << "\"";
+    if (result.loaded) {
+        out << ",\"a0\":" << result.registers[10] << ",\"a1\":" << result.registers[11]
+            << ",\"pc\":" << result.pc << ",\"instructions\":" << result.instructions
+            << ",\"seconds\":" << result.seconds << ",\"registers\":[";
+        for (int i = 0; i < 32; i++) {
+            out << (i ? "," : "") << result.registers[i];
+        }
+        out << "]";
+    }
+    out << "}\n";
+}
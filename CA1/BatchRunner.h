@@ -0,0 +1,44 @@
+#ifndef BATCHRUNNER_H
+#define BATCHRUNNER_H
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Simulator.h"
+
+// outcome of running one program of a batch
+struct BatchResult {
+    std::string path;
+    bool loaded;
+    int32_t registers[32];
+    uint32_t pc;
+    uint64_t instructions;
+    double seconds;
+};
+
+// runs every program listed in a manifest on its own CPU across a thread
+// pool and writes one JSON line per program, in manifest order. the lanes
+// engine runs consecutive programs together, LaneEngine::LANES per task, or
+// each on the threaded engine in builds where LaneEngine isn't WORTHWHILE
+class BatchRunner {
+    public:
+        BatchRunner(Engine engine, unsigned threads);
+        bool readManifest(const char *path); // one program per line, # starts a comment
+        // Loader::mapSpec files to map into every program once it is loaded
+        void setMaps(const std::vector<const char *> &specs) { maps.assign(specs.begin(), specs.end()); }
+        void run(std::ostream &out);
+        size_t size() { return programs.size(); }
+    private:
+        bool load(const std::string &path, CPU &cpu, Program &program);
+        void runOne(size_t index);
+        void runLanes(size_t first, size_t count);
+        void writeResult(std::ostream &out, const BatchResult &result);
+        Engine engine;
+        unsigned threads;
+        std::vector<std::string> programs;
+        std::vector<std::string> maps;
+        std::vector<BatchResult> results;
+};
+
+#endif // BATCHRUNNER_H
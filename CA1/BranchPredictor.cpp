@@ -0,0 +1,46 @@
+#include "BranchPredictor.h"
+#include <cstdlib>
+using namespace std;
+
+static const int DEFAULT_BITS = 12;
+static const int MAX_BITS = 24;
+
+unique_ptr<BranchPredictor> BranchPredictor::create(const string &spec) {
+    size_t colon = spec.find(':');
+    string kind = spec.substr(0, colon);
+    int bits = DEFAULT_BITS;
+    if (colon != string::npos) {
+        char *end;
+        bits = strtol(spec.c_str() + colon + 1, &end, 10);
+        if (*end != '\0' || bits < 1 || bits > MAX_BITS || (kind != "bimodal" && kind != "gshare")) {
+            return nullptr;
+        }
+    }
+    if (kind == "nottaken") {
+        return unique_ptr<BranchPredictor>(new NotTakenPredictor());
+    }
+    if (kind == "btfn") {
+        return unique_ptr<BranchPredictor>(new BtfnPredictor());
+    }
+    if (kind == "bimodal" || kind == "gshare") {
+        return unique_ptr<BranchPredictor>(new CounterPredictor(bits, kind == "gshare"));
+    }
+    return nullptr;
+}
+
+CounterPredictor::CounterPredictor(int bits, bool global) : global(global) {
+    name = string(global ? "gshare:" : "bimodal:") + to_string(bits);
+    mask = (1u << bits) - 1;
+    history = 0;
+    counters.assign(size_t(1) << bits, 1);
+}
+
+void CounterPredictor::update(uint32_t pc, bool taken) {
+    uint8_t &counter = counters[index(pc)];
+    if (taken && counter < 3) {
+        counter++;
+    } else if (!taken && counter > 0) {
+        counter--;
+    }
+    history = (history << 1) | taken;
+}
@@ -0,0 +1,58 @@
+#ifndef BRANCHPREDICTOR_H
+#define BRANCHPREDICTOR_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// direction predictor for conditional branches in the pipeline model's
+// fetch stage. predict sees only what fetch knows, the pc and the target a
+// btb hit would give; update gets the outcome once the branch resolves
+class BranchPredictor {
+    public:
+        virtual ~BranchPredictor() {}
+        virtual bool predict(uint32_t pc, uint32_t target) = 0;
+        virtual void update(uint32_t pc, bool taken) = 0;
+        const std::string &getName() { return name; }
+
+        // "nottaken", "btfn", "bimodal[:bits]" or "gshare[:bits]" with bits
+        // of counter table index (default 12); nullptr for anything else
+        static std::unique_ptr<BranchPredictor> create(const std::string &spec);
+    protected:
+        std::string name;
+};
+
+// every branch falls through
+class NotTakenPredictor : public BranchPredictor {
+    public:
+        NotTakenPredictor() { name = "nottaken"; }
+        bool predict(uint32_t, uint32_t) override { return false; }
+        void update(uint32_t, bool) override {}
+};
+
+// backward branches close loops, so they are taken and forward ones are not
+class BtfnPredictor : public BranchPredictor {
+    public:
+        BtfnPredictor() { name = "btfn"; }
+        bool predict(uint32_t pc, uint32_t target) override { return target <= pc; }
+        void update(uint32_t, bool) override {}
+};
+
+// 2-bit saturating counters indexed by pc, or by pc xor global history for
+// gshare. counters start weakly not taken
+class CounterPredictor : public BranchPredictor {
+    public:
+        CounterPredictor(int bits, bool global);
+        bool predict(uint32_t pc, uint32_t) override { return counters[index(pc)] >= 2; }
+        void update(uint32_t pc, bool taken) override;
+    private:
+        uint32_t index(uint32_t pc) { return ((pc >> 2) ^ (global ? history : 0)) & mask; }
+
+        bool global;
+        uint32_t mask;
+        uint32_t history; // recent outcomes, newest in bit 0
+        std::vector<uint8_t> counters;
+};
+
+#endif // BRANCHPREDICTOR_H
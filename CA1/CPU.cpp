@@ -5,11 +5,41 @@
 #include "MUX.h"
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
 
 // initialize cpu with pc starting at 0
 CPU::CPU() {
 	current_PC = 0;
 	next_PC = 0;
+	traceSink = nullptr;
+	caches = nullptr;
+	pipeline = nullptr;
+	locality = nullptr;
+	phases = nullptr;
+	reserved = false;
+}
+
+// same, with memory as a view of shared
+CPU::CPU(Memory &shared) : memory(shared) {
+	current_PC = 0;
+	next_PC = 0;
+	traceSink = nullptr;
+	caches = nullptr;
+	pipeline = nullptr;
+	locality = nullptr;
+	phases = nullptr;
+	reserved = false;
+}
+
+// the child gets the registers, pc and memory but none of the hooks, and
+// starts with an empty decode cache and no reservation
+void CPU::fork(CPU &child) {
+	memory.fork(child.memory);
+	for (int i = 1; i < 32; i++) {
+		child.regFile.write(i, regFile.read(i));
+	}
+	child.current_PC = current_PC;
+	child.next_PC = next_PC;
 }
 
 // return current program counter value
@@ -17,6 +47,12 @@ unsigned long CPU::readPC() {
 	return current_PC;
 }
 
+// set both current and next pc, e.g. to a program's entry point
+void CPU::setPC(unsigned long pc) {
+	current_PC = pc;
+	next_PC = pc;
+}
+
 // update current state from next state (start of new cycle)
 void CPU::updateCurrentFromNext() {
 	current_PC = next_PC;
@@ -27,16 +63,15 @@ int32_t CPU::readRegister(int regNum) {
 	return regFile.read(regNum);
 }
 
-// fetch 32-bit instruction from memory at current pc
-uint32_t CPU::fetch(char *instMem) {
-	uint8_t byte0 = instMem[current_PC];
-	uint8_t byte1 = instMem[current_PC + 1];
-	uint8_t byte2 = instMem[current_PC + 2];
-	uint8_t byte3 = instMem[current_PC + 3];
+// write value to specified register
+void CPU::writeRegister(int regNum, int32_t value) {
+	regFile.write(regNum, value);
+}
 
-	// assemble little endian bytes into 32-bit instruction
-	uint32_t currentInstruction = (byte3 << 24) | (byte2 << 16) | (byte1 << 8) | byte0;
-	return currentInstruction;
+// fetch 32-bit instruction from memory at current pc
+uint32_t CPU::fetch() {
+	// code and data share memory, which is little endian
+	return static_cast<uint32_t>(memory.read(current_PC));
 }
 
 // decode 32-bit instruction into component parts
@@ -54,56 +89,141 @@ InstructionParts CPU::decode(uint32_t instruction) {
 
 // execute decoded instruction and update next pc
 bool CPU::execute(InstructionParts parts) {
-	controller.setControlSignals(parts.opcode);
+	return executeDecoded(resolve(parts));
+}
+
+// run the controller and alu controller once for a decoded instruction
+DecodedInstruction CPU::resolve(InstructionParts parts) {
+	DecodedInstruction decoded;
+	decoded.parts = parts;
+
+	controller.setControlSignals(parts);
+	decoded.id = controller.getInstruction();
+	for (int i = 0; i < NUM_CONTROL_SIGNALS; i++) {
+		decoded.signals[i] = controller.getSignal(static_cast<ControlSignals>(i));
+	}
 
 	// determine alu operation from opcode and function fields
-	ALUOp aluOp = controller.getALUOp();
-	if (aluOp == ALU_OP_INVALID) {
-		return false;
+	decoded.aluOp = controller.getALUOp();
+	decoded.aluOperation = ALU_INVALID;
+	if (decoded.aluOp != ALU_OP_INVALID) {
+		decoded.aluOperation = aluController.getALUOperation(decoded.aluOp, parts);
 	}
+	return decoded;
+}
+
+// fetch, decode and execute one instruction, skipping decode on a cache hit
+bool CPU::step() {
+	return executeDecoded(*decodeCached());
+}
 
-	ALUOperation aluOperation = aluController.getALUOperation(aluOp, parts);
-	if (aluOperation == ALU_INVALID) {
+// look up the current pc in the decode cache, decoding it on a miss
+DecodedInstruction *CPU::decodeCached() {
+	DecodedInstruction *decoded = decodeCache.lookup(current_PC);
+	if (!decoded) {
+		decoded = decodeCache.insert(current_PC, resolve(decode(fetch())));
+	}
+	return decoded;
+}
+
+// execute a resolved instruction and update next pc
+bool CPU::executeDecoded(const DecodedInstruction &decoded) {
+	const InstructionParts &parts = decoded.parts;
+	const bool *signals = decoded.signals;
+	if (decoded.aluOp == ALU_OP_INVALID || decoded.aluOperation == ALU_INVALID) {
 		return false;
 	}
+	if (signals[ControlSignals::Atomic]) {
+		return executeAtomic(decoded);
+	}
+	if (caches) {
+		caches->fetch(current_PC);
+	}
+	if (locality) {
+		locality->fetch(current_PC);
+	}
 
 	// read source register values
 	int32_t rs1_data = regFile.read(parts.rs1);
 	int32_t rs2_data = regFile.read(parts.rs2);
 	
 	// perform alu computation with register or immediate operand using alusrc mux
-	int32_t alu_input2 = MUX::mux2(rs2_data, parts.immediate, controller.getSignal(ControlSignals::AluSrc));
-	int32_t alu_result = alu.compute(rs1_data, alu_input2, aluOperation);
+	// and the pc as the first operand for auipc
+	int32_t alu_input1 = MUX::mux2(rs1_data, static_cast<int32_t>(current_PC), signals[ControlSignals::AuiPc]);
+	int32_t alu_input2 = MUX::mux2(rs2_data, parts.immediate, signals[ControlSignals::AluSrc]);
+	int32_t alu_result = alu.compute(alu_input1, alu_input2, decoded.aluOperation);
 
 	// handle memory operations
-	if (controller.getSignal(ControlSignals::MemWrite)) {
-		memory.write(alu_result, rs2_data);
+	if ((caches || locality) && (signals[ControlSignals::MemWrite] || signals[ControlSignals::MemRead])) {
+		// funct3 & 3 is log2 of the access width for every load and store
+		uint32_t size = 1u << (parts.funct3 & 3);
+		if (signals[ControlSignals::MemWrite]) {
+			if (caches) {
+				caches->store(alu_result, size);
+			}
+			if (locality) {
+				locality->store(alu_result, size);
+			}
+		} else {
+			if (caches) {
+				caches->load(alu_result, size);
+			}
+			if (locality) {
+				locality->load(alu_result, size);
+			}
+		}
+	}
+	if (signals[ControlSignals::MemWrite]) {
+		// store width comes from funct3
+		if (parts.funct3 == 0x0) { // SB
+			memory.writeByte(alu_result, rs2_data & 0xFF);
+		} else if (parts.funct3 == 0x1) { // SH
+			memory.writeHalf(alu_result, rs2_data & 0xFFFF);
+		} else { // SW
+			memory.write(alu_result, rs2_data);
+		}
+		decodeCache.invalidate(alu_result); // self-modifying code must be decoded again
 	}
 
 	int32_t mem_data = alu_result; // default to alu result
-	if (controller.getSignal(ControlSignals::MemRead)) {
+	if (signals[ControlSignals::MemRead]) {
 		// distinguish between different load instruction types
-		if (parts.funct3 == 0x4) { // LBU (Load Byte Unsigned)
-			uint8_t byte_data = memory.readByte(alu_result);
-			mem_data = static_cast<int32_t>(byte_data); // zero-extend the byte
-		} else if (parts.funct3 == 0x2) { // LW (Load Word)
-			mem_data = memory.read(alu_result);
+		switch (parts.funct3) {
+			case 0x0: // LB (sign-extend the byte)
+				mem_data = static_cast<int8_t>(memory.readByte(alu_result));
+				break;
+			case 0x1: // LH (sign-extend the halfword)
+				mem_data = static_cast<int16_t>(memory.readHalf(alu_result));
+				break;
+			case 0x2: // LW
+				mem_data = memory.read(alu_result);
+				break;
+			case 0x4: // LBU (zero-extend the byte)
+				mem_data = memory.readByte(alu_result);
+				break;
+			case 0x5: // LHU (zero-extend the halfword)
+				mem_data = memory.readHalf(alu_result);
+				break;
 		}
 	}
 
 	// register writeback data mux: select between alu result and memory data
-	int32_t writeback_data = MUX::mux2(alu_result, mem_data, controller.getSignal(ControlSignals::MemRead));
+	int32_t writeback_data = MUX::mux2(alu_result, mem_data, signals[ControlSignals::MemRead]);
 
 	// pc source calculation
 	uint32_t pc_plus_4 = current_PC + 4;
 	uint32_t branch_target = current_PC + parts.immediate;
 	uint32_t jump_target = alu_result & ~1; // ensure alignment for jalr
 
-	// determine pc source: 0=pc+4, 1=branch, 2=jump
+	// determine pc source: 0=pc+4, 1=branch or jal, 2=jump (jalr)
+	// branches compare with sub/slt/sltu and test the result for zero or non-zero
 	int pc_src = 0;
-	if (controller.getSignal(ControlSignals::Branch) && alu_result != 0) {
+	if (signals[ControlSignals::Branch] && ((alu_result != 0) != signals[ControlSignals::BranchOnZero])) {
 		pc_src = 1; // take branch
-	} else if (controller.getSignal(ControlSignals::Link)) {
+	} else if (signals[ControlSignals::Jump]) {
+		pc_src = 1; // jal
+		writeback_data = pc_plus_4; // link register gets return address
+	} else if (signals[ControlSignals::Link]) {
 		pc_src = 2; // jump (jalr)
 		writeback_data = pc_plus_4; // link register gets return address
 	}
@@ -112,12 +232,111 @@ bool CPU::execute(InstructionParts parts) {
 	next_PC = MUX::mux3_pc(pc_plus_4, branch_target, jump_target, pc_src);
 
 	// register writeback
-	if(controller.getSignal(ControlSignals::RegWrite)) {
+	if(signals[ControlSignals::RegWrite]) {
 		regFile.write(parts.rd, writeback_data);
 	}
+	if (traceSink || pipeline || phases) {
+		retire(alu_result, pc_src != 0, decoded);
+	}
+	return true;
+}
+
+// atomics read, modify and write the word at rs1 in one host atomic, so
+// harts running on other host threads see them whole. fence becomes a full
+// host fence
+bool CPU::executeAtomic(const DecodedInstruction &decoded) {
+	const InstructionParts &parts = decoded.parts;
+	uint32_t address = regFile.read(parts.rs1);
+	int32_t source = regFile.read(parts.rs2);
+	if (decoded.id != INST_FENCE && (address & 3)) {
+		return false; // misaligned atomics trap, which ends the simulation
+	}
+	if (caches) {
+		caches->fetch(current_PC);
+		if (decoded.signals[ControlSignals::MemWrite]) {
+			caches->store(address, 4);
+		} else if (decoded.signals[ControlSignals::MemRead]) {
+			caches->load(address, 4);
+		}
+	}
+	if (locality) {
+		locality->fetch(current_PC);
+		if (decoded.signals[ControlSignals::MemWrite]) {
+			locality->store(address, 4);
+		} else if (decoded.signals[ControlSignals::MemRead]) {
+			locality->load(address, 4);
+		}
+	}
+
+	int32_t *word = decoded.id == INST_FENCE ? nullptr : memory.atomicWord(address);
+	int32_t result = 0;
+	switch (decoded.id) {
+		case INST_FENCE:
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			break;
+		case INST_LR_W:
+			result = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+			reserved = true;
+			reservedAddress = address;
+			reservedValue = result;
+			break;
+		case INST_SC_W: {
+			int32_t expected = reservedValue;
+			bool stored = reserved && reservedAddress == address
+				&& __atomic_compare_exchange_n(word, &expected, source, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+			reserved = false;
+			result = stored ? 0 : 1;
+			break;
+		}
+		case INST_AMOSWAP_W: result = __atomic_exchange_n(word, source, __ATOMIC_SEQ_CST); break;
+		case INST_AMOADD_W:  result = __atomic_fetch_add(word, source, __ATOMIC_SEQ_CST); break;
+		case INST_AMOXOR_W:  result = __atomic_fetch_xor(word, source, __ATOMIC_SEQ_CST); break;
+		case INST_AMOAND_W:  result = __atomic_fetch_and(word, source, __ATOMIC_SEQ_CST); break;
+		case INST_AMOOR_W:   result = __atomic_fetch_or(word, source, __ATOMIC_SEQ_CST); break;
+		default: {
+			// min and max have no host instruction; retry until nothing else wrote in between
+			result = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+			int32_t value;
+			do {
+				switch (decoded.id) {
+					case INST_AMOMIN_W:  value = min(result, source); break;
+					case INST_AMOMAX_W:  value = max(result, source); break;
+					case INST_AMOMINU_W: value = min(static_cast<uint32_t>(result), static_cast<uint32_t>(source)); break;
+					default:             value = max(static_cast<uint32_t>(result), static_cast<uint32_t>(source)); break;
+				}
+			} while (!__atomic_compare_exchange_n(word, &result, value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+			break;
+		}
+	}
+	if (decoded.signals[ControlSignals::MemWrite]) {
+		decodeCache.invalidate(address);
+	}
+
+	next_PC = current_PC + 4;
+	if (decoded.signals[ControlSignals::RegWrite]) {
+		regFile.write(parts.rd, result);
+	}
+	if (traceSink || pipeline || phases) {
+		retire(address, false, decoded);
+	}
 	return true;
 }
 
+// hand a retired instruction to the trace sink, the pipeline model and the
+// phase profiler
+void CPU::retire(uint32_t address, bool taken, const DecodedInstruction &decoded) {
+	TraceRecord record{static_cast<uint32_t>(current_PC), static_cast<uint32_t>(next_PC), address, taken, &decoded};
+	if (traceSink) {
+		traceSink->retire(record);
+	}
+	if (pipeline) {
+		pipeline->retire(record);
+	}
+	if (phases) {
+		phases->retire(record);
+	}
+}
+
 // debug function to print all register values in hex format
 void CPU::printAllRegisters() {
 	cout << "=== Register Contents ===" << endl;
@@ -136,4 +355,4 @@ void CPU::printAllRegisters() {
 		cout << endl;
 	}
 	cout << "========================" << endl;
-}
\ No newline at end of file
+}
\ No newline at end of file
@@ -13,6 +13,12 @@
 #include "Memory.h"
 #include "Controller.h"
 #include "MUX.h"
+#include "DecodeCache.h"
+#include "TraceSink.h"
+#include "CacheModel.h"
+#include "PipelineModel.h"
+#include "LocalityAnalyzer.h"
+#include "PhaseProfiler.h"
 using namespace std;
 
 
@@ -26,22 +32,60 @@ using namespace std;
 class CPU {
 public:
 	CPU();
+	explicit CPU(Memory &shared); // a hart on another hart's memory, which must outlive it
 	unsigned long readPC();
-	uint32_t fetch(char *instMem); // fetch the 32-bit instruction from instruction memory
+	void setPC(unsigned long pc); // start execution at pc
+	uint32_t fetch(); // fetch the 32-bit instruction from memory
 	InstructionParts decode(uint32_t instruction); // decode the fetched instruction
 	bool execute(InstructionParts parts); // execute the ALU instructions
+	DecodedInstruction resolve(InstructionParts parts); // resolve control signals and alu operation
+	bool executeDecoded(const DecodedInstruction &decoded); // execute an already resolved instruction
+	bool executeAtomic(const DecodedInstruction &decoded); // rv32a and fence, as host atomics
+	bool step(); // fetch, decode and execute through the decode cache
+	DecodedInstruction *decodeCached(); // the decode cache entry for the current pc, filling it on a miss
+	DecodeCache &getDecodeCache() { return decodeCache; }
+	Memory &getMemory() { return memory; }
 	int32_t readRegister(int regNum); // read register value
+	void writeRegister(int regNum, int32_t value); // write register value, e.g. when restoring state
 	void printAllRegisters(); // debug function to print all register values
 	void updateCurrentFromNext();
+	void fork(CPU &child); // make child, a fresh cpu, a copy of this one with memory shared copy-on-write
+	void setTraceSink(TraceSink *sink) { traceSink = sink; } // nullptr to stop tracing
+	TraceSink *getTraceSink() { return traceSink; }
+	void setCaches(CacheHierarchy *caches) { this->caches = caches; } // nullptr to stop modelling caches
+	CacheHierarchy *getCaches() { return caches; }
+	void setPipeline(PipelineModel *pipeline) { this->pipeline = pipeline; } // nullptr to stop modelling the pipeline
+	PipelineModel *getPipeline() { return pipeline; }
+	void setLocality(LocalityAnalyzer *locality) { this->locality = locality; } // nullptr to stop analyzing
+	LocalityAnalyzer *getLocality() { return locality; }
+	void setPhases(PhaseProfiler *phases) { this->phases = phases; } // nullptr to stop collecting basic block vectors
+	PhaseProfiler *getPhases() { return phases; }
 private:
+	friend class ThreadedEngine;
+	friend class JitEngine;
+
 	ImmGen immGen;
 	ALU alu;
 	ALUController aluController;
 	Controller controller;
 	RegFile regFile;
 	Memory memory;
+	DecodeCache decodeCache;
+	TraceSink *traceSink; // sees every instruction retired through executeDecoded
+	CacheHierarchy *caches; // timing model fed by executeDecoded's fetches, loads and stores
+	PipelineModel *pipeline; // timing model fed every retired instruction, after caches sees its accesses
+	LocalityAnalyzer *locality; // fed the same fetches, loads and stores as caches
+	PhaseProfiler *phases; // basic block vectors of every retired instruction
+
+	void retire(uint32_t address, bool taken, const DecodedInstruction &decoded);
 
 	unsigned long current_PC, next_PC;
+
+	// lr.w reservation. sc.w succeeds if the word still holds the value lr.w
+	// read, a compare and swap that other harts' stores can't slip past
+	bool reserved;
+	uint32_t reservedAddress;
+	int32_t reservedValue;
 };
 
-#endif // CPU_H
\ No newline at end of file
+#endif // CPU_H
\ No newline at end of file
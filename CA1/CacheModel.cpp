@@ -0,0 +1,358 @@
+#include "CacheModel.h"
+#include <cstdlib>
+#include <iomanip>
+using namespace std;
+
+static const uint32_t MAX_WAYS = 64; // plru trees fit in a uint64_t
+
+static bool powerOfTwo(uint32_t value) {
+    return value && (value & (value - 1)) == 0;
+}
+
+static int log2Of(uint32_t value) {
+    int bits = 0;
+    while ((1u << bits) < value) {
+        bits++;
+    }
+    return bits;
+}
+
+CacheLevel::CacheLevel(const string &name, const CacheConfig &config) : name(name), config(config) {
+    lineBits = log2Of(config.lineSize);
+    sets = config.size / (config.ways * config.lineSize);
+    tags.assign(sets * config.ways, INVALID_TAG);
+    dirty.assign(sets * config.ways, 0);
+    trees.assign(sets, 0);
+    ages.resize(sets * config.ways);
+    for (uint32_t set = 0; set < sets; set++) {
+        for (uint32_t way = 0; way < config.ways; way++) {
+            // lru ages stay a permutation of 0..ways-1, so the oldest way is
+            // always an empty one while any are left. rrip fills empty ways
+            // first by predicting them distant
+            ages[set * config.ways + way] = config.policy == REPLACE_LRU ? way : RRPV_MAX;
+        }
+    }
+    lastLine = INVALID_TAG;
+    lastSlot = 0;
+    accesses = misses = evictions = writebacks = 0;
+}
+
+bool CacheLevel::access(uint32_t address, bool write, bool allocate, bool &evictedDirty, uint32_t &writeback) {
+    accesses++;
+    evictedDirty = false;
+    uint32_t line = address >> lineBits;
+    if (line == lastLine) {
+        dirty[lastSlot] |= write && config.writeBack;
+        // the line is already the most recent under lru and plru, but under
+        // rrip a hit right after the fill still promotes it
+        if (config.policy == REPLACE_RRIP) {
+            ages[lastSlot] = 0;
+        }
+        return true;
+    }
+
+    uint32_t set = line & (sets - 1);
+    uint32_t base = set * config.ways;
+    const uint32_t *setTags = &tags[base];
+    for (uint32_t way = 0; way < config.ways; way++) {
+        if (setTags[way] == line) {
+            touch(set, way, false);
+            dirty[base + way] |= write && config.writeBack;
+            lastLine = line;
+            lastSlot = base + way;
+            return true;
+        }
+    }
+
+    misses++;
+    if (!allocate) {
+        return false;
+    }
+    uint32_t way = victim(set);
+    uint32_t slot = base + way;
+    if (tags[slot] != INVALID_TAG) {
+        evictions++;
+        if (dirty[slot]) {
+            writebacks++;
+            evictedDirty = true;
+            writeback = tags[slot] << lineBits;
+        }
+    }
+    tags[slot] = line;
+    dirty[slot] = write && config.writeBack;
+    touch(set, way, true);
+    lastLine = line;
+    lastSlot = slot;
+    return false;
+}
+
+// the way to replace in a full or partly empty set
+uint32_t CacheLevel::victim(uint32_t set) {
+    uint32_t base = set * config.ways;
+    switch (config.policy) {
+        case REPLACE_LRU: {
+            uint32_t oldest = 0;
+            for (uint32_t way = 1; way < config.ways; way++) {
+                if (ages[base + way] > ages[base + oldest]) {
+                    oldest = way;
+                }
+            }
+            return oldest;
+        }
+        case REPLACE_PLRU: {
+            for (uint32_t way = 0; way < config.ways; way++) {
+                if (tags[base + way] == INVALID_TAG) {
+                    return way;
+                }
+            }
+            // each node bit points at the less recently used half
+            uint32_t node = 1;
+            while (node < config.ways) {
+                node = 2 * node + ((trees[set] >> node) & 1);
+            }
+            return node - config.ways;
+        }
+        default: {
+            // age every line until one is predicted distant
+            while (true) {
+                for (uint32_t way = 0; way < config.ways; way++) {
+                    if (ages[base + way] == RRPV_MAX) {
+                        return way;
+                    }
+                }
+                for (uint32_t way = 0; way < config.ways; way++) {
+                    ages[base + way]++;
+                }
+            }
+        }
+    }
+}
+
+// update replacement state for a hit or fill of way
+void CacheLevel::touch(uint32_t set, uint32_t way, bool fill) {
+    uint32_t base = set * config.ways;
+    switch (config.policy) {
+        case REPLACE_LRU: {
+            uint8_t age = ages[base + way];
+            for (uint32_t other = 0; other < config.ways; other++) {
+                ages[base + other] += ages[base + other] < age;
+            }
+            ages[base + way] = 0;
+            break;
+        }
+        case REPLACE_PLRU: {
+            // point every node on the path away from way
+            uint32_t node = way + config.ways;
+            while (node > 1) {
+                uint32_t parent = node >> 1;
+                if (node & 1) {
+                    trees[set] &= ~(1ull << parent);
+                } else {
+                    trees[set] |= 1ull << parent;
+                }
+                node = parent;
+            }
+            break;
+        }
+        default:
+            // hits predict a near re-reference, fills a long one
+            ages[base + way] = fill ? RRPV_MAX - 1 : 0;
+            break;
+    }
+}
+
+CacheHierarchy::CacheHierarchy(const CacheConfig &l1i, const CacheConfig &l1d, const CacheConfig *l2, uint32_t memoryLatency)
+    : memoryLatency(memoryLatency) {
+    l1[INSTRUCTION].reset(new CacheLevel("l1i", l1i));
+    l1[DATA].reset(new CacheLevel("l1d", l1d));
+    if (l2) {
+        this->l2.reset(new CacheLevel("l2", *l2));
+    }
+    memoryReads = memoryWrites = 0;
+    for (int side = 0; side < NUM_SIDES; side++) {
+        requests[side] = cycles[side] = 0;
+    }
+}
+
+// a size with an optional k or m suffix
+static bool parseSize(const string &text, uint32_t &size) {
+    char *end;
+    unsigned long value = strtoul(text.c_str(), &end, 10);
+    if (end == text.c_str()) {
+        return false;
+    }
+    if (*end == 'k' || *end == 'K') {
+        value <<= 10;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        value <<= 20;
+        end++;
+    }
+    size = value;
+    return *end == '\0' && value == size;
+}
+
+// size/ways/line[/policy[/wb|wt[/latency]]]
+static bool parseLevel(const string &text, CacheConfig &config, string &error) {
+    vector<string> fields;
+    size_t start = 0;
+    while (true) {
+        size_t slash = text.find('/', start);
+        fields.push_back(text.substr(start, slash - start));
+        if (slash == string::npos) {
+            break;
+        }
+        start = slash + 1;
+    }
+    if (fields.size() < 3 || fields.size() > 6 || !parseSize(fields[0], config.size)
+        || !parseSize(fields[1], config.ways) || !parseSize(fields[2], config.lineSize)) {
+        error = "expected size/ways/line[/policy[/wb|wt[/latency]]] in " + text;
+        return false;
+    }
+    if (fields.size() > 3) {
+        if (fields[3] == "lru") {
+            config.policy = REPLACE_LRU;
+        } else if (fields[3] == "plru") {
+            config.policy = REPLACE_PLRU;
+        } else if (fields[3] == "rrip") {
+            config.policy = REPLACE_RRIP;
+        } else {
+            error = "unknown replacement policy " + fields[3];
+            return false;
+        }
+    }
+    if (fields.size() > 4) {
+        if (fields[4] != "wb" && fields[4] != "wt") {
+            error = "unknown write policy " + fields[4];
+            return false;
+        }
+        config.writeBack = fields[4] == "wb";
+    }
+    if (fields.size() > 5 && !parseSize(fields[5], config.latency)) {
+        error = "bad latency " + fields[5];
+        return false;
+    }
+    if (!powerOfTwo(config.lineSize) || config.lineSize < 4 || config.ways == 0 || config.ways > MAX_WAYS
+        || config.size % (config.ways * config.lineSize) || !powerOfTwo(config.size / (config.ways * config.lineSize))) {
+        error = "size, ways and line in " + text + " must give a power of two number of sets, "
+            "with a line of at least 4 bytes and at most 64 ways";
+        return false;
+    }
+    if (config.policy == REPLACE_PLRU && !powerOfTwo(config.ways)) {
+        error = "plru needs a power of two number of ways in " + text;
+        return false;
+    }
+    return true;
+}
+
+unique_ptr<CacheHierarchy> CacheHierarchy::create(const string &spec, string &error) {
+    CacheConfig l1i = {32u << 10, 8, 64, REPLACE_LRU, true, 4};
+    CacheConfig l1d = {32u << 10, 8, 64, REPLACE_LRU, true, 4};
+    CacheConfig l2 = {1u << 20, 16, 64, REPLACE_LRU, true, 12};
+    bool hasL2 = true;
+    uint32_t memoryLatency = 100;
+
+    size_t start = 0;
+    while (spec != "default" && start <= spec.size()) {
+        size_t comma = spec.find(',', start);
+        string item = spec.substr(start, comma - start);
+        start = comma == string::npos ? spec.size() + 1 : comma + 1;
+        size_t equals = item.find('=');
+        string key = item.substr(0, equals);
+        string value = equals == string::npos ? "" : item.substr(equals + 1);
+        bool ok;
+        if (key == "l1i") {
+            ok = parseLevel(value, l1i, error);
+        } else if (key == "l1d") {
+            ok = parseLevel(value, l1d, error);
+        } else if (key == "l2" && value == "none") {
+            hasL2 = false;
+            ok = true;
+        } else if (key == "l2") {
+            hasL2 = true;
+            ok = parseLevel(value, l2, error);
+        } else if (key == "mem") {
+            ok = parseSize(value, memoryLatency);
+            if (!ok) {
+                error = "bad memory latency " + value;
+            }
+        } else {
+            error = "unknown cache level " + key;
+            ok = false;
+        }
+        if (!ok) {
+            return nullptr;
+        }
+    }
+    return unique_ptr<CacheHierarchy>(new CacheHierarchy(l1i, l1d, hasL2 ? &l2 : nullptr, memoryLatency));
+}
+
+// an access that crosses into a second line costs both lines
+void CacheHierarchy::access(Side side, uint32_t address, uint32_t size, bool write) {
+    CacheLevel *cache = l1[side].get();
+    requests[side]++;
+    cycles[side] += accessLevel(cache, l2.get(), address, write);
+    uint32_t last = address + size - 1;
+    if (cache->lineOf(last) != cache->lineOf(address)) {
+        cycles[side] += accessLevel(cache, l2.get(), last, write);
+    }
+}
+
+uint64_t CacheHierarchy::accessLevel(CacheLevel *cache, CacheLevel *next, uint32_t address, bool write) {
+    if (!cache) {
+        if (write) {
+            memoryWrites++;
+        } else {
+            memoryReads++;
+        }
+        return memoryLatency;
+    }
+    const CacheConfig &config = cache->getConfig();
+    uint64_t cost = config.latency;
+    bool allocate = !write || config.writeBack;
+    bool evictedDirty;
+    uint32_t writeback;
+    bool hit = cache->access(address, write, allocate, evictedDirty, writeback);
+    if (evictedDirty) {
+        accessLevel(next, nullptr, writeback, true);
+    }
+    if (!hit && allocate) {
+        cost += accessLevel(next, nullptr, address, false); // line fill
+    }
+    if (write && !config.writeBack) {
+        accessLevel(next, nullptr, address, true); // write through
+    }
+    return cost;
+}
+
+static void printLevel(ostream &out, CacheLevel &level) {
+    const CacheConfig &config = level.getConfig();
+    static const char *const POLICY_NAMES[] = {"lru", "plru", "rrip"};
+    out << level.getName() << ": " << config.size / 1024 << " KB " << config.ways << "-way "
+        << config.lineSize << " B lines " << POLICY_NAMES[config.policy] << (config.writeBack ? " wb" : " wt")
+        << ", " << level.getAccesses() << " accesses, " << level.getHits() << " hits, " << level.getMisses()
+        << " misses";
+    if (level.getAccesses()) {
+        out << " (" << fixed << setprecision(2) << 100.0 * level.getMisses() / level.getAccesses() << "%)";
+    }
+    out << ", " << level.getEvictions() << " evictions, " << level.getWritebacks() << " writebacks" << endl;
+}
+
+// per level counts and the average memory access time of each side
+void CacheHierarchy::printStats(ostream &out) {
+    ios::fmtflags flags = out.flags();
+    streamsize precision = out.precision();
+    printLevel(out, *l1[INSTRUCTION]);
+    printLevel(out, *l1[DATA]);
+    if (l2) {
+        printLevel(out, *l2);
+    }
+    out << "memory: " << memoryReads << " line reads, " << memoryWrites << " writes, "
+        << memoryLatency << " cycle latency" << endl;
+    out << "amat: " << fixed << setprecision(3)
+        << (requests[INSTRUCTION] ? double(cycles[INSTRUCTION]) / requests[INSTRUCTION] : 0.0)
+        << " cycles instruction, "
+        << (requests[DATA] ? double(cycles[DATA]) / requests[DATA] : 0.0) << " cycles data" << endl;
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,116 @@
+#ifndef CACHEMODEL_H
+#define CACHEMODEL_H
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum ReplacementPolicy {
+    REPLACE_LRU,  // true lru from per-way ages
+    REPLACE_PLRU, // tree pseudo-lru, one bit per internal node
+    REPLACE_RRIP, // static rrip with 2-bit re-reference predictions
+};
+
+struct CacheConfig {
+    uint32_t size;      // bytes
+    uint32_t ways;
+    uint32_t lineSize;  // bytes, a power of two
+    ReplacementPolicy policy;
+    bool writeBack;     // write back and allocate on a store miss, otherwise write through around the level
+    uint32_t latency;   // cycles for a hit
+};
+
+// one set-associative level. it only tracks which lines are present, since
+// Memory still holds the data. tags and replacement state are flat arrays
+// with each set's ways next to each other, so a lookup touches one or two
+// host cache lines
+class CacheLevel {
+    public:
+        CacheLevel(const std::string &name, const CacheConfig &config);
+
+        // look up the line holding address, filling it on a miss when
+        // allocate is set. the address of a dirty line evicted by the fill
+        // goes to writeback. returns true on a hit
+        bool access(uint32_t address, bool write, bool allocate, bool &evictedDirty, uint32_t &writeback);
+
+        const std::string &getName() { return name; }
+        const CacheConfig &getConfig() { return config; }
+        uint32_t lineOf(uint32_t address) { return address >> lineBits; }
+        uint64_t getAccesses() { return accesses; }
+        uint64_t getHits() { return accesses - misses; }
+        uint64_t getMisses() { return misses; }
+        uint64_t getEvictions() { return evictions; }
+        uint64_t getWritebacks() { return writebacks; }
+    private:
+        static const uint32_t INVALID_TAG = 0xFFFFFFFF; // line numbers never reach this with lines of 2+ bytes
+        static const uint8_t RRPV_MAX = 3;
+
+        uint32_t victim(uint32_t set);
+        void touch(uint32_t set, uint32_t way, bool fill);
+
+        std::string name;
+        CacheConfig config;
+        int lineBits;
+        uint32_t sets;
+        std::vector<uint32_t> tags;  // sets * ways line numbers
+        std::vector<uint8_t> ages;   // lru age or rrip prediction per way
+        std::vector<uint8_t> dirty;  // per way
+        std::vector<uint64_t> trees; // plru bits per set
+
+        // the most recently used line. repeating an access to it changes no
+        // lru or plru state and at most its own rrip prediction, so it skips
+        // the set search
+        uint32_t lastLine;
+        uint32_t lastSlot;
+
+        uint64_t accesses, misses, evictions, writebacks;
+};
+
+// split l1 instruction and data caches in front of an optional unified l2
+// and main memory. every access is charged the latency of each level it has
+// to reach, which gives the average memory access time directly. stores to
+// a write through level and writebacks of dirty lines are assumed to drain
+// through a write buffer, so they cost no cycles
+class CacheHierarchy {
+    public:
+        CacheHierarchy(const CacheConfig &l1i, const CacheConfig &l1d, const CacheConfig *l2, uint32_t memoryLatency);
+
+        // spec is "default" or comma separated overrides of the default
+        // hierarchy: l1i=, l1d= or l2=size/ways/line[/policy[/wb|wt[/latency]]]
+        // with sizes like 32k or 1m, l2=none, and mem=<latency>. nullptr with
+        // a message in error for a bad spec
+        static std::unique_ptr<CacheHierarchy> create(const std::string &spec, std::string &error);
+
+        void fetch(uint32_t pc) { access(INSTRUCTION, pc, 4, false); }
+        void load(uint32_t address, uint32_t size) { access(DATA, address, size, false); }
+        void store(uint32_t address, uint32_t size) { access(DATA, address, size, true); }
+
+        void printStats(std::ostream &out);
+
+        enum Side {
+            INSTRUCTION,
+            DATA,
+            NUM_SIDES,
+        };
+        // cpu accesses and the cycles they took so far, and the cycles of
+        // an l1 hit, so other timing models can tell what a miss cost
+        uint64_t getRequests(Side side) { return requests[side]; }
+        uint64_t getCycles(Side side) { return cycles[side]; }
+        uint32_t getHitLatency(Side side) { return l1[side]->getConfig().latency; }
+    private:
+        void access(Side side, uint32_t address, uint32_t size, bool write);
+        // one line at cache, with next below it and main memory below that
+        // (nullptr for memory itself). returns the cycles the access took
+        uint64_t accessLevel(CacheLevel *cache, CacheLevel *next, uint32_t address, bool write);
+
+        std::unique_ptr<CacheLevel> l1[NUM_SIDES];
+        std::unique_ptr<CacheLevel> l2;
+        uint32_t memoryLatency;
+        uint64_t memoryReads, memoryWrites;
+        uint64_t requests[NUM_SIDES]; // cpu accesses, a line crossing counts once
+        uint64_t cycles[NUM_SIDES];
+};
+
+#endif // CACHEMODEL_H
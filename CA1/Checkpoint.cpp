@@ -0,0 +1,179 @@
+#include "Checkpoint.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+using namespace std;
+
+static const char CHECKPOINT_MAGIC[8] = "RVCKPT2";
+
+// offset of the first page: header and page list rounded up to a page
+static size_t dataOffset(uint32_t pageCount) {
+    size_t size = sizeof(CheckpointHeader) + pageCount * sizeof(uint32_t);
+    return (size + Memory::PAGE_SIZE - 1) & ~static_cast<size_t>(Memory::PAGE_MASK);
+}
+
+// directory part of a path including the trailing slash, or empty
+static string directoryOf(const string &path) {
+    size_t slash = path.rfind('/');
+    return slash == string::npos ? "" : path.substr(0, slash + 1);
+}
+
+// read and check the header of a checkpoint file; the file's size and
+// identity too if asked for
+static bool readHeader(const string &path, CheckpointHeader &header, struct stat *st = nullptr) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat local;
+    if (!st) {
+        st = &local;
+    }
+    bool ok = fstat(fd, st) == 0 && (size_t)st->st_size >= sizeof(CheckpointHeader)
+        && pread(fd, &header, sizeof(header), 0) == sizeof(header);
+    close(fd);
+    return ok && memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) == 0
+        && header.pageSize == Memory::PAGE_SIZE
+        && header.parent[sizeof(header.parent) - 1] == '\0'
+        && dataOffset(header.pageCount) + (size_t)header.pageCount * Memory::PAGE_SIZE <= (size_t)st->st_size;
+}
+
+// once the parent's chain is MAX_CHAIN links long, start a new one with
+// every page in use rather than just the dirty ones
+bool Checkpoint::save(const string &path, CPU &cpu, const Program &program,
+                      uint64_t instructions, const string &parent) {
+    Memory &memory = cpu.getMemory();
+    vector<uint32_t> pages = memory.takeDirtyPages();
+    uint32_t depth = 0;
+    if (!parent.empty()) {
+        CheckpointHeader parentHeader;
+        if (!readHeader(parent, parentHeader)) {
+            return false;
+        }
+        depth = parentHeader.depth + 1;
+    }
+    string parentName = parent.substr(parent.rfind('/') + 1);
+    if (depth >= MAX_CHAIN) {
+        pages = memory.usedPages();
+        depth = 0;
+        parentName.clear();
+    }
+
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.pageSize = Memory::PAGE_SIZE;
+    header.pageCount = pages.size();
+    header.instructions = instructions;
+    header.pc = cpu.readPC();
+    header.entry = program.entry;
+    header.end = program.end;
+    for (int i = 0; i < 32; i++) {
+        header.registers[i] = cpu.readRegister(i);
+    }
+    header.depth = depth;
+    if (parentName.size() >= sizeof(header.parent)) {
+        return false;
+    }
+    strcpy(header.parent, parentName.c_str());
+
+    FILE *out = fopen(path.c_str(), "wb");
+    if (!out) {
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = ok && (pages.empty() || fwrite(pages.data(), sizeof(uint32_t), pages.size(), out) == pages.size());
+    size_t padding = dataOffset(pages.size()) - sizeof(header) - pages.size() * sizeof(uint32_t);
+    static const uint8_t zeros[Memory::PAGE_SIZE] = {};
+    ok = ok && (padding == 0 || fwrite(zeros, 1, padding, out) == padding);
+    for (size_t i = 0; ok && i < pages.size(); i++) {
+        ok = fwrite(memory.pageData(pages[i]), Memory::PAGE_SIZE, 1, out) == 1;
+    }
+    return fclose(out) == 0 && ok;
+}
+
+// map one checkpoint's pages over memory and load its registers
+static bool restoreOne(const string &path, CPU &cpu, Program &program, uint64_t &instructions) {
+    CheckpointHeader check;
+    struct stat st;
+    if (!readHeader(path, check, &st)) {
+        return false;
+    }
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    // private and writable: guest stores to restored pages copy on write
+    size_t size = st.st_size;
+    void *mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    uint8_t *data = static_cast<uint8_t *>(mapped);
+    const CheckpointHeader *header = reinterpret_cast<const CheckpointHeader *>(data);
+    if (memcmp(header, &check, sizeof(check)) != 0) {
+        munmap(mapped, size); // changed since the chain was walked
+        return false;
+    }
+
+    Memory &memory = cpu.getMemory();
+    const uint32_t *pages = reinterpret_cast<const uint32_t *>(data + sizeof(CheckpointHeader));
+    uint8_t *pageData = data + dataOffset(header->pageCount);
+    for (uint32_t i = 0; i < header->pageCount; i++) {
+        memory.mapPage(pages[i], pageData + (size_t)i * Memory::PAGE_SIZE);
+    }
+    memory.adoptMapping(mapped, size);
+
+    for (int i = 1; i < 32; i++) {
+        cpu.writeRegister(i, header->registers[i]);
+    }
+    cpu.setPC(header->pc);
+    program.entry = header->entry;
+    program.end = header->end;
+    instructions = header->instructions;
+    return true;
+}
+
+// walk the parent links to the start of the chain, then restore it oldest
+// first so that newer pages override older ones
+bool Checkpoint::restore(const string &path, CPU &cpu, Program &program, uint64_t &instructions) {
+    vector<string> chain;
+    vector<pair<dev_t, ino_t>> seen;
+    string link = path;
+    while (true) {
+        CheckpointHeader header;
+        struct stat st;
+        if (!readHeader(link, header, &st) || chain.size() == MAX_CHAIN) {
+            return false;
+        }
+        pair<dev_t, ino_t> id(st.st_dev, st.st_ino);
+        for (const pair<dev_t, ino_t> &other : seen) {
+            if (other == id) {
+                return false; // the chain loops
+            }
+        }
+        seen.push_back(id);
+        chain.push_back(link);
+        if (!header.parent[0]) {
+            break;
+        }
+        link = directoryOf(link) + header.parent;
+    }
+
+    for (size_t i = chain.size(); i-- > 0;) {
+        if (!restoreOne(chain[i], cpu, program, instructions)) {
+            return false;
+        }
+    }
+    cpu.getDecodeCache().flush();
+
+    // the restored image is the baseline for the next incremental checkpoint
+    cpu.getMemory().takeDirtyPages();
+    return true;
+}
@@ -0,0 +1,45 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdint>
+#include <string>
+#include "CPU.h"
+#include "Loader.h"
+
+// on-disk architectural state. a checkpoint holds the registers, pc and the
+// memory pages written since the previous checkpoint, and names that previous
+// checkpoint as its parent; restoring walks the chain oldest first. page data
+// is page aligned in the file and is mmapped straight into guest memory
+// copy-on-write, so a restore costs a page table update per page. a restore
+// keeps one mapping per link, so every MAX_CHAIN-th link of a chain is a full
+// checkpoint of every page in use, with no parent
+//
+// layout: CheckpointHeader, pageCount uint32 page numbers, zero padding to
+// the next page boundary, then pageCount pages
+struct CheckpointHeader {
+    char magic[8];        // "RVCKPT2"
+    uint32_t pageSize;
+    uint32_t pageCount;
+    uint64_t instructions; // retired when the checkpoint was taken
+    uint32_t pc;
+    uint32_t entry;        // Program of the checkpointed run
+    uint32_t end;
+    int32_t registers[32];
+    uint32_t depth;        // links before this one in its chain
+    char parent[256];      // file name of the previous checkpoint, relative to this one; empty for the first
+};
+
+class Checkpoint {
+    public:
+        static const uint32_t MAX_CHAIN = 1024;
+
+        // write the cpu's state; takes (and clears) the memory's dirty pages.
+        // the cpu must be stopped between instructions, e.g. by Simulator::setStop
+        static bool save(const std::string &path, CPU &cpu, const Program &program,
+                         uint64_t instructions, const std::string &parent);
+        // rebuild state from a checkpoint chain into a fresh cpu. false for
+        // a chain that loops back on itself or is over MAX_CHAIN links
+        static bool restore(const std::string &path, CPU &cpu, Program &program, uint64_t &instructions);
+};
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,247 @@
+#include "CoSimulator.h"
+#include "Checkpoint.h"
+#include "InstructionTable.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+using namespace std;
+
+static const uint8_t zeroPage[Memory::PAGE_SIZE] = {};
+
+// 64-bit multiply-xorshift hash over whole words
+static uint64_t hashWords(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 29;
+    }
+    for (size_t i = size & ~size_t(7); i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x9E3779B97F4A7C15ull;
+    }
+    return hash;
+}
+
+static const uint8_t *pageOf(CPU &cpu, uint32_t page) {
+    const uint8_t *data = cpu.getMemory().pageData(page);
+    return data ? data : zeroPage;
+}
+
+CoSimulator::CoSimulator(Engine reference, Engine candidate, Setup setup) : setup(setup) {
+    sides[0].engine = reference;
+    sides[1].engine = candidate;
+    interval = 1u << 16;
+    instructions = 0;
+    reproducer = "cosim.diverge.ckpt";
+}
+
+void CoSimulator::setReproducer(const string &path, const string &parent) {
+    reproducer = path;
+    this->parent = parent;
+}
+
+// fresh cpus for both sides with the given starting state
+bool CoSimulator::start(const Setup &setup) {
+    for (Side &side : sides) {
+        side.simulator.reset();
+        side.cpu.reset(new CPU());
+        uint64_t retired = 0;
+        if (!setup(*side.cpu, side.program, retired)) {
+            return false;
+        }
+        side.simulator.reset(new Simulator(*side.cpu, side.engine));
+        side.simulator->setRetired(retired);
+        instructions = retired;
+    }
+    return true;
+}
+
+void CoSimulator::advance(uint64_t until) {
+    for (Side &side : sides) {
+        side.simulator->setStop(until, Simulator::NO_STOP);
+        side.simulator->run(side.program);
+    }
+}
+
+vector<uint32_t> CoSimulator::takeDirtyPages() {
+    vector<uint32_t> pages = sides[0].cpu->getMemory().takeDirtyPages();
+    vector<uint32_t> other = sides[1].cpu->getMemory().takeDirtyPages();
+    vector<uint32_t> both;
+    set_union(pages.begin(), pages.end(), other.begin(), other.end(), back_inserter(both));
+    return both;
+}
+
+// registers, pc, retired count and the given pages
+uint64_t CoSimulator::hashState(Side &side, const vector<uint32_t> &pages) {
+    int32_t registers[32];
+    for (int i = 0; i < 32; i++) {
+        registers[i] = side.cpu->readRegister(i);
+    }
+    uint64_t scalars[2] = {side.cpu->readPC(), side.simulator->getRetired()};
+    uint64_t hash = hashWords(0, registers, sizeof(registers));
+    hash = hashWords(hash, scalars, sizeof(scalars));
+    for (uint32_t page : pages) {
+        hash = hashWords(hash, &page, sizeof(page));
+        hash = hashWords(hash, pageOf(*side.cpu, page), Memory::PAGE_SIZE);
+    }
+    return hash;
+}
+
+// exact comparison for the single stepping phase
+bool CoSimulator::sameState(const vector<uint32_t> &pages) {
+    CPU &a = *sides[0].cpu;
+    CPU &b = *sides[1].cpu;
+    if (a.readPC() != b.readPC() || sides[0].simulator->getRetired() != sides[1].simulator->getRetired()) {
+        return false;
+    }
+    for (int i = 0; i < 32; i++) {
+        if (a.readRegister(i) != b.readRegister(i)) {
+            return false;
+        }
+    }
+    for (uint32_t page : pages) {
+        if (memcmp(pageOf(a, page), pageOf(b, page), Memory::PAGE_SIZE) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CoSimulator::run(ostream &out) {
+    if (!start(setup)) {
+        out << "cosim: setup failed" << endl;
+        return false;
+    }
+    takeDirtyPages(); // the starting image is identical by construction
+    uint64_t lastGood = instructions;
+    uint64_t intervals = 0;
+    while (true) {
+        advance(lastGood + interval);
+        vector<uint32_t> pages = takeDirtyPages();
+        intervals++;
+        if (hashState(sides[0], pages) != hashState(sides[1], pages)) {
+            out << "cosim: state differs after " << sides[0].simulator->getRetired() << " instructions" << endl;
+            locate(lastGood, sides[0].simulator->getRetired(), out);
+            return false;
+        }
+        instructions = sides[0].simulator->getRetired();
+        if (!sides[0].simulator->stoppedEarly() && !sides[1].simulator->stoppedEarly()) {
+            break; // both finished
+        }
+        lastGood = instructions;
+    }
+    out << "cosim: " << instructions << " instructions in " << intervals << " intervals, no divergence" << endl;
+    return true;
+}
+
+// restore both sides from a checkpoint, run them to from and then to until
+// (as separate runs, so block based engines start a block at from) and
+// compare. leaves both sides at until
+bool CoSimulator::replayDiffers(const string &checkpoint, uint64_t from, uint64_t until) {
+    Setup restore = [&](CPU &cpu, Program &program, uint64_t &retired) {
+        return Checkpoint::restore(checkpoint, cpu, program, retired);
+    };
+    if (!start(restore)) {
+        return false;
+    }
+    advance(from);
+    vector<uint32_t> pages = takeDirtyPages();
+    advance(until);
+    vector<uint32_t> more = takeDirtyPages();
+    pages.insert(pages.end(), more.begin(), more.end());
+    sort(pages.begin(), pages.end());
+    pages.erase(unique(pages.begin(), pages.end()), pages.end());
+    lastPages = pages;
+    return !sameState(pages);
+}
+
+// shrink the failing interval (lastGood, bad] to the shortest run that still
+// diverges: first the earliest point where the states differ, then the latest
+// start that still leads there. an engine that is exact per instruction ends
+// with a single instruction; block based engines end with the block
+void CoSimulator::locate(uint64_t lastGood, uint64_t bad, ostream &out) {
+    // replays start from a checkpoint at the last good interval rather than
+    // from the beginning
+    string base = reproducer + ".base";
+    if (!start(setup)) {
+        return;
+    }
+    sides[0].simulator->setStop(lastGood, Simulator::NO_STOP);
+    sides[0].simulator->run(sides[0].program);
+    if (!Checkpoint::save(base, *sides[0].cpu, sides[0].program, lastGood, parent)) {
+        out << "cosim: error writing " << base << endl;
+        return;
+    }
+    if (!replayDiffers(base, lastGood, bad)) {
+        out << "cosim: the divergence did not reproduce" << endl;
+        remove(base.c_str());
+        return;
+    }
+
+    uint64_t low = lastGood, high = bad; // the run to high diverges, to low doesn't
+    while (high - low > 1) {
+        uint64_t middle = low + (high - low) / 2;
+        (replayDiffers(base, lastGood, middle) ? high : low) = middle;
+    }
+    uint64_t until = high;
+    low = lastGood;     // latest start known to diverge
+    high = until;       // earliest start known not to
+    while (high - low > 1) {
+        uint64_t middle = low + (high - low) / 2;
+        (replayDiffers(base, middle, until) ? low : high) = middle;
+    }
+    uint64_t from = low;
+    replayDiffers(base, from, until);
+    remove(base.c_str());
+
+    out << "cosim: first divergence running instructions " << from << " to " << until << endl;
+    reportDifferences(lastPages, out);
+
+    // the reference state at from, so restoring it and running until - from
+    // instructions on both engines reproduces the divergence
+    if (start(setup)) {
+        sides[0].simulator->setStop(from, Simulator::NO_STOP);
+        sides[0].simulator->run(sides[0].program);
+        CPU &cpu = *sides[0].cpu;
+        uint32_t word = cpu.getMemory().read(cpu.readPC());
+        out << "  starting at pc 0x" << hex << setw(8) << setfill('0') << cpu.readPC() << ": " << setw(8) << word
+            << dec << setfill(' ') << " (" << instructionName(static_cast<InstructionId>(lookupDecode(cpu.decode(word)).id))
+            << ")" << endl;
+        if (Checkpoint::save(reproducer, cpu, sides[0].program, from, parent)) {
+            out << "cosim: reproducer written to " << reproducer << ", run " << (until - from)
+                << " instructions from it to diverge" << endl;
+        } else {
+            out << "cosim: error writing " << reproducer << endl;
+        }
+    }
+}
+
+// every field that differs between the two sides
+void CoSimulator::reportDifferences(const vector<uint32_t> &pages, ostream &out) {
+    static const char *const names[] = {"reference", "candidate"};
+    CPU &a = *sides[0].cpu;
+    CPU &b = *sides[1].cpu;
+    for (int i = 0; i < 2; i++) {
+        out << "  " << names[i] << ": " << sides[i].simulator->getRetired() << " instructions, pc 0x"
+            << hex << sides[i].cpu->readPC() << dec << (sides[i].simulator->stoppedEarly() ? "" : " (finished)") << endl;
+    }
+    for (int i = 0; i < 32; i++) {
+        if (a.readRegister(i) != b.readRegister(i)) {
+            out << "  x" << i << ": " << a.readRegister(i) << " vs " << b.readRegister(i) << endl;
+        }
+    }
+    int shown = 0;
+    for (uint32_t page : pages) {
+        const uint8_t *x = pageOf(a, page);
+        const uint8_t *y = pageOf(b, page);
+        for (uint32_t offset = 0; offset < Memory::PAGE_SIZE && shown < 16; offset++) {
+            if (x[offset] != y[offset]) {
+                out << "  mem[0x" << hex << (page << Memory::PAGE_BITS | offset) << "]: 0x" << int(x[offset])
+                    << " vs 0x" << int(y[offset]) << dec << endl;
+                shown++;
+            }
+        }
+    }
+}
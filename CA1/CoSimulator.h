@@ -0,0 +1,64 @@
+#ifndef COSIMULATOR_H
+#define COSIMULATOR_H
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "CPU.h"
+#include "Loader.h"
+#include "Simulator.h"
+
+// differential co-simulation: runs the same starting state on two engines in
+// lockstep and checks that they agree on the registers, the pc and every page
+// written. the engines run an interval at a time and only a hash of each
+// side's state is compared, which keeps the checking cost per instruction
+// small enough for very long runs. on a mismatch both sides are replayed from
+// a checkpoint of the last interval that matched, bisecting down to the
+// shortest run that still diverges, which is reported along with a
+// checkpoint of the state it starts from
+class CoSimulator {
+    public:
+        // build identical starting state: load a program or restore a checkpoint.
+        // instructions is the retired count the state starts from
+        typedef std::function<bool(CPU &cpu, Program &program, uint64_t &instructions)> Setup;
+
+        CoSimulator(Engine reference, Engine candidate, Setup setup);
+        void setInterval(uint64_t instructions) { interval = instructions ? instructions : 1; }
+        // where to write the reproducer on divergence, which must be set before
+        // run(); parent as for Checkpoint::save
+        void setReproducer(const std::string &path, const std::string &parent);
+
+        // false on divergence or if setup fails; reports to out either way
+        bool run(std::ostream &out);
+        CPU &getReference() { return *sides[0].cpu; }
+        uint64_t getInstructions() { return instructions; }
+    private:
+        struct Side {
+            Engine engine;
+            std::unique_ptr<CPU> cpu;
+            std::unique_ptr<Simulator> simulator;
+            Program program;
+        };
+
+        bool start(const Setup &setup);
+        void advance(uint64_t until); // run both sides to a retired count
+        uint64_t hashState(Side &side, const std::vector<uint32_t> &pages);
+        std::vector<uint32_t> takeDirtyPages(); // union over both sides
+        bool sameState(const std::vector<uint32_t> &pages);
+        bool replayDiffers(const std::string &checkpoint, uint64_t from, uint64_t until);
+        void locate(uint64_t lastGood, uint64_t bad, std::ostream &out);
+        void reportDifferences(const std::vector<uint32_t> &pages, std::ostream &out);
+
+        Side sides[2]; // reference, candidate
+        Setup setup;
+        uint64_t interval;
+        uint64_t instructions;
+        std::string reproducer;
+        std::string parent;
+        std::vector<uint32_t> lastPages; // pages compared by the last replay
+};
+
+#endif // COSIMULATOR_H
@@ -1,11 +1,11 @@
 #include "Controller.h"
+#include "InstructionTable.h"
 
 // clear all control signals to default state
 void Controller::resetSignals() {
-    for(int i = 0; i < 7; i++) {
-        signals[i] = false;
-    }
+    signals = 0;
     aluOp = ALUOp::ALU_OP_INVALID;
+    instruction = INST_INVALID;
 }
 
 // initialize controller with all signals reset
@@ -13,49 +13,10 @@ Controller::Controller() {
     resetSignals();
 }
 
-// set control signals based on instruction opcode
-void Controller::setControlSignals(uint32_t opcode) {
-    resetSignals();
-
-    switch (opcode) {
-        case 0x33: // R-type
-            signals[ControlSignals::RegWrite] = true;
-            aluOp = ALUOp::ALU_OP_FUNC; // ALU operation determined by funct fields
-            break;
-        case 0x13: // I-type
-            signals[ControlSignals::RegWrite] = true;
-            signals[ControlSignals::AluSrc] = true;
-            aluOp = ALUOp::ALU_OP_FUNC; // Check funct3 to determine operation
-            break;
-        case 0x03: // load
-            signals[ControlSignals::RegWrite] = true;
-            signals[ControlSignals::AluSrc] = true;
-            signals[ControlSignals::MemRead] = true;
-            signals[ControlSignals::MemToReg] = true;
-            aluOp = ALUOp::ALU_OP_ADD;
-            break;
-        case 0x23: // store
-            signals[ControlSignals::AluSrc] = true;
-            signals[ControlSignals::MemWrite] = true;
-            aluOp = ALUOp::ALU_OP_ADD;
-            break;
-        case 0x63: // branch
-            signals[ControlSignals::Branch] = true;
-            aluOp = ALUOp::ALU_OP_SUB;
-            break;
-        case 0x37: // LUI
-            signals[ControlSignals::RegWrite] = true;
-            signals[ControlSignals::AluSrc] = true;
-            aluOp = ALUOp::ALU_OP_PASS_IMM;
-            break;
-        case 0x67: // JALR
-            signals[ControlSignals::RegWrite] = true;
-            signals[ControlSignals::AluSrc] = true;
-            signals[ControlSignals::Link] = true;
-            aluOp = ALUOp::ALU_OP_ADD;
-            break;
-        default:
-            // Handle other opcodes or invalid opcode
-            break;
-    }
-}
\ No newline at end of file
+// set control signals from the generated RV32I decode table
+void Controller::setControlSignals(InstructionParts parts) {
+    const DecodeEntry &entry = lookupDecode(parts);
+    signals = entry.signals;
+    aluOp = static_cast<ALUOp>(entry.aluOp);
+    instruction = static_cast<InstructionId>(entry.id);
+}
@@ -3,6 +3,7 @@
 
 #include <bitset>
 #include <cstdint>
+#include "InstructionParts.h"
 
 enum ControlSignals {
     RegWrite,
@@ -11,7 +12,12 @@ enum ControlSignals {
     MemRead,
     MemWrite,
     MemToReg,
-    Link,
+    Link,         // jalr: jump to alu result, write pc + 4
+    Jump,         // jal: jump to pc + immediate, write pc + 4
+    AuiPc,        // alu operand 1 is the pc instead of rs1
+    BranchOnZero, // branch when the compare result is zero (beq, bge, bgeu)
+    Atomic,       // rv32a atomics and fence, done by CPU::executeAtomic
+    NUM_CONTROL_SIGNALS,
 };
 
 enum ALUOp {
@@ -22,16 +28,35 @@ enum ALUOp {
     ALU_OP_INVALID,
 };
 
+// every RV32I and RV32A instruction the controller can identify
+enum InstructionId {
+    INST_INVALID,
+    INST_LUI, INST_AUIPC, INST_JAL, INST_JALR,
+    INST_BEQ, INST_BNE, INST_BLT, INST_BGE, INST_BLTU, INST_BGEU,
+    INST_LB, INST_LH, INST_LW, INST_LBU, INST_LHU,
+    INST_SB, INST_SH, INST_SW,
+    INST_ADDI, INST_SLTI, INST_SLTIU, INST_XORI, INST_ORI, INST_ANDI,
+    INST_SLLI, INST_SRLI, INST_SRAI,
+    INST_ADD, INST_SUB, INST_SLL, INST_SLT, INST_SLTU,
+    INST_XOR, INST_SRL, INST_SRA, INST_OR, INST_AND,
+    INST_FENCE, INST_SYSTEM,
+    INST_LR_W, INST_SC_W, INST_AMOSWAP_W, INST_AMOADD_W, INST_AMOXOR_W,
+    INST_AMOAND_W, INST_AMOOR_W, INST_AMOMIN_W, INST_AMOMAX_W, INST_AMOMINU_W, INST_AMOMAXU_W,
+    INST_COUNT,
+};
+
 class Controller {
     public:
         Controller();
-        void setControlSignals(uint32_t opcode);
+        void setControlSignals(InstructionParts parts);
         ALUOp getALUOp() { return aluOp; }
-        bool getSignal(ControlSignals signal) { return signals[signal]; }
+        InstructionId getInstruction() { return instruction; }
+        bool getSignal(ControlSignals signal) { return (signals >> signal) & 1; }
     private:
         void resetSignals();
-        bool signals[7];
+        uint16_t signals; // one bit per ControlSignals value
         ALUOp aluOp;
+        InstructionId instruction;
 };
 
-#endif // CONTROLLER_H
\ No newline at end of file
+#endif // CONTROLLER_H
@@ -0,0 +1,49 @@
+#include "DecodeCache.h"
+
+// start with every entry invalid
+DecodeCache::DecodeCache() {
+    flush();
+}
+
+// invalidate every entry and reset statistics
+void DecodeCache::flush() {
+    for (uint32_t i = 0; i < CACHE_SIZE; i++) {
+        tags[i] = INVALID_TAG;
+    }
+    hits = 0;
+    misses = 0;
+    invalidations = 0;
+}
+
+// return the cached decode for pc if present
+DecodedInstruction *DecodeCache::lookup(uint32_t pc) {
+    uint32_t i = index(pc);
+    if (tags[i] == pc) {
+        hits++;
+        return &entries[i];
+    }
+    misses++;
+    return nullptr;
+}
+
+// store a decoded instruction, replacing whatever shared its slot
+DecodedInstruction *DecodeCache::insert(uint32_t pc, const DecodedInstruction &decoded) {
+    uint32_t i = index(pc);
+    tags[i] = pc;
+    entries[i] = decoded;
+    return &entries[i];
+}
+
+// a word store can overlap at most two instruction words
+void DecodeCache::invalidate(uint32_t address) {
+    uint32_t first = address & ~3u;
+    uint32_t last = (address + 3) & ~3u;
+    if (tags[index(first)] == first) {
+        tags[index(first)] = INVALID_TAG;
+        invalidations++;
+    }
+    if (last != first && tags[index(last)] == last) {
+        tags[index(last)] = INVALID_TAG;
+        invalidations++;
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef DECODECACHE_H
+#define DECODECACHE_H
+
+#include <cstdint>
+#include "InstructionParts.h"
+#include "Controller.h"
+#include "ALU.h"
+
+// instruction with its control signals and alu operation already resolved
+struct DecodedInstruction {
+    InstructionParts parts;
+    InstructionId id;
+    bool signals[NUM_CONTROL_SIGNALS];
+    ALUOp aluOp;
+    ALUOperation aluOperation;
+};
+
+// direct-mapped cache of decoded instructions indexed by pc
+class DecodeCache {
+    public:
+        DecodeCache();
+        DecodedInstruction *lookup(uint32_t pc); // returns nullptr on a miss
+        DecodedInstruction *insert(uint32_t pc, const DecodedInstruction &decoded);
+        void invalidate(uint32_t address); // drop any entry covering a written word
+        void flush();
+        uint64_t getHits() { return hits; }
+        uint64_t getMisses() { return misses; }
+        uint64_t getInvalidations() { return invalidations; }
+    private:
+        static const int CACHE_BITS = 12; // 4K entries
+        static const uint32_t CACHE_SIZE = 1u << CACHE_BITS;
+        static const uint32_t INVALID_TAG = 0xFFFFFFFF; // pcs are word aligned so this never matches
+        uint32_t index(uint32_t pc) { return (pc >> 2) & (CACHE_SIZE - 1); }
+        uint32_t tags[CACHE_SIZE];
+        DecodedInstruction entries[CACHE_SIZE];
+        uint64_t hits, misses, invalidations;
+};
+
+#endif // DECODECACHE_H
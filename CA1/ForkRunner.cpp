@@ -0,0 +1,130 @@
+#include "ForkRunner.h"
+#include "ThreadPool.h"
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+using namespace std;
+
+ForkRunner::ForkRunner(Engine engine, unsigned threads) : engine(engine), threads(threads) {
+}
+
+// a whole number in C syntax that fits 32 bits, signed or not
+static bool parseNumber(const string &text, int64_t &value) {
+    char *end;
+    value = strtoll(text.c_str(), &end, 0);
+    return !text.empty() && *end == '\0' && value >= INT32_MIN && value <= UINT32_MAX;
+}
+
+bool ForkRunner::readVariants(const char *path, string &error) {
+    ifstream file(path);
+    if (!file.is_open()) {
+        error = string("error opening ") + path;
+        return false;
+    }
+    string line;
+    while (getline(file, line)) {
+        size_t hash = line.find('#');
+        if (hash != string::npos) {
+            line.erase(hash);
+        }
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == string::npos) {
+            continue;
+        }
+        line = line.substr(first, line.find_last_not_of(" \t\r") - first + 1);
+
+        vector<VariantSetting> settings;
+        istringstream items(line);
+        string item;
+        while (items >> item) {
+            if (item == "-") {
+                continue;
+            }
+            size_t equals = item.find('=');
+            string key = item.substr(0, equals);
+            int64_t where, value;
+            bool memory = key.empty() || key[0] != 'x';
+            bool ok = equals != string::npos && parseNumber(item.substr(equals + 1), value)
+                && parseNumber(memory ? key : key.substr(1), where)
+                && (memory ? where >= 0 : where >= 1 && where < 32 && isdigit(key[1]));
+            if (!ok) {
+                error = "expected x<n>=value or <address>=value, not " + item;
+                return false;
+            }
+            settings.push_back(VariantSetting{memory, static_cast<uint32_t>(where), static_cast<int32_t>(value)});
+        }
+        lines.push_back(line);
+        variants.push_back(settings);
+    }
+    return true;
+}
+
+// fork the parent, apply the variant and run it to the end
+void ForkRunner::runOne(CPU &parent, const Program &program, uint64_t retired, size_t index) {
+    auto start = chrono::steady_clock::now();
+    CPU child;
+    {
+        lock_guard<mutex> guard(forkLock);
+        parent.fork(child);
+    }
+    for (const VariantSetting &setting : variants[index]) {
+        if (setting.memory) {
+            child.getMemory().write(setting.where, setting.value);
+        } else {
+            child.writeRegister(setting.where, setting.value);
+        }
+    }
+    Simulator simulator(child, engine);
+    simulator.setRetired(retired);
+    Result &result = results[index];
+    result.instructions = simulator.run(program);
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    for (int i = 0; i < 32; i++) {
+        result.registers[i] = child.readRegister(i);
+    }
+    result.pc = child.readPC();
+}
+
+// run every variant, printing each result once all earlier ones are printed
+void ForkRunner::run(CPU &parent, const Program &program, uint64_t retired, ostream &out) {
+    results.assign(variants.size(), Result());
+    vector<bool> finished(variants.size(), false);
+    mutex outputLock;
+    size_t nextToPrint = 0;
+
+    ThreadPool pool(threads);
+    for (size_t i = 0; i < variants.size(); i++) {
+        pool.submit([this, &parent, &program, retired, i, &finished, &outputLock, &nextToPrint, &out] {
+            runOne(parent, program, retired, i);
+            lock_guard<mutex> guard(outputLock);
+            finished[i] = true;
+            while (nextToPrint < finished.size() && finished[nextToPrint]) {
+                writeResult(out, nextToPrint++);
+            }
+        });
+    }
+    pool.wait();
+    out.flush();
+}
+
+// one JSON object per line, like BatchRunner's with the variant in place of the program
+void ForkRunner::writeResult(ostream &out, size_t index) {
+    const Result &result = results[index];
+    out << "{\"variant\":\"";
+    for (char c : lines[index]) {
+        if (c == '"' || c == '\\') {
+            out << '\\';
+        }
+        out << c;
+    }
+    out << "\",\"status\":\"ok\",\"a0\":" << result.registers[10] << ",\"a1\":" << result.registers[11]
+        << ",\"pc\":" << result.pc << ",\"instructions\":" << result.instructions
+        << ",\"seconds\":" << result.seconds << ",\"registers\":[";
+    for (int i = 0; i < 32; i++) {
+        out << (i ? "," : "") << result.registers[i];
+    }
+    out << "]}\n";
+}
@@ -0,0 +1,55 @@
+#ifndef FORKRUNNER_H
+#define FORKRUNNER_H
+
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "CPU.h"
+#include "Loader.h"
+#include "Simulator.h"
+
+// one change a variant makes to the forked state before it runs
+struct VariantSetting {
+    bool memory;    // a word of memory rather than a register
+    uint32_t where; // register number or address
+    int32_t value;
+};
+
+// fans a run out into input variants. the caller runs the shared prefix on
+// one cpu; each variant then gets a copy-on-write fork of it, applies its
+// settings and runs to the end on a thread pool, so a variant costs only the
+// pages it writes. results are JSON lines in variant order, with the same
+// fields as a batch run
+class ForkRunner {
+    public:
+        ForkRunner(Engine engine, unsigned threads);
+        // one variant per line of whitespace separated settings: x<n>=value
+        // for a register, <address>=value for a memory word, numbers in C
+        // syntax. # starts a comment, and a line with no settings is a
+        // variant too once anything else is on it, e.g. "-"
+        bool readVariants(const char *path, std::string &error);
+        // parent is stopped between instructions after retiring retired
+        void run(CPU &parent, const Program &program, uint64_t retired, std::ostream &out);
+        size_t size() { return variants.size(); }
+    private:
+        struct Result {
+            int32_t registers[32];
+            uint32_t pc;
+            uint64_t instructions;
+            double seconds;
+        };
+
+        void runOne(CPU &parent, const Program &program, uint64_t retired, size_t index);
+        void writeResult(std::ostream &out, size_t index);
+
+        Engine engine;
+        unsigned threads;
+        std::vector<std::string> lines; // as written, for the output
+        std::vector<std::vector<VariantSetting>> variants;
+        std::vector<Result> results;
+        std::mutex forkLock; // forking updates the parent's page table
+};
+
+#endif // FORKRUNNER_H
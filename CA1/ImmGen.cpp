@@ -7,20 +7,22 @@ int32_t ImmGen::generate(uint32_t instruction) {
     int32_t immediate = 0;
 
     switch (opcode) {
-        case 0x13: // I-type (addi, ori, sltiu)
-        case 0x03: // I-type (lw, lbu)
+        case 0x13: // I-type (addi, ori, sltiu, shifts)
+        case 0x03: // I-type (loads)
+        case 0x67: // I-type (jalr)
+        case 0x73: // I-type (ecall, ebreak)
             immediate = (instruction >> 20) & 0xFFF; // bits [31:20]
             if (immediate & 0x800) {
                 immediate |= 0xFFFFF000; // sign extend
             }
             break;
-        case 0x23: // S-type (sw, sh)
+        case 0x23: // S-type (sw, sh, sb)
             immediate = ((instruction >> 25) & 0x7F) << 5 | ((instruction >> 7) & 0x1F); // bits [31:25] and [11:7]
             if (immediate & 0x800) {
                 immediate |= 0xFFFFF000;
             }
             break;
-        case 0x63: // B-type (bne)
+        case 0x63: // B-type (beq, bne, blt, bge, bltu, bgeu)
             immediate = ((instruction >> 31) & 0x1) << 12 | ((instruction >> 7) & 0x1) << 11 |
                         ((instruction >> 25) & 0x3F) << 5 | ((instruction >> 8) & 0xF) << 1; // bits [31], [7], [30:25], [11:8]
             if (immediate & 0x1000) {
@@ -28,9 +30,17 @@ int32_t ImmGen::generate(uint32_t instruction) {
             }
             break;
         case 0x37: // U-type (lui)
+        case 0x17: // U-type (auipc)
             immediate = (instruction >> 12) & 0xFFFFF; // bits [31:12] - 20 bits
             immediate <<= 12; // shift to upper 20 bits, lower 12 bits become 0
             break;
+        case 0x6F: // J-type (jal)
+            immediate = ((instruction >> 31) & 0x1) << 20 | ((instruction >> 12) & 0xFF) << 12 |
+                        ((instruction >> 20) & 0x1) << 11 | ((instruction >> 21) & 0x3FF) << 1; // bits [31], [19:12], [20], [30:21]
+            if (immediate & 0x100000) {
+                immediate |= 0xFFE00000;
+            }
+            break;
         default:
             immediate = 0; // for r-type and other types without immediates
             break;
@@ -0,0 +1,203 @@
+#ifndef INSTRUCTIONTABLE_H
+#define INSTRUCTIONTABLE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include "InstructionParts.h"
+#include "Controller.h"
+#include "ALU.h"
+
+// how an instruction constrains funct7. RV32I only ever uses 0x00 and 0x20;
+// F7_ANY is for formats where bits [31:25] belong to the immediate
+enum Funct7Class {
+    F7_ZERO,
+    F7_ALT,
+    F7_ANY = 4,
+};
+
+const int8_t ANY_FUNCT3 = -1; // funct3 bits belong to the immediate
+
+#define SIG(signal) (1u << (signal))
+
+// one row of the instruction set description
+struct InstructionSpec {
+    InstructionId id;
+    const char *name;
+    uint8_t opcode;
+    int8_t funct3;
+    Funct7Class funct7;
+    ALUOp aluOp;
+    ALUOperation aluOperation;
+    uint16_t signals;
+};
+
+// the RV32I base instruction set, described once. ecall and ebreak decode
+// as INST_SYSTEM with no alu operation, which stops the simulation
+constexpr InstructionSpec RV32I[] = {
+    {INST_LUI,    "lui",    0x37, ANY_FUNCT3, F7_ANY,  ALU_OP_PASS_IMM, ALU_COPY_IMM, SIG(RegWrite) | SIG(AluSrc)},
+    {INST_AUIPC,  "auipc",  0x17, ANY_FUNCT3, F7_ANY,  ALU_OP_ADD,      ALU_ADD,      SIG(RegWrite) | SIG(AluSrc) | SIG(AuiPc)},
+    {INST_JAL,    "jal",    0x6F, ANY_FUNCT3, F7_ANY,  ALU_OP_PASS_IMM, ALU_COPY_IMM, SIG(RegWrite) | SIG(Jump)},
+    {INST_JALR,   "jalr",   0x67, 0x0,        F7_ANY,  ALU_OP_ADD,      ALU_ADD,      SIG(RegWrite) | SIG(AluSrc) | SIG(Link)},
+
+    {INST_BEQ,    "beq",    0x63, 0x0,        F7_ANY,  ALU_OP_SUB,      ALU_SUB,      SIG(Branch) | SIG(BranchOnZero)},
+    {INST_BNE,    "bne",    0x63, 0x1,        F7_ANY,  ALU_OP_SUB,      ALU_SUB,      SIG(Branch)},
+    {INST_BLT,    "blt",    0x63, 0x4,        F7_ANY,  ALU_OP_FUNC,     ALU_SLT,      SIG(Branch)},
+    {INST_BGE,    "bge",    0x63, 0x5,        F7_ANY,  ALU_OP_FUNC,     ALU_SLT,      SIG(Branch) | SIG(BranchOnZero)},
+    {INST_BLTU,   "bltu",   0x63, 0x6,        F7_ANY,  ALU_OP_FUNC,     ALU_SLTU,     SIG(Branch)},
+    {INST_BGEU,   "bgeu",   0x63, 0x7,        F7_ANY,  ALU_OP_FUNC,     ALU_SLTU,     SIG(Branch) | SIG(BranchOnZero)},
+
+    {INST_LB,     "lb",     0x03, 0x0,        F7_ANY,  ALU_OP_ADD,      ALU_ADD,      SIG(RegWrite) | SIG(AluSrc) | SIG(MemRead) | SIG(MemToReg)},
+    {INST_LH,     "lh",     0x03, 0x1,        F7_ANY,  ALU_OP_ADD,      ALU_ADD,      SIG(RegWrite) | SIG(AluSrc) | SIG(MemRead) | SIG(MemToReg)},
+    {INST_LW,     "lw",     0x03, 0x2,        F7_ANY,  ALU_OP_ADD,      ALU_ADD,      SIG(RegWrite) | SIG(AluSrc) | SIG(MemRead) | SIG(MemToReg)},
+    {INST_LBU,    "lbu",    0x03, 0x4,        F7_ANY,  ALU_OP_ADD,      ALU_ADD,      SIG(RegWrite) | SIG(AluSrc) | SIG(MemRead) | SIG(MemToReg)},
+    {INST_LHU,    "lhu",    0x03, 0x5,        F7_ANY,  ALU_OP_ADD,      ALU_ADD,      SIG(RegWrite) | SIG(AluSrc) | SIG(MemRead) | SIG(MemToReg)},
+
+    {INST_SB,     "sb",     0x23, 0x0,        F7_ANY,  ALU_OP_ADD,      ALU_ADD,      SIG(AluSrc) | SIG(MemWrite)},
+    {INST_SH,     "sh",     0x23, 0x1,        F7_ANY,  ALU_OP_ADD,      ALU_ADD,      SIG(AluSrc) | SIG(MemWrite)},
+    {INST_SW,     "sw",     0x23, 0x2,        F7_ANY,  ALU_OP_ADD,      ALU_ADD,      SIG(AluSrc) | SIG(MemWrite)},
+
+    {INST_ADDI,   "addi",   0x13, 0x0,        F7_ANY,  ALU_OP_FUNC,     ALU_ADD,      SIG(RegWrite) | SIG(AluSrc)},
+    {INST_SLTI,   "slti",   0x13, 0x2,        F7_ANY,  ALU_OP_FUNC,     ALU_SLT,      SIG(RegWrite) | SIG(AluSrc)},
+    {INST_SLTIU,  "sltiu",  0x13, 0x3,        F7_ANY,  ALU_OP_FUNC,     ALU_SLTU,     SIG(RegWrite) | SIG(AluSrc)},
+    {INST_XORI,   "xori",   0x13, 0x4,        F7_ANY,  ALU_OP_FUNC,     ALU_XOR,      SIG(RegWrite) | SIG(AluSrc)},
+    {INST_ORI,    "ori",    0x13, 0x6,        F7_ANY,  ALU_OP_FUNC,     ALU_OR,       SIG(RegWrite) | SIG(AluSrc)},
+    {INST_ANDI,   "andi",   0x13, 0x7,        F7_ANY,  ALU_OP_FUNC,     ALU_AND,      SIG(RegWrite) | SIG(AluSrc)},
+    {INST_SLLI,   "slli",   0x13, 0x1,        F7_ZERO, ALU_OP_FUNC,     ALU_SLL,      SIG(RegWrite) | SIG(AluSrc)},
+    {INST_SRLI,   "srli",   0x13, 0x5,        F7_ZERO, ALU_OP_FUNC,     ALU_SRL,      SIG(RegWrite) | SIG(AluSrc)},
+    {INST_SRAI,   "srai",   0x13, 0x5,        F7_ALT,  ALU_OP_FUNC,     ALU_SRA,      SIG(RegWrite) | SIG(AluSrc)},
+
+    {INST_ADD,    "add",    0x33, 0x0,        F7_ZERO, ALU_OP_FUNC,     ALU_ADD,      SIG(RegWrite)},
+    {INST_SUB,    "sub",    0x33, 0x0,        F7_ALT,  ALU_OP_FUNC,     ALU_SUB,      SIG(RegWrite)},
+    {INST_SLL,    "sll",    0x33, 0x1,        F7_ZERO, ALU_OP_FUNC,     ALU_SLL,      SIG(RegWrite)},
+    {INST_SLT,    "slt",    0x33, 0x2,        F7_ZERO, ALU_OP_FUNC,     ALU_SLT,      SIG(RegWrite)},
+    {INST_SLTU,   "sltu",   0x33, 0x3,        F7_ZERO, ALU_OP_FUNC,     ALU_SLTU,     SIG(RegWrite)},
+    {INST_XOR,    "xor",    0x33, 0x4,        F7_ZERO, ALU_OP_FUNC,     ALU_XOR,      SIG(RegWrite)},
+    {INST_SRL,    "srl",    0x33, 0x5,        F7_ZERO, ALU_OP_FUNC,     ALU_SRL,      SIG(RegWrite)},
+    {INST_SRA,    "sra",    0x33, 0x5,        F7_ALT,  ALU_OP_FUNC,     ALU_SRA,      SIG(RegWrite)},
+    {INST_OR,     "or",     0x33, 0x6,        F7_ZERO, ALU_OP_FUNC,     ALU_OR,       SIG(RegWrite)},
+    {INST_AND,    "and",    0x33, 0x7,        F7_ZERO, ALU_OP_FUNC,     ALU_AND,      SIG(RegWrite)},
+
+    {INST_FENCE,  "fence",  0x0F, 0x0,        F7_ANY,  ALU_OP_ADD,      ALU_ADD,      SIG(Atomic)}, // orders memory between harts
+    {INST_SYSTEM, "system", 0x73, 0x0,        F7_ANY,  ALU_OP_INVALID,  ALU_INVALID,  0},
+};
+
+const uint8_t ATOMIC_OPCODE = 0x2F;
+const uint8_t ATOMIC_FUNCT3 = 0x2; // .w, the only width on rv32
+
+// one rv32a instruction. they share opcode and funct3 and are told apart by
+// funct5, funct7 bits [6:2]. the aq and rl bits are ignored because every
+// atomic is sequentially consistent here
+struct AtomicSpec {
+    InstructionId id;
+    const char *name;
+    uint8_t funct5;
+    uint16_t signals;
+};
+
+// the address is rs1 plus the zero immediate these formats decode to
+#define AMO_SIGNALS (SIG(RegWrite) | SIG(AluSrc) | SIG(MemRead) | SIG(MemWrite) | SIG(Atomic))
+
+// the RV32A word atomics
+constexpr AtomicSpec RV32A[] = {
+    {INST_LR_W,      "lr.w",      0x02, SIG(RegWrite) | SIG(AluSrc) | SIG(MemRead) | SIG(Atomic)},
+    {INST_SC_W,      "sc.w",      0x03, AMO_SIGNALS},
+    {INST_AMOSWAP_W, "amoswap.w", 0x01, AMO_SIGNALS},
+    {INST_AMOADD_W,  "amoadd.w",  0x00, AMO_SIGNALS},
+    {INST_AMOXOR_W,  "amoxor.w",  0x04, AMO_SIGNALS},
+    {INST_AMOAND_W,  "amoand.w",  0x0C, AMO_SIGNALS},
+    {INST_AMOOR_W,   "amoor.w",   0x08, AMO_SIGNALS},
+    {INST_AMOMIN_W,  "amomin.w",  0x10, AMO_SIGNALS},
+    {INST_AMOMAX_W,  "amomax.w",  0x14, AMO_SIGNALS},
+    {INST_AMOMINU_W, "amominu.w", 0x18, AMO_SIGNALS},
+    {INST_AMOMAXU_W, "amomaxu.w", 0x1C, AMO_SIGNALS},
+};
+
+static_assert(sizeof(RV32I) / sizeof(RV32I[0]) + sizeof(RV32A) / sizeof(RV32A[0]) == INST_COUNT - 1,
+              "every InstructionId needs exactly one row");
+
+// one slot of the generated decode table
+struct DecodeEntry {
+    uint8_t id;           // InstructionId
+    uint8_t aluOp;        // ALUOp
+    uint8_t aluOperation; // ALUOperation
+    uint16_t signals;     // one bit per ControlSignals value
+};
+
+// decode key: [10] opcode bits [1:0] aren't 11, [9:5] opcode [6:2], [4:2] funct3,
+// [1:0] funct7 class (0 = 0x00, 1 = 0x20, 2 or 3 = anything else)
+const int DECODE_KEY_BITS = 11;
+typedef std::array<DecodeEntry, 1u << DECODE_KEY_BITS> DecodeTable;
+
+constexpr uint32_t decodeKey(uint32_t opcode, uint32_t funct3, uint32_t funct7) {
+    return ((opcode & 0x3) != 0x3) << 10 | (opcode >> 2 & 0x1F) << 5 | (funct3 & 0x7) << 2
+         | (funct7 == 0x20) | ((funct7 & ~0x20u) != 0) << 1;
+}
+
+// expand an instruction set description into a dense table covering every key
+template <size_t N>
+constexpr DecodeTable buildDecodeTable(const InstructionSpec (&specs)[N]) {
+    DecodeTable table{};
+    for (uint32_t key = 0; key < table.size(); key++) {
+        table[key] = DecodeEntry{INST_INVALID, ALU_OP_INVALID, ALU_INVALID, 0};
+        uint32_t funct3 = key >> 2 & 0x7;
+        uint32_t funct7 = key & 0x3;
+        for (size_t i = 0; i < N; i++) {
+            const InstructionSpec &spec = specs[i];
+            if (decodeKey(spec.opcode, 0, 0) >> 5 == key >> 5
+                && (spec.funct3 == ANY_FUNCT3 || static_cast<uint32_t>(spec.funct3) == funct3)
+                && (spec.funct7 == F7_ANY || static_cast<uint32_t>(spec.funct7) == funct7)) {
+                table[key] = DecodeEntry{static_cast<uint8_t>(spec.id), static_cast<uint8_t>(spec.aluOp),
+                                         static_cast<uint8_t>(spec.aluOperation), spec.signals};
+                break;
+            }
+        }
+    }
+    return table;
+}
+
+inline constexpr DecodeTable DECODE_TABLE = buildDecodeTable(RV32I);
+
+// atomics indexed by funct5, with a last entry for any other funct3
+typedef std::array<DecodeEntry, 33> AtomicDecodeTable;
+
+template <size_t N>
+constexpr AtomicDecodeTable buildAtomicDecodeTable(const AtomicSpec (&specs)[N]) {
+    AtomicDecodeTable table{};
+    for (uint32_t funct5 = 0; funct5 < table.size(); funct5++) {
+        table[funct5] = DecodeEntry{INST_INVALID, ALU_OP_INVALID, ALU_INVALID, 0};
+        for (size_t i = 0; i < N; i++) {
+            if (specs[i].funct5 == funct5) {
+                table[funct5] = DecodeEntry{static_cast<uint8_t>(specs[i].id), ALU_OP_ADD, ALU_ADD, specs[i].signals};
+            }
+        }
+    }
+    return table;
+}
+
+inline constexpr AtomicDecodeTable ATOMIC_DECODE_TABLE = buildAtomicDecodeTable(RV32A);
+
+// one table load replaces the opcode, funct3 and funct7 switches
+inline const DecodeEntry &lookupDecode(const InstructionParts &parts) {
+    if (parts.opcode == ATOMIC_OPCODE) {
+        return ATOMIC_DECODE_TABLE[parts.funct3 == ATOMIC_FUNCT3 ? parts.funct7 >> 2 : 32];
+    }
+    return DECODE_TABLE[decodeKey(parts.opcode, parts.funct3, parts.funct7)];
+}
+
+// mnemonic for an instruction id, for statistics output
+inline const char *instructionName(InstructionId id) {
+    for (const InstructionSpec &spec : RV32I) {
+        if (spec.id == id) {
+            return spec.name;
+        }
+    }
+    for (const AtomicSpec &spec : RV32A) {
+        if (spec.id == id) {
+            return spec.name;
+        }
+    }
+    return "invalid";
+}
+
+#endif // INSTRUCTIONTABLE_H
@@ -0,0 +1,601 @@
+#include "JitEngine.h"
+#include "InstructionTable.h"
+#include <cstddef>
+#include <cstring>
+#include <sys/mman.h>
+using namespace std;
+
+// x86-64 register numbers
+enum HostRegister {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+// condition codes for jcc and setcc
+enum Condition {
+    CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A = 0x7,
+    CC_L = 0xC, CC_GE = 0xD,
+    CC_ALWAYS = -1,
+};
+
+// callee-saved, so they survive the calls into Memory; r15 holds the context
+static const int CACHE_REGISTERS[] = {RBX, RBP, R12, R13, R14};
+
+static const int32_t EXECUTED = offsetof(JitContext, executed);
+static const int32_t BUDGET = offsetof(JitContext, budget);
+
+typedef uint32_t (*EnterFunction)(JitContext *context, const uint8_t *block);
+
+JitEngine::JitEngine(CPU &cpu) : cpu(cpu) {
+    memset(&context, 0, sizeof(context));
+    context.engine = this;
+    code = nullptr; // mapped on the first run
+    codeUsed = 0;
+    codeStart = 0;
+    exitStub = nullptr;
+    maxPC = 0;
+    stopPC = 0;
+    codeBase = 0;
+    flushPending = false;
+    blocksTranslated = 0;
+    flushes = 0;
+    fallbacks = 0;
+    stopped = false;
+}
+
+JitEngine::~JitEngine() {
+    if (code) {
+        munmap(code, CODE_SIZE);
+    }
+}
+
+void JitEngine::emit32(uint32_t value) {
+    memcpy(code + codeUsed, &value, 4);
+    codeUsed += 4;
+}
+
+void JitEngine::emit64(uint64_t value) {
+    memcpy(code + codeUsed, &value, 8);
+    codeUsed += 8;
+}
+
+// modrm (and displacement) addressing [r15 + displacement]; the caller emits rex.b
+void JitEngine::emitMemory(int reg, int32_t displacement) {
+    if (displacement >= -128 && displacement <= 127) {
+        emit8(0x40 | (reg & 7) << 3 | (R15 & 7));
+        emit8(displacement);
+    } else {
+        emit8(0x80 | (reg & 7) << 3 | (R15 & 7));
+        emit32(displacement);
+    }
+}
+
+// mov dst32, src32
+void JitEngine::emitMove(int dst, int src) {
+    uint8_t rex = 0x40 | (src >= 8) << 2 | (dst >= 8);
+    if (rex != 0x40) {
+        emit8(rex);
+    }
+    emit8(0x89);
+    emit8(0xC0 | (src & 7) << 3 | (dst & 7));
+}
+
+// mov dst32, [r15 + displacement]
+void JitEngine::emitLoad(int dst, int32_t displacement) {
+    emit8(0x41 | (dst >= 8) << 2);
+    emit8(0x8B);
+    emitMemory(dst, displacement);
+}
+
+// mov [r15 + displacement], src32
+void JitEngine::emitStore(int32_t displacement, int src) {
+    emit8(0x41 | (src >= 8) << 2);
+    emit8(0x89);
+    emitMemory(src, displacement);
+}
+
+// mov dst32, imm32
+void JitEngine::emitImmediate(int dst, uint32_t value) {
+    if (dst >= 8) {
+        emit8(0x41);
+    }
+    emit8(0xB8 | (dst & 7));
+    emit32(value);
+}
+
+// jcc or jmp rel32 with the target filled in later by patch()
+size_t JitEngine::emitJump(int condition) {
+    if (condition == CC_ALWAYS) {
+        emit8(0xE9);
+    } else {
+        emit8(0x0F);
+        emit8(0x80 | condition);
+    }
+    emit32(0);
+    return codeUsed - 4;
+}
+
+void JitEngine::patch(size_t rel32, const uint8_t *target) {
+    int32_t offset = target - (code + rel32 + 4);
+    memcpy(code + rel32, &offset, 4);
+}
+
+// call function(context, esi, edx)
+void JitEngine::emitCall(const void *function) {
+    emit8(0x4C); emit8(0x89); emit8(0xFF); // mov rdi, r15
+    emit8(0x48); emit8(0xB8);              // mov rax, function
+    emit64(reinterpret_cast<uint64_t>(function));
+    emit8(0xFF); emit8(0xD0);              // call rax
+}
+
+// mov eax, pc and jump to the block for pc if it can be chained, else to the
+// dispatcher. pcs the dispatcher must see (past the program, misaligned, the
+// stop pc) are never chained
+void JitEngine::emitExit(uint32_t pc, bool chain) {
+    emitImmediate(RAX, pc);
+    size_t rel32 = emitJump(CC_ALWAYS);
+    chain = chain && pc <= maxPC && !(pc & 3) && pc != stopPC;
+    if (chain && pc >= codeBase && blockAt(pc).entry) {
+        patch(rel32, blockAt(pc).entry);
+        return;
+    }
+    patch(rel32, exitStub);
+    if (chain) {
+        pendingChains[pc].push_back(rel32);
+    }
+}
+
+// store the cached guest registers the block has written so far
+void JitEngine::emitWriteBack() {
+    for (uint32_t guest = 1; guest < 32; guest++) {
+        if (hostRegister[guest] >= 0 && dirty[guest]) {
+            emitStore(guest * 4, hostRegister[guest]);
+        }
+    }
+}
+
+// host scratch register = guest register
+void JitEngine::loadGuest(int host, uint32_t guest) {
+    if (guest == 0) {
+        emit8(0x31); // xor host, host
+        emit8(0xC0 | host << 3 | host);
+    } else if (hostRegister[guest] >= 0) {
+        emitMove(host, hostRegister[guest]);
+    } else {
+        emitLoad(host, guest * 4);
+    }
+}
+
+// guest register = host scratch register; writes to x0 are dropped
+void JitEngine::storeGuest(uint32_t guest, int host) {
+    if (guest == 0) {
+        return;
+    }
+    if (hostRegister[guest] >= 0) {
+        emitMove(hostRegister[guest], host);
+        dirty[guest] = true;
+    } else {
+        emitStore(guest * 4, host);
+    }
+}
+
+int32_t JitEngine::loadByte(JitContext *context, uint32_t address) {
+    return static_cast<int8_t>(context->engine->cpu.memory.readByte(address));
+}
+
+int32_t JitEngine::loadHalf(JitContext *context, uint32_t address) {
+    return static_cast<int16_t>(context->engine->cpu.memory.readHalf(address));
+}
+
+int32_t JitEngine::loadWord(JitContext *context, uint32_t address) {
+    return context->engine->cpu.memory.read(address);
+}
+
+int32_t JitEngine::loadByteUnsigned(JitContext *context, uint32_t address) {
+    return context->engine->cpu.memory.readByte(address);
+}
+
+int32_t JitEngine::loadHalfUnsigned(JitContext *context, uint32_t address) {
+    return context->engine->cpu.memory.readHalf(address);
+}
+
+uint32_t JitEngine::storeByte(JitContext *context, uint32_t address, int32_t data) {
+    context->engine->cpu.memory.writeByte(address, data & 0xFF);
+    return context->engine->stored(address, 1);
+}
+
+uint32_t JitEngine::storeHalf(JitContext *context, uint32_t address, int32_t data) {
+    context->engine->cpu.memory.writeHalf(address, data & 0xFFFF);
+    return context->engine->stored(address, 2);
+}
+
+uint32_t JitEngine::storeWord(JitContext *context, uint32_t address, int32_t data) {
+    context->engine->cpu.memory.write(address, data);
+    return context->engine->stored(address, 4);
+}
+
+// keep the decode cache coherent and drop every translation once a store
+// lands on a page with translated code
+uint32_t JitEngine::stored(uint32_t address, uint32_t size) {
+    cpu.decodeCache.invalidate(address);
+    uint32_t base = codeBase >> Memory::PAGE_BITS;
+    uint32_t first = (address >> Memory::PAGE_BITS) - base;
+    uint32_t last = ((address + size - 1) >> Memory::PAGE_BITS) - base;
+    // pages below codeBase wrap past the end of codePages
+    if ((first < codePages.size() && codePages[first]) || (last < codePages.size() && codePages[last])) {
+        flushPending = true;
+        return 1;
+    }
+    return 0;
+}
+
+// start over for a new program bound or stop pc, both of which are compiled
+// into the blocks. the tables start at the page of the first pc rather than
+// at 0, since a program linked high would otherwise need an entry for every
+// word below it
+void JitEngine::reset(uint32_t pc, unsigned long maxPC, uint64_t stopPC) {
+    this->maxPC = maxPC;
+    this->stopPC = stopPC;
+    codeBase = (pc <= maxPC ? pc : maxPC) & ~Memory::PAGE_MASK;
+    blocks.assign(((maxPC - codeBase) >> 2) + 1, Block{nullptr, 0});
+    codePages.assign(((maxPC - codeBase) >> Memory::PAGE_BITS) + 1, 0);
+    pendingChains.clear();
+    codeUsed = codeStart;
+    flushPending = false;
+}
+
+// for control that goes below the code seen so far
+void JitEngine::cover(uint32_t pc) {
+    uint32_t base = pc & ~Memory::PAGE_MASK;
+    blocks.insert(blocks.begin(), (codeBase - base) >> 2, Block{nullptr, 0});
+    codePages.insert(codePages.begin(), (codeBase - base) >> Memory::PAGE_BITS, 0);
+    codeBase = base;
+}
+
+void JitEngine::flush() {
+    blocks.assign(blocks.size(), Block{nullptr, 0});
+    codePages.assign(codePages.size(), 0);
+    pendingChains.clear();
+    codeUsed = codeStart;
+    flushPending = false;
+    flushes++;
+}
+
+// translate the basic block starting at pc. returns nullptr if its first
+// instruction has to be interpreted
+JitEngine::Block *JitEngine::translate(uint32_t pc) {
+    if (codeUsed + MAX_BLOCK_CODE > CODE_SIZE) {
+        flush();
+    }
+
+    // find the end of the block
+    vector<DecodedInstruction> instructions;
+    uint64_t end = pc;
+    while (instructions.size() < MAX_BLOCK_LENGTH && end <= maxPC && (instructions.empty() || end != stopPC)) {
+        DecodedInstruction decoded = cpu.resolve(cpu.decode(cpu.memory.read(end)));
+        if (decoded.id == INST_INVALID || decoded.id == INST_SYSTEM
+            || (decoded.signals[Atomic] && decoded.id != INST_FENCE)) {
+            break; // atomics run through the interpreter
+        }
+        instructions.push_back(decoded);
+        codePages[(end - codeBase) >> Memory::PAGE_BITS] = 1;
+        end += 4;
+        if (decoded.signals[Branch] || decoded.id == INST_JAL || decoded.id == INST_JALR) {
+            break;
+        }
+    }
+    if (instructions.empty()) {
+        return nullptr;
+    }
+    uint32_t length = instructions.size();
+
+    // the guest registers used most often get host registers
+    uint32_t uses[32] = {};
+    for (const DecodedInstruction &decoded : instructions) {
+        const InstructionParts &parts = decoded.parts;
+        if (decoded.id != INST_LUI && decoded.id != INST_AUIPC && decoded.id != INST_JAL && decoded.id != INST_FENCE) {
+            uses[parts.rs1]++;
+        }
+        if (decoded.signals[Branch] || decoded.signals[MemWrite] || parts.opcode == 0x33) {
+            uses[parts.rs2]++;
+        }
+        if (decoded.signals[RegWrite]) {
+            uses[parts.rd]++;
+        }
+    }
+    uses[0] = 0;
+    for (int i = 0; i < 32; i++) {
+        hostRegister[i] = -1;
+        dirty[i] = false;
+    }
+    for (int slot = 0; slot < CACHED_REGISTERS; slot++) {
+        uint32_t best = 0;
+        for (uint32_t guest = 1; guest < 32; guest++) {
+            if (hostRegister[guest] < 0 && uses[guest] > uses[best]) {
+                best = guest;
+            }
+        }
+        if (uses[best] < 2) {
+            break; // one use is no cheaper in a register
+        }
+        hostRegister[best] = CACHE_REGISTERS[slot];
+    }
+
+    Block &block = blockAt(pc);
+    block.entry = code + codeUsed;
+    block.length = length;
+
+    // leave without executing anything if the block would overrun the budget
+    emit8(0x49); emit8(0x8B); emitMemory(RAX, EXECUTED); // mov rax, [r15 + executed]
+    emit8(0x48); emit8(0x05); emit32(length);            // add rax, length
+    emit8(0x49); emit8(0x3B); emitMemory(RAX, BUDGET);   // cmp rax, [r15 + budget]
+    emit8(0x76); emit8(10);                              // jbe over the next two instructions
+    emitImmediate(RAX, pc);
+    patch(emitJump(CC_ALWAYS), exitStub);
+    emit8(0x49); emit8(0x89); emitMemory(RAX, EXECUTED); // mov [r15 + executed], rax
+
+    for (uint32_t guest = 1; guest < 32; guest++) {
+        if (hostRegister[guest] >= 0) {
+            emitLoad(hostRegister[guest], guest * 4);
+        }
+    }
+
+    bool ended = false;
+    for (uint32_t i = 0; i < length; i++) {
+        const DecodedInstruction &decoded = instructions[i];
+        const InstructionParts &parts = decoded.parts;
+        uint32_t at = pc + 4 * i;
+        int32_t immediate = parts.immediate;
+        switch (decoded.id) {
+            case INST_LUI:
+                emitImmediate(RAX, immediate);
+                storeGuest(parts.rd, RAX);
+                break;
+            case INST_AUIPC:
+                emitImmediate(RAX, at + immediate);
+                storeGuest(parts.rd, RAX);
+                break;
+            case INST_JAL:
+                emitImmediate(RAX, at + 4);
+                storeGuest(parts.rd, RAX);
+                emitWriteBack();
+                emitExit(at + immediate, true);
+                ended = true;
+                break;
+            case INST_JALR:
+                // target before link in case rd is rs1
+                loadGuest(RAX, parts.rs1);
+                emit8(0x05); emit32(immediate);   // add eax, immediate
+                emit8(0x83); emit8(0xE0); emit8(0xFE); // and eax, ~1
+                emitImmediate(RCX, at + 4);
+                storeGuest(parts.rd, RCX);
+                emitWriteBack();
+                patch(emitJump(CC_ALWAYS), exitStub);
+                ended = true;
+                break;
+
+            case INST_BEQ: case INST_BNE: case INST_BLT: case INST_BGE: case INST_BLTU: case INST_BGEU: {
+                static const int conditions[] = {CC_E, CC_NE, CC_L, CC_GE, CC_B, CC_AE};
+                emitWriteBack();
+                loadGuest(RAX, parts.rs1);
+                loadGuest(RCX, parts.rs2);
+                emit8(0x39); emit8(0xC8); // cmp eax, ecx
+                size_t taken = emitJump(conditions[decoded.id - INST_BEQ]);
+                emitExit(at + 4, true);
+                patch(taken, code + codeUsed);
+                emitExit(at + immediate, true);
+                ended = true;
+                break;
+            }
+
+            case INST_LB: case INST_LH: case INST_LW: case INST_LBU: case INST_LHU: {
+                static const void *const loads[] = {
+                    reinterpret_cast<const void *>(&loadByte), reinterpret_cast<const void *>(&loadHalf),
+                    reinterpret_cast<const void *>(&loadWord), reinterpret_cast<const void *>(&loadByteUnsigned),
+                    reinterpret_cast<const void *>(&loadHalfUnsigned),
+                };
+                loadGuest(RSI, parts.rs1);
+                emit8(0x81); emit8(0xC6); emit32(immediate); // add esi, immediate
+                emitCall(loads[decoded.id - INST_LB]);
+                storeGuest(parts.rd, RAX);
+                break;
+            }
+
+            case INST_SB: case INST_SH: case INST_SW: {
+                static const void *const stores[] = {
+                    reinterpret_cast<const void *>(&storeByte), reinterpret_cast<const void *>(&storeHalf),
+                    reinterpret_cast<const void *>(&storeWord),
+                };
+                loadGuest(RSI, parts.rs1);
+                emit8(0x81); emit8(0xC6); emit32(immediate); // add esi, immediate
+                loadGuest(RDX, parts.rs2);
+                emitCall(stores[decoded.id - INST_SB]);
+
+                // the store hit translated code: leave before running stale code
+                emit8(0x85); emit8(0xC0); // test eax, eax
+                size_t skip = emitJump(CC_E);
+                emitWriteBack();
+                uint32_t remaining = length - i - 1;
+                if (remaining) {
+                    emit8(0x49); emit8(0x81); // sub qword [r15 + executed], remaining
+                    emitMemory(5, EXECUTED);
+                    emit32(remaining);
+                }
+                emitExit(at + 4, false);
+                patch(skip, code + codeUsed);
+                break;
+            }
+
+            case INST_ADDI: case INST_XORI: case INST_ORI: case INST_ANDI: case INST_SLTI: case INST_SLTIU: {
+                loadGuest(RAX, parts.rs1);
+                emit8(0x81);
+                switch (decoded.id) {
+                    case INST_ADDI: emit8(0xC0); break; // add eax, immediate
+                    case INST_XORI: emit8(0xF0); break; // xor
+                    case INST_ORI:  emit8(0xC8); break; // or
+                    case INST_ANDI: emit8(0xE0); break; // and
+                    default:        emit8(0xF8); break; // cmp
+                }
+                emit32(immediate);
+                if (decoded.id == INST_SLTI || decoded.id == INST_SLTIU) {
+                    emit8(0x0F); emit8(0x90 | (decoded.id == INST_SLTI ? CC_L : CC_B)); emit8(0xC0); // setcc al
+                    emit8(0x0F); emit8(0xB6); emit8(0xC0); // movzx eax, al
+                }
+                storeGuest(parts.rd, RAX);
+                break;
+            }
+
+            case INST_SLLI: case INST_SRLI: case INST_SRAI: {
+                static const uint8_t shifts[] = {0xE0, 0xE8, 0xF8}; // shl, shr, sar
+                loadGuest(RAX, parts.rs1);
+                emit8(0xC1); emit8(shifts[decoded.id - INST_SLLI]); emit8(immediate & 0x1F);
+                storeGuest(parts.rd, RAX);
+                break;
+            }
+
+            case INST_ADD: case INST_SUB: case INST_SLL: case INST_SLT: case INST_SLTU:
+            case INST_XOR: case INST_SRL: case INST_SRA: case INST_OR: case INST_AND:
+                loadGuest(RAX, parts.rs1);
+                loadGuest(RCX, parts.rs2);
+                switch (decoded.id) {
+                    case INST_ADD: emit8(0x01); emit8(0xC8); break; // add eax, ecx
+                    case INST_SUB: emit8(0x29); emit8(0xC8); break; // sub
+                    case INST_XOR: emit8(0x31); emit8(0xC8); break; // xor
+                    case INST_OR:  emit8(0x09); emit8(0xC8); break; // or
+                    case INST_AND: emit8(0x21); emit8(0xC8); break; // and
+                    case INST_SLL: emit8(0xD3); emit8(0xE0); break; // shl eax, cl (masks to 5 bits like riscv)
+                    case INST_SRL: emit8(0xD3); emit8(0xE8); break; // shr
+                    case INST_SRA: emit8(0xD3); emit8(0xF8); break; // sar
+                    default:
+                        emit8(0x39); emit8(0xC8); // cmp eax, ecx
+                        emit8(0x0F); emit8(0x90 | (decoded.id == INST_SLT ? CC_L : CC_B)); emit8(0xC0);
+                        emit8(0x0F); emit8(0xB6); emit8(0xC0);
+                        break;
+                }
+                storeGuest(parts.rd, RAX);
+                break;
+
+            default: // fence
+                emit8(0x0F); emit8(0xAE); emit8(0xF0); // mfence
+                break;
+        }
+    }
+    if (!ended) {
+        emitWriteBack();
+        emitExit(end, true);
+    }
+
+    // blocks already translated can now jump straight here
+    auto waiting = pendingChains.find(pc);
+    if (waiting != pendingChains.end()) {
+        for (size_t rel32 : waiting->second) {
+            patch(rel32, block.entry);
+        }
+        pendingChains.erase(waiting);
+    }
+    blocksTranslated++;
+    return &block;
+}
+
+// run one instruction on the reference datapath
+bool JitEngine::interpret(uint32_t &pc) {
+    fallbacks++;
+    for (int i = 1; i < 32; i++) {
+        cpu.regFile.write(i, context.regs[i]);
+    }
+    cpu.current_PC = pc;
+    InstructionParts parts = cpu.decode(cpu.fetch());
+    uint32_t address = context.regs[parts.rs1] + parts.immediate;
+    if (!cpu.execute(parts)) {
+        return false;
+    }
+    if (lookupDecode(parts).signals & SIG(MemWrite)) {
+        stored(address, 4);
+    }
+    for (int i = 1; i < 32; i++) {
+        context.regs[i] = cpu.regFile.read(i);
+    }
+    context.executed++;
+    pc = cpu.next_PC;
+    return true;
+}
+
+// run from the cpu's next pc like ThreadedEngine::runUntil. translated code
+// returns here only on an exit that isn't chained
+uint64_t JitEngine::run(unsigned long maxPC, uint64_t budget, uint64_t stopPC) {
+    if (!code) {
+#ifdef MAP_JIT
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_JIT;
+#else
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#endif
+        void *mapped = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, flags, -1, 0);
+        if (mapped == MAP_FAILED) {
+            return 0;
+        }
+        code = static_cast<uint8_t *>(mapped);
+
+        // enter(context, block): save callee-saved registers, keep the stack
+        // 16 byte aligned for calls, point r15 at the context and jump
+        static const uint8_t enter[] = {
+            0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57, // push rbx, rbp, r12-r15
+            0x48, 0x83, 0xEC, 0x08, // sub rsp, 8
+            0x49, 0x89, 0xFF,       // mov r15, rdi
+            0xFF, 0xE6,             // jmp rsi
+        };
+        // blocks exit here with the next pc in eax
+        static const uint8_t leave[] = {
+            0x48, 0x83, 0xC4, 0x08, // add rsp, 8
+            0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B, // pop r15-r12, rbp, rbx
+            0xC3,
+        };
+        memcpy(code, enter, sizeof(enter));
+        memcpy(code + sizeof(enter), leave, sizeof(leave));
+        exitStub = code + sizeof(enter);
+        codeStart = codeUsed = sizeof(enter) + sizeof(leave);
+    }
+    if (blocks.empty() || maxPC != this->maxPC || stopPC != this->stopPC) {
+        reset(cpu.next_PC, maxPC, stopPC);
+    }
+    EnterFunction enter = reinterpret_cast<EnterFunction>(code);
+
+    for (int i = 0; i < 32; i++) {
+        context.regs[i] = cpu.regFile.read(i);
+    }
+    context.executed = 0;
+    context.budget = budget;
+    bool bounded = budget != UINT64_MAX || stopPC <= 0xFFFFFFFF;
+    stopped = false;
+
+    uint32_t pc = cpu.next_PC;
+    while (pc <= maxPC) {
+        if (bounded && (context.executed >= budget || (pc == stopPC && context.executed))) {
+            stopped = true;
+            break;
+        }
+        if (flushPending) {
+            flush();
+        }
+        Block *block = nullptr;
+        if (!(pc & 3)) {
+            if (pc < codeBase) {
+                cover(pc);
+            }
+            block = blockAt(pc).entry ? &blockAt(pc) : translate(pc);
+        }
+        if (!block || context.executed + block->length > budget) {
+            if (!interpret(pc)) {
+                break;
+            }
+            continue;
+        }
+        pc = enter(&context, block->entry);
+    }
+
+    for (int i = 1; i < 32; i++) {
+        cpu.regFile.write(i, context.regs[i]);
+    }
+    cpu.current_PC = pc;
+    cpu.next_PC = pc;
+    return context.executed;
+}
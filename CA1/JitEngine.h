@@ -0,0 +1,124 @@
+#ifndef JITENGINE_H
+#define JITENGINE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "CPU.h"
+
+// the jit emits x86-64 code for the system v calling convention
+#if defined(__x86_64__) && !defined(_WIN32)
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+class JitEngine;
+
+// state shared between the dispatcher and translated code, which reaches it
+// through r15
+struct JitContext {
+    int32_t regs[32];
+    uint64_t executed; // instructions retired by this run
+    uint64_t budget;   // leave a block rather than let executed pass this
+    JitEngine *engine;
+};
+
+// basic-block jit: straight-line guest code up to a branch, jal or jalr is
+// translated to x86-64 in an executable mmap region. the most used guest
+// registers of a block live in callee-saved host registers while it runs.
+// exits to blocks that are already known become direct jumps, and exits to
+// blocks translated later are patched into direct jumps then, so hot loops
+// never return to the dispatcher. loads and stores call into Memory. a store
+// to a page holding translated code ends the block and drops every
+// translation. anything the jit doesn't translate (misaligned pcs, atomics,
+// ecall, invalid instructions) runs through CPU::execute
+class JitEngine {
+    public:
+        JitEngine(CPU &cpu);
+        ~JitEngine();
+        JitEngine(const JitEngine &) = delete;
+        JitEngine &operator=(const JitEngine &) = delete;
+        static bool supported() { return JIT_SUPPORTED; }
+
+        // same contract as ThreadedEngine::runUntil; NO_STOP style values
+        // (budget UINT64_MAX, stopPC above 32 bits) disable the stop conditions
+        uint64_t run(unsigned long maxPC, uint64_t budget, uint64_t stopPC);
+        bool hitStop() { return stopped; }
+        uint64_t getBlocks() { return blocksTranslated; }
+        uint64_t getFlushes() { return flushes; }
+        uint64_t getFallbacks() { return fallbacks; }
+    private:
+        struct Block {
+            const uint8_t *entry;
+            uint32_t length; // guest instructions
+        };
+
+        static const size_t CODE_SIZE = 32u << 20;
+        static const size_t MAX_BLOCK_CODE = 64u << 10; // room kept free before translating a block
+        static const uint32_t MAX_BLOCK_LENGTH = 64;
+        static const int CACHED_REGISTERS = 5;
+
+        // loads and stores called from translated code. stores return
+        // nonzero when they hit translated code
+        static int32_t loadByte(JitContext *context, uint32_t address);
+        static int32_t loadHalf(JitContext *context, uint32_t address);
+        static int32_t loadWord(JitContext *context, uint32_t address);
+        static int32_t loadByteUnsigned(JitContext *context, uint32_t address);
+        static int32_t loadHalfUnsigned(JitContext *context, uint32_t address);
+        static uint32_t storeByte(JitContext *context, uint32_t address, int32_t data);
+        static uint32_t storeHalf(JitContext *context, uint32_t address, int32_t data);
+        static uint32_t storeWord(JitContext *context, uint32_t address, int32_t data);
+        uint32_t stored(uint32_t address, uint32_t size);
+
+        void reset(uint32_t pc, unsigned long maxPC, uint64_t stopPC);
+        void cover(uint32_t pc); // grow the tables down to pc's page
+        Block &blockAt(uint32_t pc) { return blocks[(pc - codeBase) >> 2]; }
+        void flush();
+        Block *translate(uint32_t pc);
+        bool interpret(uint32_t &pc);
+
+        // x86-64 emission
+        void emit8(uint8_t byte) { code[codeUsed++] = byte; }
+        void emit32(uint32_t value);
+        void emit64(uint64_t value);
+        void emitMemory(int reg, int32_t displacement); // modrm for [r15 + displacement]
+        void emitMove(int dst, int src);
+        void emitLoad(int dst, int32_t displacement);
+        void emitStore(int32_t displacement, int src);
+        void emitImmediate(int dst, uint32_t value);
+        size_t emitJump(int condition); // returns the offset of the rel32; -1 for jmp
+        void patch(size_t rel32, const uint8_t *target);
+        void emitCall(const void *function);
+        void emitExit(uint32_t pc, bool chain); // leave the block for pc
+        void emitWriteBack();
+        void loadGuest(int host, uint32_t guest);
+        void storeGuest(uint32_t guest, int host);
+
+        CPU &cpu;
+        JitContext context;
+        uint8_t *code;
+        size_t codeUsed;
+        size_t codeStart; // first byte after the entry and exit stubs
+        const uint8_t *exitStub;
+
+        unsigned long maxPC;
+        uint64_t stopPC;
+        uint32_t codeBase;                 // page aligned; programs may be linked anywhere
+        std::vector<Block> blocks;         // indexed by (pc - codeBase) / 4, entry nullptr if untranslated
+        std::vector<uint8_t> codePages;    // guest pages from codeBase's holding translated code
+        std::unordered_map<uint32_t, std::vector<size_t>> pendingChains; // pc to jmp rel32s waiting for it
+        bool flushPending;
+
+        // per block register allocation while translating
+        int hostRegister[32]; // -1 when the guest register stays in memory
+        bool dirty[32];
+
+        uint64_t blocksTranslated;
+        uint64_t flushes;
+        uint64_t fallbacks;
+        bool stopped;
+};
+
+#endif // JITENGINE_H
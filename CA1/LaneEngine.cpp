@@ -0,0 +1,384 @@
+#include "LaneEngine.h"
+using namespace std;
+
+LaneEngine::LaneEngine(Engine fallback) : fallback(fallback) {
+    lanes = 0;
+    steps = 0;
+    scalarLanes = 0;
+    running = 0;
+    for (int lane = 0; lane < LANES; lane++) {
+        retired[lane] = 0;
+    }
+}
+
+bool LaneEngine::addLane(CPU &cpu, const Program &program) {
+    if (lanes == LANES) {
+        return false;
+    }
+    cpus[lanes] = &cpu;
+    programs[lanes] = program;
+    lanes++;
+    return true;
+}
+
+// whether any lane of a mask is set
+static bool any(const LaneVector &mask) {
+    int32_t set = 0;
+    for (int lane = 0; lane < LaneEngine::LANES; lane++) {
+        set |= mask[lane];
+    }
+    return set != 0;
+}
+
+// cache the instruction at pc in op, decoding it from the first running
+// lane there and comparing every lane's word with it
+const LaneEngine::LaneOp &LaneEngine::fill(LaneOp &op, uint32_t pc) {
+    int leader = 0;
+    while (leader < lanes - 1 && !(active[leader] && pcs[leader] == pc)) {
+        leader++;
+    }
+    LaneVector words = {};
+    for (int lane = 0; lane < lanes; lane++) {
+        words[lane] = cpus[lane]->getMemory().read(pc);
+    }
+    CPU &cpu = *cpus[leader];
+    op.pc = pc;
+    op.same = words == words[leader];
+    op.decoded = cpu.resolve(cpu.decode(words[leader]));
+    return op;
+}
+
+// a store to any lane's memory may have changed the word a cached op was
+// decoded from or compared against
+void LaneEngine::stored(uint32_t address, uint32_t size) {
+    uint32_t words = ((address & 3) + size + 3) >> 2; // a misaligned store can reach two
+    for (uint32_t i = 0; i < words; i++) {
+        uint32_t word = (address & ~3u) + 4 * i;
+        LaneOp &op = ops[(word >> 2) & (OP_CACHE_SIZE - 1)];
+        if (op.pc == word) {
+            op.pc = NO_PC;
+        }
+    }
+}
+
+void LaneEngine::run() {
+    running = 0;
+    for (int lane = 0; lane < LANES; lane++) {
+        bool used = lane < lanes;
+        for (int i = 0; i < 32; i++) {
+            regs[i][lane] = used ? cpus[lane]->readRegister(i) : 0;
+        }
+        pcs[lane] = used ? cpus[lane]->readPC() : 0;
+        ends[lane] = used ? programs[lane].end : 0;
+        active[lane] = used ? -1 : 0;
+        running += used;
+    }
+    waits = LaneVector{};
+    counted = LaneVector{};
+    ops.assign(OP_CACHE_SIZE, LaneOp{NO_PC, {}, {}});
+
+    uint64_t windowSteps = 0;
+    uint64_t windowLanes = 0;
+    int first = 0; // lowest active lane
+    while (true) {
+        // lanes that ran past their program stop there
+        LaneVector done = active & reinterpret_cast<LaneVector>(pcs > ends);
+        if (any(done)) {
+            for (int lane = 0; lane < lanes; lane++) {
+                if (done[lane]) {
+                    finish(lane);
+                }
+            }
+        }
+        while (first < lanes && !active[first]) {
+            first++;
+        }
+        if (first == lanes) {
+            break;
+        }
+
+        // the common case: every running lane is at the first one's aligned
+        // pc and has the same word there
+        const LaneOp *op = pcs[first] & 3 ? nullptr : &lookup(pcs[first]);
+        LaneVector group = {};
+        uint64_t size = running;
+        if (op) {
+            group = active & reinterpret_cast<LaneVector>(pcs == pcs[first]) & op->same;
+        }
+        uint64_t taken = 1;
+        if (op && !any(group ^ active)) {
+            waits = LaneVector{};
+            taken = runTogether(first, WINDOW - windowSteps);
+        } else {
+            // otherwise lanes can share a step when they are at the same pc
+            // with the same instruction word there. the biggest such group
+            // goes next, the one at the lowest pc on a tie, unless some lane
+            // has been left waiting for MAX_WAIT steps; then its group goes
+            // so that no lane starves
+            LaneVector words = {};
+            for (int lane = 0; lane < lanes; lane++) {
+                if (active[lane]) {
+                    words[lane] = cpus[lane]->getMemory().read(pcs[lane]);
+                }
+            }
+            int leader = -1;
+            size = 0;
+            int starved = -1;
+            for (int lane = 0; lane < lanes; lane++) {
+                if (active[lane] && waits[lane] >= MAX_WAIT && (starved < 0 || waits[lane] > waits[starved])) {
+                    starved = lane;
+                }
+            }
+            for (int lane = 0; lane < lanes; lane++) {
+                if (!active[lane] || (leader >= 0 && group[lane]) || (starved >= 0 && lane != starved)) {
+                    continue;
+                }
+                LaneVector same = active & reinterpret_cast<LaneVector>(pcs == pcs[lane]) & (words == words[lane]);
+                uint64_t count = 0;
+                for (int other = 0; other < LANES; other++) {
+                    count -= same[other];
+                }
+                if (count > size || (count == size && pcs[lane] < pcs[leader])) {
+                    leader = lane;
+                    group = same;
+                    size = count;
+                }
+            }
+            waits = (waits + 1) & active & ~group;
+            uint32_t pc = pcs[leader];
+            cpus[leader]->setPC(pc);
+            step<false>(*cpus[leader]->decodeCached(), group);
+        }
+        steps += taken;
+
+        // too little shared work left for lockstep to pay
+        windowSteps += taken;
+        windowLanes += taken * size;
+        if (windowSteps == WINDOW) {
+            count();
+            if (windowLanes < MIN_GROUP * WINDOW) {
+                for (int lane = 0; lane < lanes; lane++) {
+                    if (active[lane]) {
+                        runScalar(lane);
+                    }
+                }
+                break;
+            }
+            windowSteps = 0;
+            windowLanes = 0;
+        }
+    }
+}
+
+// step every running lane as one from the first lane's pc, where they all
+// are with the same word, until they part at a branch or jalr, one of them
+// leaves, they reach a word they don't share or limit steps are taken.
+// returns the steps taken. the pc stays uniform in between, so each step
+// skips the regrouping and the per lane end checks
+uint64_t LaneEngine::runTogether(int first, uint64_t limit) {
+    uint32_t end = NO_PC;
+    for (int lane = 0; lane < lanes; lane++) {
+        if (active[lane] && ends[lane] < end) {
+            end = ends[lane];
+        }
+    }
+    int before = running;
+    uint32_t pc = pcs[first];
+    uint64_t taken = 0;
+    while (taken < limit) {
+        const LaneOp &op = lookup(pc);
+        if (any((op.same & active) ^ active)) {
+            break;
+        }
+        bool parting = step<true>(op.decoded, active);
+        taken++;
+        if (parting && (running != before || any(reinterpret_cast<LaneVector>(pcs != pcs[first]) & active))) {
+            break;
+        }
+        pc = pcs[first];
+        if (pc > end || (pc & 3)) {
+            break;
+        }
+    }
+    return taken;
+}
+
+// signed overflow wraps, so arithmetic goes through the unsigned vector
+#define UV(x) reinterpret_cast<LaneVectorU>(x)
+#define SV(x) reinterpret_cast<LaneVector>(x)
+
+template <bool Whole>
+inline __attribute__((always_inline)) bool LaneEngine::step(const DecodedInstruction &decoded, const LaneVector &group) {
+    const InstructionParts &parts = decoded.parts;
+    const LaneVector &a = regs[parts.rs1];
+    const LaneVector &b = regs[parts.rs2];
+    LaneVector immediate = LaneVector{} + parts.immediate;
+    LaneVectorU next = pcs + 4;
+    LaneVector result = {};
+    bool writes = true;
+
+    switch (decoded.id) {
+        case INST_LUI:   result = immediate; break;
+        case INST_AUIPC: result = SV(pcs + UV(immediate)); break;
+        case INST_JAL:
+            result = SV(next);
+            next = pcs + UV(immediate);
+            break;
+        case INST_JALR:
+            result = SV(next);
+            next = UV(a + immediate) & ~1u;
+            break;
+
+        case INST_BEQ: case INST_BNE: case INST_BLT: case INST_BGE: case INST_BLTU: case INST_BGEU: {
+            LaneVector taken;
+            switch (decoded.id) {
+                case INST_BEQ:  taken = a == b; break;
+                case INST_BNE:  taken = a != b; break;
+                case INST_BLT:  taken = a < b; break;
+                case INST_BGE:  taken = a >= b; break;
+                case INST_BLTU: taken = UV(a) < UV(b); break;
+                default:        taken = UV(a) >= UV(b); break;
+            }
+            next = (UV(taken) & (pcs + UV(immediate))) | (~UV(taken) & next);
+            writes = false;
+            break;
+        }
+
+        case INST_LB: case INST_LH: case INST_LW: case INST_LBU: case INST_LHU:
+            for (int lane = 0; lane < lanes; lane++) {
+                if (!group[lane]) {
+                    continue;
+                }
+                Memory &memory = cpus[lane]->getMemory();
+                uint32_t address = a[lane] + parts.immediate;
+                switch (decoded.id) {
+                    case INST_LB:  result[lane] = static_cast<int8_t>(memory.readByte(address)); break;
+                    case INST_LH:  result[lane] = static_cast<int16_t>(memory.readHalf(address)); break;
+                    case INST_LW:  result[lane] = memory.read(address); break;
+                    case INST_LBU: result[lane] = memory.readByte(address); break;
+                    default:       result[lane] = memory.readHalf(address); break;
+                }
+            }
+            break;
+        case INST_SB: case INST_SH: case INST_SW:
+            for (int lane = 0; lane < lanes; lane++) {
+                if (!group[lane]) {
+                    continue;
+                }
+                Memory &memory = cpus[lane]->getMemory();
+                uint32_t address = a[lane] + parts.immediate;
+                switch (decoded.id) {
+                    case INST_SB: memory.writeByte(address, b[lane] & 0xFF); break;
+                    case INST_SH: memory.writeHalf(address, b[lane] & 0xFFFF); break;
+                    default:      memory.write(address, b[lane]); break;
+                }
+                cpus[lane]->getDecodeCache().invalidate(address);
+                stored(address, 1u << (parts.funct3 & 3));
+            }
+            writes = false;
+            break;
+
+        case INST_ADDI:  result = SV(UV(a) + UV(immediate)); break;
+        case INST_SLTI:  result = (a < immediate) & 1; break;
+        case INST_SLTIU: result = SV(UV(a) < UV(immediate)) & 1; break;
+        case INST_XORI:  result = a ^ immediate; break;
+        case INST_ORI:   result = a | immediate; break;
+        case INST_ANDI:  result = a & immediate; break;
+        case INST_SLLI:  result = SV(UV(a) << UV(immediate & 0x1F)); break;
+        case INST_SRLI:  result = SV(UV(a) >> UV(immediate & 0x1F)); break;
+        case INST_SRAI:  result = a >> (immediate & 0x1F); break;
+
+        case INST_ADD:  result = SV(UV(a) + UV(b)); break;
+        case INST_SUB:  result = SV(UV(a) - UV(b)); break;
+        case INST_SLL:  result = SV(UV(a) << UV(b & 0x1F)); break;
+        case INST_SLT:  result = (a < b) & 1; break;
+        case INST_SLTU: result = SV(UV(a) < UV(b)) & 1; break;
+        case INST_XOR:  result = a ^ b; break;
+        case INST_SRL:  result = SV(UV(a) >> UV(b & 0x1F)); break;
+        case INST_SRA:  result = a >> (b & 0x1F); break;
+        case INST_OR:   result = a | b; break;
+        case INST_AND:  result = a & b; break;
+
+        case INST_FENCE:
+            writes = false; // every lane has its own memory, so there is nothing to order
+            break;
+
+        default:
+            // atomics, ecall and invalid instructions
+            for (int lane = 0; lane < lanes; lane++) {
+                if (!group[lane]) {
+                    continue;
+                }
+                if (decoded.signals[MemWrite]) {
+                    stored(a[lane], 4); // amos and sc.w write the word at rs1
+                }
+                if (!stepScalar(lane)) {
+                    finish(lane);
+                }
+            }
+            return true;
+    }
+
+    if (Whole) {
+        if (writes && parts.rd != 0) {
+            regs[parts.rd] = result;
+        }
+        pcs = next;
+    } else {
+        if (writes && parts.rd != 0) {
+            regs[parts.rd] = (result & group) | (regs[parts.rd] & ~group);
+        }
+        pcs = (next & UV(group)) | (pcs & ~UV(group));
+    }
+    counted += group; // -1 for lanes in the group
+    return decoded.signals[Branch] || decoded.id == INST_JALR;
+}
+
+#undef UV
+#undef SV
+
+bool LaneEngine::stepScalar(int lane) {
+    CPU &cpu = *cpus[lane];
+    for (int i = 1; i < 32; i++) {
+        cpu.writeRegister(i, regs[i][lane]);
+    }
+    cpu.setPC(pcs[lane]);
+    if (!cpu.step()) {
+        return false;
+    }
+    cpu.updateCurrentFromNext();
+    for (int i = 1; i < 32; i++) {
+        regs[i][lane] = cpu.readRegister(i);
+    }
+    pcs[lane] = cpu.readPC();
+    retired[lane]++;
+    return true;
+}
+
+void LaneEngine::count() {
+    for (int lane = 0; lane < lanes; lane++) {
+        retired[lane] -= counted[lane];
+    }
+    counted = LaneVector{};
+}
+
+// hand a lane's state back to its cpu and stop running it
+void LaneEngine::finish(int lane) {
+    count();
+    CPU &cpu = *cpus[lane];
+    for (int i = 1; i < 32; i++) {
+        cpu.writeRegister(i, regs[i][lane]);
+    }
+    cpu.setPC(pcs[lane]);
+    running -= active[lane] != 0;
+    active[lane] = 0;
+}
+
+// run the rest of a lane's program on its own
+void LaneEngine::runScalar(int lane) {
+    finish(lane);
+    Simulator simulator(*cpus[lane], fallback);
+    simulator.setRetired(retired[lane]);
+    retired[lane] = simulator.run(programs[lane]);
+    scalarLanes++;
+}
@@ -0,0 +1,105 @@
+#ifndef LANEENGINE_H
+#define LANEENGINE_H
+
+#include <cstdint>
+#include <vector>
+#include "CPU.h"
+#include "Loader.h"
+#include "Simulator.h"
+
+// lanes per batch and the vector holding one register across them. with
+// -mavx512f a vector is one zmm register, with -mavx2 one ymm register, and
+// otherwise the compiler splits it over whatever the host has. plain sse2
+// gets one xmm register of 4 lanes, since it lacks the unsigned compares and
+// per lane shifts an 8 lane vector would have to be split up for. 4 lanes
+// don't beat the threaded engine, so batches only use lanes from 8 up
+#if defined(__AVX512F__)
+#define LANE_COUNT 16
+#elif defined(__x86_64__) && !defined(__AVX2__)
+#define LANE_COUNT 4
+#else
+#define LANE_COUNT 8
+#endif
+typedef int32_t LaneVector __attribute__((vector_size(LANE_COUNT * sizeof(int32_t))));
+typedef uint32_t LaneVectorU __attribute__((vector_size(LANE_COUNT * sizeof(uint32_t))));
+
+// runs up to LANES independent programs in lockstep. registers are kept
+// structure of arrays, one LaneVector per guest register, and each step runs
+// one decoded instruction for every lane at the same pc with the same
+// instruction word; other lanes are masked off and wait. instructions are
+// decoded once per pc into a small direct mapped cache that also records
+// which lanes hold the same word there, so while every running lane is at
+// one pc a step costs a lookup and the vector operation. when they are
+// not, the biggest group goes first, the lowest pc on a tie so lanes that
+// fell behind catch up, and a lane passed over for MAX_WAIT steps goes
+// regardless. loads and stores go lane by lane to each program's own
+// memory, and anything without a vector form runs through CPU::step. once
+// the lanes have drifted apart so far that steps average under MIN_GROUP
+// lanes, the rest of each program runs alone on the fallback engine
+class LaneEngine {
+    public:
+        static const int LANES = LANE_COUNT;
+        static const bool WORTHWHILE = LANES >= 8; // otherwise -e lanes batches run threaded
+
+        LaneEngine(Engine fallback);
+        // cpu must have its program loaded and pc set; false once LANES are in use
+        bool addLane(CPU &cpu, const Program &program);
+        // run every lane until its program ends, leaving the final state in
+        // each cpu like Simulator::run does
+        void run();
+        uint64_t getRetired(int lane) { return retired[lane]; }
+        uint64_t getSteps() { return steps; }
+        uint64_t getScalarLanes() { return scalarLanes; } // lanes finished by the fallback engine
+    private:
+        static const uint64_t WINDOW = 1024; // steps between divergence checks
+        static const uint64_t MIN_GROUP = 2;
+        static const int32_t MAX_WAIT = 64;    // steps a lane may be passed over
+        static const uint32_t OP_CACHE_SIZE = 4096; // decoded pcs, a power of two
+        static const uint32_t NO_PC = 0xFFFFFFFF;   // tag of an empty entry; never an aligned pc
+
+        // an instruction decoded from the lowest running lane at pc when it
+        // was cached, and the lanes whose word at pc is the same
+        struct LaneOp {
+            uint32_t pc;
+            LaneVector same;
+            DecodedInstruction decoded;
+        };
+
+        const LaneOp &lookup(uint32_t pc) {
+            LaneOp &op = ops[(pc >> 2) & (OP_CACHE_SIZE - 1)];
+            return op.pc == pc ? op : fill(op, pc);
+        }
+        const LaneOp &fill(LaneOp &op, uint32_t pc);
+        uint64_t runTogether(int first, uint64_t limit);
+        void stored(uint32_t address, uint32_t size); // drop cached ops a store overwrote
+
+        // execute the instruction at the leader's pc for the lanes in group.
+        // Whole is for a group of every running lane: finished lanes' state
+        // is already back in their cpus, so results needn't be masked.
+        // returns true if the lanes may now be at different pcs
+        template <bool Whole>
+        bool step(const DecodedInstruction &decoded, const LaneVector &group);
+        // one lane through the reference datapath; false if the instruction failed
+        bool stepScalar(int lane);
+        void count(); // add counted into retired
+        void finish(int lane);
+        void runScalar(int lane);
+
+        Engine fallback;
+        int lanes;
+        CPU *cpus[LANES];
+        Program programs[LANES];
+        LaneVector regs[32];
+        LaneVectorU pcs;
+        LaneVectorU ends;   // last pc each program may run
+        LaneVector active;  // -1 for lanes still running
+        LaneVector waits;   // steps since each lane last ran
+        int running;        // lanes still active
+        std::vector<LaneOp> ops; // OP_CACHE_SIZE entries indexed by pc / 4
+        uint64_t retired[LANES];
+        LaneVector counted; // minus the steps since retired was last brought up to date
+        uint64_t steps;
+        uint64_t scalarLanes;
+};
+
+#endif // LANEENGINE_H
@@ -0,0 +1,268 @@
+#include "Loader.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+// the parts of the ELF format the loader reads, defined here because
+// <elf.h> is only found on Linux
+static const uint8_t ELF_MAGIC[4] = {0x7F, 'E', 'L', 'F'};
+static const int ELF_CLASS = 4;        // e_ident index of the word size
+static const int ELF_DATA = 5;         // e_ident index of the byte order
+static const uint8_t ELF_CLASS_32 = 1;
+static const uint8_t ELF_DATA_LSB = 1;
+static const uint16_t ELF_MACHINE_RISCV = 243;
+static const uint32_t SEGMENT_LOAD = 1;
+static const uint32_t SEGMENT_EXECUTE = 1; // p_flags bit
+
+struct ElfHeader {
+    uint8_t e_ident[16];
+    uint16_t e_type;
+    uint16_t e_machine;
+    uint32_t e_version;
+    uint32_t e_entry;
+    uint32_t e_phoff;
+    uint32_t e_shoff;
+    uint32_t e_flags;
+    uint16_t e_ehsize;
+    uint16_t e_phentsize;
+    uint16_t e_phnum;
+    uint16_t e_shentsize;
+    uint16_t e_shnum;
+    uint16_t e_shstrndx;
+};
+
+struct ElfSegment {
+    uint32_t p_type;
+    uint32_t p_offset;
+    uint32_t p_vaddr;
+    uint32_t p_paddr;
+    uint32_t p_filesz;
+    uint32_t p_memsz;
+    uint32_t p_flags;
+    uint32_t p_align;
+};
+
+// character classes for the hex text parser: 0-15 are digit values
+static const uint8_t HEX_SPACE = 0x10;
+static const uint8_t HEX_TEXT = 0x20; // printable, but not part of the hex format
+static const uint8_t HEX_BAD = 0xFF;
+
+// lookup table from input character to digit value or class
+struct HexTable {
+    uint8_t values[256];
+    HexTable() {
+        memset(values, HEX_BAD, sizeof(values));
+        for (int c = '!'; c <= '~'; c++) values[c] = HEX_TEXT;
+        for (int c = '0'; c <= '9'; c++) values[c] = c - '0';
+        for (int c = 'a'; c <= 'f'; c++) values[c] = c - 'a' + 10;
+        for (int c = 'A'; c <= 'F'; c++) values[c] = c - 'A' + 10;
+        values[' '] = values['\t'] = values['\n'] = values['\r'] = values['\v'] = values['\f'] = HEX_SPACE;
+    }
+};
+static const HexTable hexTable;
+
+// map the file read-only and hand it to the loader for its format
+bool Loader::load(const char *path, Memory &memory, Program &program) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    const uint8_t *data = static_cast<const uint8_t *>(mapped);
+
+    bool ok;
+    if (size >= sizeof(ELF_MAGIC) && memcmp(data, ELF_MAGIC, sizeof(ELF_MAGIC)) == 0) {
+        ok = loadElf(data, size, memory, program);
+    } else if (isText(data, size)) {
+        // a typo in a hex program is an error, not a reason to run it as binary
+        ok = loadHex(data, size, memory, program);
+    } else {
+        ok = loadBinary(data, size, memory, program);
+    }
+    munmap(mapped, size);
+    return ok;
+}
+
+// back the guest pages from address on with the file's pages. the last
+// page reads as zero past the end of the file
+bool Loader::mapFile(const char *path, uint32_t address, bool readOnly, Memory &memory, string &error) {
+    if (address & Memory::PAGE_MASK) {
+        error = "map address of " + string(path) + " is not page aligned";
+        return false;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        error = "error opening " + string(path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        error = string(path) + " is empty";
+        return false;
+    }
+    size_t size = st.st_size;
+    if (size > (1ull << 32) - address) {
+        close(fd);
+        error = string(path) + " does not fit in the address space above its map address";
+        return false;
+    }
+    int protection = readOnly ? PROT_READ : PROT_READ | PROT_WRITE;
+    void *mapped = mmap(nullptr, size, protection, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        error = "error mapping " + string(path);
+        return false;
+    }
+
+    uint8_t *data = static_cast<uint8_t *>(mapped);
+    uint32_t pages = (size + Memory::PAGE_MASK) >> Memory::PAGE_BITS;
+    for (uint32_t i = 0; i < pages; i++) {
+        memory.mapPage((address >> Memory::PAGE_BITS) + i, data + (size_t)i * Memory::PAGE_SIZE, readOnly);
+    }
+    memory.adoptMapping(mapped, size);
+    return true;
+}
+
+// split file@address[:ro|:cow] and map it
+bool Loader::mapSpec(const string &spec, Memory &memory, string &error) {
+    string path = spec;
+    bool readOnly = true;
+    size_t colon = path.rfind(':');
+    if (colon != string::npos && (path.substr(colon) == ":ro" || path.substr(colon) == ":cow")) {
+        readOnly = path.substr(colon) == ":ro";
+        path.erase(colon);
+    }
+    size_t at = path.rfind('@');
+    char *end = nullptr;
+    unsigned long long address = 0;
+    if (at != string::npos) {
+        address = strtoull(path.c_str() + at + 1, &end, 0);
+    }
+    if (at == string::npos || at == 0 || *end != '\0' || end == path.c_str() + at + 1 || address > 0xFFFFFFFFull) {
+        error = "bad map " + spec + "; expected file@address[:ro|:cow]";
+        return false;
+    }
+    path.erase(at);
+    return mapFile(path.c_str(), address, readOnly, memory, error);
+}
+
+// copy the loadable segments of a little endian RV32 executable into memory
+bool Loader::loadElf(const uint8_t *data, size_t size, Memory &memory, Program &program) {
+    if (size < sizeof(ElfHeader)) {
+        return false;
+    }
+    const ElfHeader *header = reinterpret_cast<const ElfHeader *>(data);
+    if (header->e_ident[ELF_CLASS] != ELF_CLASS_32 || header->e_ident[ELF_DATA] != ELF_DATA_LSB
+        || header->e_machine != ELF_MACHINE_RISCV || header->e_phentsize != sizeof(ElfSegment)
+        || header->e_phoff + (size_t)header->e_phnum * sizeof(ElfSegment) > size) {
+        return false;
+    }
+
+    const ElfSegment *segments = reinterpret_cast<const ElfSegment *>(data + header->e_phoff);
+    program.entry = header->e_entry;
+    program.end = 0;
+    for (int i = 0; i < header->e_phnum; i++) {
+        const ElfSegment &segment = segments[i];
+        if (segment.p_type != SEGMENT_LOAD) {
+            continue;
+        }
+        if ((size_t)segment.p_offset + segment.p_filesz > size || segment.p_filesz > segment.p_memsz
+            || (uint64_t)segment.p_vaddr + segment.p_memsz > 1ull << 32) {
+            return false; // past the file, or wrapping past the top of the address space
+        }
+        // the bss tail is already zero in fresh memory
+        if (!memory.load(segment.p_vaddr, data + segment.p_offset, segment.p_filesz)) {
+            return false;
+        }
+        if ((segment.p_flags & SEGMENT_EXECUTE) && segment.p_vaddr + segment.p_memsz > program.end) {
+            program.end = segment.p_vaddr + segment.p_memsz;
+        }
+    }
+    return program.end != 0; // there is no code to run without an executable segment
+}
+
+// true if every byte is printable ascii or whitespace. raw binaries give
+// themselves away within the first few bytes, since opcodes are control codes
+bool Loader::isText(const uint8_t *data, size_t size) {
+    const uint8_t *table = hexTable.values;
+    for (size_t i = 0; i < size; i++) {
+        if (table[data[i]] == HEX_BAD) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// parse whitespace separated hex bytes, taking the common "xx\n" layout
+// three characters at a time. returns false on anything that isn't hex text
+bool Loader::loadHex(const uint8_t *data, size_t size, Memory &memory, Program &program) {
+    const uint8_t *table = hexTable.values;
+    vector<uint8_t> bytes;
+    bytes.reserve(size / 3 + 1);
+
+    size_t i = 0;
+    uint32_t value = 0;
+    bool inToken = false;
+    while (i < size) {
+        // fast path: a two digit token followed by one separator
+        while (!inToken && i + 3 <= size) {
+            uint8_t high = table[data[i]], low = table[data[i + 1]], separator = table[data[i + 2]];
+            if ((high | low) >= 16 || separator != HEX_SPACE) {
+                break;
+            }
+            bytes.push_back(high << 4 | low);
+            i += 3;
+        }
+        if (i >= size) {
+            break;
+        }
+
+        // slow path: one character of an irregular token or run of whitespace
+        uint8_t v = table[data[i++]];
+        if (v < 16) {
+            value = value << 4 | v;
+            inToken = true;
+        } else if (v == HEX_SPACE) {
+            if (inToken) {
+                bytes.push_back(value & 0xFF);
+            }
+            value = 0;
+            inToken = false;
+        } else {
+            return false;
+        }
+    }
+    if (inToken) {
+        bytes.push_back(value & 0xFF);
+    }
+    if (bytes.empty()) {
+        return false;
+    }
+
+    program.entry = 0;
+    program.end = bytes.size();
+    return memory.load(0, bytes.data(), bytes.size());
+}
+
+// a raw binary image is copied to address 0 and executed from there
+bool Loader::loadBinary(const uint8_t *data, size_t size, Memory &memory, Program &program) {
+    program.entry = 0;
+    program.end = size;
+    return memory.load(0, data, size);
+}
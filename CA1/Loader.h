@@ -0,0 +1,37 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include "Memory.h"
+
+// where a loaded program starts and where its code ends
+struct Program {
+    uint32_t entry; // initial pc
+    uint32_t end;   // one past the last code byte; the simulation stops past this pc
+};
+
+// loads program images into guest memory. the file is mmapped and its format
+// is picked from its contents: RV32 ELF, the one-hex-byte-per-token text
+// format used by the instMem traces for any other text file, or a raw binary
+// loaded at address 0
+class Loader {
+    public:
+        static bool load(const char *path, Memory &memory, Program &program);
+        // mmap a data file into the guest at a page aligned address instead
+        // of copying it in, so loads read the file's pages directly. the
+        // host mapping is private either way: readOnly maps it PROT_READ and
+        // the guest's first store to a page copies it, otherwise the kernel
+        // copies a page on its first write. false with a message in error
+        static bool mapFile(const char *path, uint32_t address, bool readOnly, Memory &memory, std::string &error);
+        // mapFile for a command line spec, file@address[:ro|:cow], read-only by default
+        static bool mapSpec(const std::string &spec, Memory &memory, std::string &error);
+    private:
+        static bool isText(const uint8_t *data, size_t size);
+        static bool loadElf(const uint8_t *data, size_t size, Memory &memory, Program &program);
+        static bool loadHex(const uint8_t *data, size_t size, Memory &memory, Program &program);
+        static bool loadBinary(const uint8_t *data, size_t size, Memory &memory, Program &program);
+};
+
+#endif // LOADER_H
@@ -0,0 +1,234 @@
+#include "LocalityAnalyzer.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+using namespace std;
+
+static const uint32_t MIN_TIMESTAMPS = 1u << 16;
+
+LocalityAnalyzer::LocalityAnalyzer(uint32_t lineSize, uint64_t interval, bool fetches, const string &intervalsPath)
+    : interval(interval), fetches(fetches), intervalsPath(intervalsPath) {
+    lineBits = 0;
+    while ((1u << lineBits) < lineSize) {
+        lineBits++;
+    }
+    tree.assign(MIN_TIMESTAMPS + 1, 0);
+    now = 0;
+    instructions = accesses = coldAccesses = 0;
+    intervalLines = 0;
+}
+
+// a whole number with an optional k or m suffix
+static bool parseCount(const string &text, uint64_t &value) {
+    char *end;
+    value = strtoull(text.c_str(), &end, 10);
+    if (end == text.c_str()) {
+        return false;
+    }
+    if (*end == 'k' || *end == 'K') {
+        value <<= 10;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        value <<= 20;
+        end++;
+    }
+    return *end == '\0';
+}
+
+unique_ptr<LocalityAnalyzer> LocalityAnalyzer::create(const string &spec, string &error) {
+    uint64_t lineSize = 64;
+    uint64_t interval = 1000000;
+    bool fetches = false;
+    string intervalsPath;
+
+    size_t start = 0;
+    while (spec != "default" && start <= spec.size()) {
+        size_t comma = spec.find(',', start);
+        string item = spec.substr(start, comma - start);
+        start = comma == string::npos ? spec.size() + 1 : comma + 1;
+        size_t equals = item.find('=');
+        string key = item.substr(0, equals);
+        string value = equals == string::npos ? "" : item.substr(equals + 1);
+        if (key == "line" && parseCount(value, lineSize) && lineSize >= 4 && lineSize <= 4096
+            && (lineSize & (lineSize - 1)) == 0) {
+            continue;
+        }
+        if (key == "interval" && parseCount(value, interval) && interval > 0) {
+            continue;
+        }
+        if (item == "fetch") {
+            fetches = true;
+            continue;
+        }
+        if (key == "intervals" && !value.empty()) {
+            intervalsPath = value;
+            continue;
+        }
+        error = "bad locality option " + item + "; expected line=<power of two from 4 to 4096>, "
+            "interval=<instructions>, fetch or intervals=<path>";
+        return nullptr;
+    }
+    return unique_ptr<LocalityAnalyzer>(new LocalityAnalyzer(lineSize, interval, fetches, intervalsPath));
+}
+
+// an access that crosses into a second line touches both
+void LocalityAnalyzer::access(uint32_t address, uint32_t size) {
+    uint32_t first = address >> lineBits;
+    uint32_t last = (address + size - 1) >> lineBits;
+    touch(first);
+    if (last != first) {
+        touch(last);
+    }
+}
+
+void LocalityAnalyzer::touch(uint32_t line) {
+    accesses++;
+    if (now + 1 == tree.size()) {
+        renumber();
+    }
+    now++;
+    uint64_t current = workingSets.size() + 1;
+    auto found = lines.find(line);
+    if (found == lines.end()) {
+        coldAccesses++;
+        lines.emplace(line, Line{now, current});
+        add(now, 1);
+        intervalLines++;
+        return;
+    }
+
+    // marks after the line's own are the distinct lines touched since
+    Line &entry = found->second;
+    uint32_t distance = prefix(now) - prefix(entry.time);
+    add(entry.time, -1);
+    add(now, 1);
+    entry.time = now;
+    size_t bucket = distance ? 32 - __builtin_clz(distance) : 0;
+    if (bucket >= histogram.size()) {
+        histogram.resize(bucket + 1, 0);
+    }
+    histogram[bucket]++;
+    if (entry.interval != current) {
+        entry.interval = current;
+        intervalLines++;
+    }
+}
+
+void LocalityAnalyzer::endInterval() {
+    workingSets.push_back(intervalLines);
+    intervalLines = 0;
+}
+
+// give the live marks timestamps 1..lines in the same order, in a tree with
+// room for as many accesses again
+void LocalityAnalyzer::renumber() {
+    vector<pair<uint32_t, Line *>> order;
+    order.reserve(lines.size());
+    for (auto &line : lines) {
+        order.emplace_back(line.second.time, &line.second);
+    }
+    sort(order.begin(), order.end(), [](const pair<uint32_t, Line *> &a, const pair<uint32_t, Line *> &b) {
+        return a.first < b.first;
+    });
+    uint32_t capacity = max<uint32_t>(MIN_TIMESTAMPS, 2 * order.size());
+    tree.assign(capacity + 1, 0);
+    for (uint32_t i = 0; i < order.size(); i++) {
+        order[i].second->time = i + 1;
+        tree[i + 1] = 1;
+    }
+    // each node adds itself into its parent, building the tree in one pass
+    for (uint32_t i = 1; i <= capacity; i++) {
+        uint32_t parent = i + (i & -i);
+        if (parent <= capacity) {
+            tree[parent] += tree[i];
+        }
+    }
+    now = order.size();
+}
+
+void LocalityAnalyzer::add(uint32_t index, int32_t delta) {
+    for (; index < tree.size(); index += index & -index) {
+        tree[index] += delta;
+    }
+}
+
+uint32_t LocalityAnalyzer::prefix(uint32_t index) {
+    int32_t sum = 0;
+    for (; index > 0; index -= index & -index) {
+        sum += tree[index];
+    }
+    return sum;
+}
+
+// bytes in the largest unit that keeps them whole
+static string formatBytes(uint64_t bytes) {
+    if (bytes >= (1u << 20) && bytes % (1u << 20) == 0) {
+        return to_string(bytes >> 20) + " MB";
+    }
+    if (bytes >= 1024 && bytes % 1024 == 0) {
+        return to_string(bytes >> 10) + " KB";
+    }
+    return to_string(bytes) + " B";
+}
+
+// the distance histogram, the miss ratio of a fully associative lru cache of
+// each power of two size, and the working set per interval
+void LocalityAnalyzer::printStats(ostream &out) {
+    ios::fmtflags flags = out.flags();
+    streamsize precision = out.precision();
+    uint32_t lineSize = 1u << lineBits;
+    vector<uint64_t> sets = workingSets;
+    if (instructions % interval) {
+        sets.push_back(intervalLines); // the last, partial interval
+    }
+
+    out << "locality: " << lineSize << " B lines, " << (fetches ? "fetches, loads and stores" : "loads and stores")
+        << ", " << accesses << " line accesses, " << lines.size() << " distinct lines ("
+        << formatBytes(uint64_t(lines.size()) << lineBits) << ")" << endl;
+    out << "reuse distance: accesses" << endl;
+    out << "  cold: " << coldAccesses << endl;
+    for (size_t bucket = 0; bucket < histogram.size(); bucket++) {
+        uint64_t low = bucket ? 1ull << (bucket - 1) : 0;
+        uint64_t high = bucket ? (1ull << bucket) - 1 : 0;
+        out << "  " << low;
+        if (high != low) {
+            out << "-" << high;
+        }
+        out << ": " << histogram[bucket] << endl;
+    }
+
+    // an access hits a cache of 2^k lines when its bucket is at most k
+    out << "miss ratio curve (fully associative lru):" << endl;
+    uint64_t hits = 0;
+    for (size_t k = 0; k < histogram.size(); k++) {
+        hits += histogram[k];
+        uint64_t cacheLines = 1ull << k;
+        out << "  " << cacheLines << " lines (" << formatBytes(cacheLines << lineBits) << "): " << fixed
+            << setprecision(4) << (accesses ? double(accesses - hits) / accesses : 0.0) << endl;
+    }
+
+    if (!sets.empty()) {
+        uint64_t smallest = *min_element(sets.begin(), sets.end());
+        uint64_t largest = *max_element(sets.begin(), sets.end());
+        uint64_t total = 0;
+        for (uint64_t set : sets) {
+            total += set;
+        }
+        out << "working set: " << sets.size() << " intervals of " << interval << " instructions, lines min "
+            << smallest << " mean " << fixed << setprecision(1) << double(total) / sets.size() << " max " << largest
+            << " (" << formatBytes(largest << lineBits) << ")" << endl;
+    }
+    if (!intervalsPath.empty()) {
+        ofstream file(intervalsPath);
+        file << "interval,first_instruction,lines,bytes\n";
+        for (size_t i = 0; i < sets.size(); i++) {
+            file << i << "," << i * interval << "," << sets[i] << "," << (sets[i] << lineBits) << "\n";
+        }
+        if (!file) {
+            out << "error writing " << intervalsPath << endl;
+        }
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,75 @@
+#ifndef LOCALITYANALYZER_H
+#define LOCALITYANALYZER_H
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// exact lru stack distances of a run's memory accesses at cache line
+// granularity, and the working set of every interval of instructions. the
+// stack distance of an access is the number of distinct other lines touched
+// since the previous access to its line, so a fully associative lru cache of
+// c lines hits exactly the accesses with a distance under c: one histogram
+// gives the miss ratio of every cache size.
+//
+// each line's last access time is marked in a fenwick tree over access
+// timestamps, so the distinct lines since then are a prefix sum, O(log n).
+// when the timestamps fill the tree it is rebuilt with the live marks
+// renumbered in order, which keeps it at most twice the distinct lines
+class LocalityAnalyzer {
+    public:
+        LocalityAnalyzer(uint32_t lineSize, uint64_t interval, bool fetches, const std::string &intervalsPath);
+
+        // spec is "default" or comma separated overrides: line=<bytes>,
+        // interval=<instructions>, fetch to count instruction fetches as
+        // well as loads and stores, and intervals=<path> to write each
+        // interval's working set there. nullptr with a message in error
+        static std::unique_ptr<LocalityAnalyzer> create(const std::string &spec, std::string &error);
+
+        // every instruction is fetched once, so fetch also counts them
+        void fetch(uint32_t pc) {
+            if (fetches) {
+                access(pc, 4);
+            }
+            if (++instructions % interval == 0) {
+                endInterval();
+            }
+        }
+        void load(uint32_t address, uint32_t size) { access(address, size); }
+        void store(uint32_t address, uint32_t size) { access(address, size); }
+
+        void printStats(std::ostream &out);
+    private:
+        struct Line {
+            uint32_t time;     // tree index of the latest access
+            uint64_t interval; // 1 + the last interval the line was touched in
+        };
+
+        void access(uint32_t address, uint32_t size);
+        void touch(uint32_t line);
+        void endInterval();
+        void renumber();
+        void add(uint32_t index, int32_t delta);
+        uint32_t prefix(uint32_t index); // marks at 1..index
+
+        uint32_t lineBits;
+        uint64_t interval;
+        bool fetches;
+        std::string intervalsPath;
+
+        std::unordered_map<uint32_t, Line> lines;
+        std::vector<int32_t> tree; // fenwick tree, 1 based, one mark per line at its latest access
+        uint32_t now;              // last timestamp handed out
+
+        uint64_t instructions;
+        uint64_t accesses;
+        uint64_t coldAccesses;           // first touches, which no cache size hits
+        std::vector<uint64_t> histogram; // [0] distance 0, [b] distances 2^(b-1) to 2^b - 1
+        uint64_t intervalLines;          // distinct lines in the current interval
+        std::vector<uint64_t> workingSets;
+};
+
+#endif // LOCALITYANALYZER_H
@@ -1,34 +1,314 @@
 #include "Memory.h"
 #include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <sys/mman.h>
 using namespace std;
 
-// initialize memory array to all zeros
+// every page reads as zero until it is first written
+static const uint8_t zeroPage[Memory::PAGE_SIZE] = {};
+
+// start with no pages and empty tlbs
 Memory::Memory() {
-    for (int i = 0; i < 131072; i++) {
-        memory[i] = 0;
+    owner = this;
+    shared = false;
+    memset(directory, 0, sizeof(directory));
+    for (uint32_t i = 0; i < TLB_SIZE; i++) {
+        readTLB[i].tag = INVALID_TAG;
+        writeTLB[i].tag = INVALID_TAG;
+    }
+    allocatedPages = 0;
+}
+
+// a view with empty tlbs. the owner's read tlb may hold the zero page, which
+// sharing doesn't allow
+Memory::Memory(Memory &owner) : Memory() {
+    this->owner = &owner;
+    shared = true;
+    lock_guard<mutex> guard(owner.lock);
+    owner.shared = true;
+    for (uint32_t i = 0; i < TLB_SIZE; i++) {
+        owner.readTLB[i].tag = INVALID_TAG;
+    }
+}
+
+// release every allocated page, page table and adopted mapping
+Memory::~Memory() {
+    if (owner != this) {
+        return; // the owner frees the pages
+    }
+    for (uint32_t i = 0; i < (1u << DIRECTORY_BITS); i++) {
+        if (!directory[i]) {
+            continue;
+        }
+        for (uint32_t j = 0; j < (1u << TABLE_BITS); j++) {
+            if (directory[i][j].owned) {
+                delete[] directory[i][j].host;
+            }
+        }
+        delete[] directory[i];
+    }
+    for (const Mapping &mapping : mappings) {
+        munmap(mapping.base, mapping.size);
     }
 }
 
-// read 32-bit word from memory in little endian format
-int32_t Memory::read(uint32_t address) {
+// the last memory sharing these pages is gone
+Memory::ForkedPages::~ForkedPages() {
+    for (uint8_t *page : pages) {
+        delete[] page;
+    }
+    for (const Mapping &mapping : mappings) {
+        munmap(mapping.base, mapping.size);
+    }
+}
+
+// walk the page table for a guest page number, optionally creating its table
+Memory::PageEntry *Memory::findEntry(uint32_t page, bool create) {
+    PageEntry *&table = owner->directory[page >> TABLE_BITS];
+    if (!table) {
+        if (!create) {
+            return nullptr;
+        }
+        table = new PageEntry[1u << TABLE_BITS]();
+    }
+    return &table[page & ((1u << TABLE_BITS) - 1)];
+}
+
+// point any tlb entries for page at a new host page
+void Memory::retargetTLBs(uint32_t page, uint8_t *host) {
+    TLBEntry &readEntry = readTLB[page & (TLB_SIZE - 1)];
+    if (readEntry.tag == page) {
+        readEntry.host = host;
+    }
+    TLBEntry &writeEntry = writeTLB[page & (TLB_SIZE - 1)];
+    if (writeEntry.tag == page) {
+        writeEntry.host = host;
+    }
+}
+
+// allocate a zeroed page, creating its page table if needed
+uint8_t *Memory::allocatePage(uint32_t page) {
+    PageEntry *entry = findEntry(page, true);
+    if (!entry->host) {
+        entry->host = new uint8_t[PAGE_SIZE]();
+        entry->owned = true;
+        allocatedPages++;
+
+        // reads of this page may still be pointing at the zero page
+        retargetTLBs(page, entry->host);
+    }
+    return entry->host;
+}
+
+// give a page shared with a fork a private copy ahead of a write
+uint8_t *Memory::copyPage(uint32_t page, PageEntry *entry) {
+    uint8_t *copy = new uint8_t[PAGE_SIZE];
+    memcpy(copy, entry->host, PAGE_SIZE);
+    entry->host = copy;
+    entry->owned = true;
+    entry->copyOnWrite = false;
+    retargetTLBs(page, copy);
+    return copy;
+}
+
+// translate a guest address, allocating on writes, and refill the tlb
+uint8_t *Memory::hostAddress(uint32_t address, bool forWrite) {
+    uint32_t page = address >> PAGE_BITS;
+    uint8_t *host = shared ? owner->sharedPage(page, forWrite) : localPage(page, forWrite);
+    TLBEntry &tlbEntry = (forWrite ? writeTLB : readTLB)[page & (TLB_SIZE - 1)];
+    tlbEntry.tag = page;
+    tlbEntry.host = host;
+    return host + (address & PAGE_MASK);
+}
+
+// host page for a memory only one hart uses; unwritten pages read as zero
+uint8_t *Memory::localPage(uint32_t page, bool forWrite) {
+    PageEntry *entry = findEntry(page, forWrite);
+    if (!forWrite) {
+        return entry && entry->host ? entry->host : const_cast<uint8_t *>(zeroPage);
+    }
+    uint8_t *host = entry->host ? entry->host : allocatePage(page);
+    if (entry->copyOnWrite) {
+        host = copyPage(page, entry);
+    }
+    if (!entry->dirty) {
+        // later writes hit the tlb, so this is the one chance to see them
+        entry->dirty = true;
+        dirtyPages.push_back(page);
+    }
+    return host;
+}
+
+// host page for a memory shared between harts, allocated on any access.
+// other harts' tlbs are never touched, since they can't hold this page yet.
+// for the same reason a read-only mapped page is copied on its first access
+// rather than its first write, which would leave other harts reading the file
+uint8_t *Memory::sharedPage(uint32_t page, bool forWrite) {
+    lock_guard<mutex> guard(lock);
+    PageEntry *entry = findEntry(page, true);
+    if (!entry->host) {
+        entry->host = new uint8_t[PAGE_SIZE]();
+        entry->owned = true;
+        allocatedPages++;
+    }
+    if (entry->copyOnWrite) {
+        copyPage(page, entry);
+    }
+    if (forWrite && !entry->dirty) {
+        entry->dirty = true;
+        dirtyPages.push_back(page);
+    }
+    return entry->host;
+}
+
+// word read that missed the tlb or crosses a page boundary
+int32_t Memory::readSlow(uint32_t address) {
+    if ((address & PAGE_MASK) <= PAGE_SIZE - 4) {
+        int32_t data;
+        memcpy(&data, hostAddress(address, false), 4);
+        return data;
+    }
     int32_t data = 0;
-    data |= (memory[address] & 0xFF);
-    data |= (memory[address + 1] & 0xFF) << 8;
-    data |= (memory[address + 2] & 0xFF) << 16;
-    data |= (memory[address + 3] & 0xFF) << 24;
-    
+    data |= (readByte(address) & 0xFF);
+    data |= (readByte(address + 1) & 0xFF) << 8;
+    data |= (readByte(address + 2) & 0xFF) << 16;
+    data |= (readByte(address + 3) & 0xFF) << 24;
     return data;
 }
 
-// read single byte from memory for unsigned byte loads
-uint8_t Memory::readByte(uint32_t address) {
-    return memory[address];
+// halfword read that missed the tlb or crosses a page boundary
+uint16_t Memory::readHalfSlow(uint32_t address) {
+    return readByte(address) | readByte(address + 1) << 8;
+}
+
+// word write that missed the tlb or crosses a page boundary
+void Memory::writeSlow(uint32_t address, int32_t data) {
+    if ((address & PAGE_MASK) <= PAGE_SIZE - 4) {
+        memcpy(hostAddress(address, true), &data, 4);
+        return;
+    }
+    for (int i = 0; i < 4; i++) {
+        *hostAddress(address + i, true) = (data >> (8 * i)) & 0xFF;
+    }
+}
+
+// halfword write that missed the tlb or crosses a page boundary
+void Memory::writeHalfSlow(uint32_t address, uint16_t data) {
+    writeByte(address, data & 0xFF);
+    writeByte(address + 1, data >> 8);
+}
+
+// copy a block of bytes into memory a page at a time
+bool Memory::load(uint32_t address, const uint8_t *data, size_t size) {
+    if (size > 0xFFFFFFFFull - address + 1) {
+        return false; // would wrap past the top of the address space
+    }
+    while (size > 0) {
+        size_t chunk = PAGE_SIZE - (address & PAGE_MASK);
+        if (chunk > size) {
+            chunk = size;
+        }
+        memcpy(hostAddress(address, true), data, chunk);
+        address += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+
+// hand back the pages written since the last call and start tracking afresh.
+// the write tlb is flushed so the next write to any page is seen again
+vector<uint32_t> Memory::takeDirtyPages() {
+    vector<uint32_t> pages;
+    pages.swap(dirtyPages);
+    sort(pages.begin(), pages.end());
+    for (uint32_t page : pages) {
+        findEntry(page, false)->dirty = false;
+    }
+    for (uint32_t i = 0; i < TLB_SIZE; i++) {
+        writeTLB[i].tag = INVALID_TAG;
+    }
+    return pages;
+}
+
+// host copy of a page, if it exists
+const uint8_t *Memory::pageData(uint32_t page) {
+    PageEntry *entry = findEntry(page, false);
+    return entry ? entry->host : nullptr;
 }
 
-// write 32-bit word to memory in little endian format
-void Memory::write(uint32_t address, int32_t data) {
-    memory[address] = (data & 0xFF);
-    memory[address + 1] = (data >> 8) & 0xFF;
-    memory[address + 2] = (data >> 16) & 0xFF;
-    memory[address + 3] = (data >> 24) & 0xFF;
-}
\ No newline at end of file
+// every page that has been written or mapped in, for a full checkpoint
+vector<uint32_t> Memory::usedPages() {
+    vector<uint32_t> pages;
+    for (uint32_t i = 0; i < (1u << DIRECTORY_BITS); i++) {
+        if (!directory[i]) {
+            continue;
+        }
+        for (uint32_t j = 0; j < (1u << TABLE_BITS); j++) {
+            if (directory[i][j].host) {
+                pages.push_back(i << TABLE_BITS | j);
+            }
+        }
+    }
+    return pages;
+}
+
+// replace a page's backing with host memory owned by someone else
+void Memory::mapPage(uint32_t page, uint8_t *host, bool readOnly) {
+    PageEntry *entry = findEntry(page, true);
+    if (entry->owned) {
+        delete[] entry->host;
+    } else if (!entry->host) {
+        allocatedPages++;
+    }
+    entry->host = host;
+    entry->owned = false;
+    entry->copyOnWrite = readOnly;
+    retargetTLBs(page, host);
+    if (readOnly) {
+        // the next write must come through localPage to take its copy
+        writeTLB[page & (TLB_SIZE - 1)].tag = INVALID_TAG;
+    }
+}
+
+// keep an mmapped region alive for as long as pages point into it
+void Memory::adoptMapping(void *base, size_t size) {
+    mappings.push_back(Mapping{base, size});
+}
+
+// hand every page this memory owns or has mapped over to a reference counted
+// set shared with the child, mark all of them copy-on-write on both sides,
+// and give the child its own copy of the page tables. the write tlb is
+// flushed so the next write to each page comes through localPage
+void Memory::fork(Memory &child) {
+    shared_ptr<ForkedPages> pages = make_shared<ForkedPages>();
+    for (uint32_t i = 0; i < (1u << DIRECTORY_BITS); i++) {
+        if (!directory[i]) {
+            continue;
+        }
+        for (uint32_t j = 0; j < (1u << TABLE_BITS); j++) {
+            PageEntry &entry = directory[i][j];
+            if (entry.owned) {
+                pages->pages.push_back(entry.host);
+                entry.owned = false;
+            }
+            entry.copyOnWrite = entry.host != nullptr;
+        }
+        child.directory[i] = new PageEntry[1u << TABLE_BITS];
+        memcpy(child.directory[i], directory[i], sizeof(PageEntry) << TABLE_BITS);
+    }
+    pages->mappings.swap(mappings);
+    if (!pages->pages.empty() || !pages->mappings.empty()) {
+        // a parent forked again without writing has nothing new to hand over,
+        // and an empty set would make every later fork copy a longer list
+        forked.push_back(pages);
+    }
+    child.forked = forked;
+    child.allocatedPages = allocatedPages;
+    child.dirtyPages = dirtyPages;
+    for (uint32_t i = 0; i < TLB_SIZE; i++) {
+        writeTLB[i].tag = INVALID_TAG;
+    }
+}
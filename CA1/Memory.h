@@ -2,15 +2,187 @@
 #define MEMORY_H
 
 #include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
 
+// sparse 4 GB guest memory. pages are allocated on the first write and a small
+// software tlb caches guest page to host pointer translations so that most
+// accesses are a tag compare plus one host load or store. untouched pages read
+// as zero. host byte order is assumed to be little endian like the guest.
+// pages written since the last takeDirtyPages() are tracked for incremental
+// checkpoints; the tracking happens on write tlb refills so stores stay fast.
+// several harts share one memory through views: each view has its own tlbs
+// but walks and fills the owner's page table under the owner's lock. shared
+// pages are allocated on first touch, so no tlb ever caches the zero page
+// that another hart's write would make stale. fork() gives a fresh memory
+// the same contents without copying them: both sides share every page
+// copy-on-write, and the first write to a shared page through either side
+// copies just that page
 class Memory {
     public:
+        static const int PAGE_BITS = 12; // 4 KB pages
+        static const uint32_t PAGE_SIZE = 1u << PAGE_BITS;
+        static const uint32_t PAGE_MASK = PAGE_SIZE - 1;
+
         Memory();
+        explicit Memory(Memory &owner); // a view of owner's pages; owner must outlive it
+        ~Memory();
+        Memory(const Memory &) = delete;
+        Memory &operator=(const Memory &) = delete;
         int32_t read(uint32_t address);
         uint8_t readByte(uint32_t address);
+        uint16_t readHalf(uint32_t address);
         void write(uint32_t address, int32_t data);
+        void writeByte(uint32_t address, uint8_t data);
+        void writeHalf(uint32_t address, uint16_t data);
+        int32_t *atomicWord(uint32_t address); // host word for an aligned atomic, allocated and marked dirty
+        bool load(uint32_t address, const uint8_t *data, size_t size); // bulk copy a program image
+        size_t getAllocatedPages() { return allocatedPages; }
+
+        std::vector<uint32_t> takeDirtyPages(); // sorted page numbers written since the last call
+        const uint8_t *pageData(uint32_t page); // nullptr if the page was never written
+        std::vector<uint32_t> usedPages(); // sorted page numbers of every page with data
+        // back a page with memory the caller keeps alive. a read-only page is
+        // copied on its first write, or first access once harts share this
+        // memory, so host is never written through. not for use while harts run
+        void mapPage(uint32_t page, uint8_t *host, bool readOnly = false);
+        void adoptMapping(void *base, size_t size); // munmap this region when memory is destroyed
+        // make child, a fresh memory, a copy-on-write copy of this one. costs
+        // a copy of the page tables in use; neither side may be shared with
+        // harts. forks of forks are fine, and any side may be destroyed first
+        void fork(Memory &child);
     private:
-        uint8_t memory[131072]; // 128 KB memory
+        static const int DIRECTORY_BITS = 10; // two level page table: 1024 x 1024 pages
+        static const int TABLE_BITS = 32 - PAGE_BITS - DIRECTORY_BITS;
+        static const int TLB_BITS = 6; // 64 entries each for reads and writes
+        static const uint32_t TLB_SIZE = 1u << TLB_BITS;
+        static const uint32_t INVALID_TAG = 0xFFFFFFFF; // page numbers only use 20 bits
+
+        struct TLBEntry {
+            uint32_t tag; // guest page number
+            uint8_t *host;
+        };
+
+        struct PageEntry {
+            uint8_t *host;     // nullptr until first written
+            bool owned;        // allocated here rather than mapped in
+            bool dirty;        // written since the last takeDirtyPages()
+            bool copyOnWrite;  // host is shared with a fork, so copy it before writing
+        };
+
+        struct Mapping {
+            void *base;
+            size_t size;
+        };
+
+        // pages and mappings handed over by fork(). every memory that may
+        // still point into them keeps a reference, and the last one frees them
+        struct ForkedPages {
+            std::vector<uint8_t *> pages;
+            std::vector<Mapping> mappings;
+            ~ForkedPages();
+        };
+
+        PageEntry *findEntry(uint32_t page, bool create);
+        uint8_t *allocatePage(uint32_t page);
+        uint8_t *copyPage(uint32_t page, PageEntry *entry);
+        void retargetTLBs(uint32_t page, uint8_t *host);
+        uint8_t *hostAddress(uint32_t address, bool forWrite); // slow path, refills the tlb
+        uint8_t *localPage(uint32_t page, bool forWrite);
+        uint8_t *sharedPage(uint32_t page, bool forWrite); // called on the owner
+        int32_t readSlow(uint32_t address);
+        uint16_t readHalfSlow(uint32_t address);
+        void writeSlow(uint32_t address, int32_t data);
+        void writeHalfSlow(uint32_t address, uint16_t data);
+
+        Memory *owner; // this, unless this is a view
+        bool shared;   // views exist, so page table changes take the owner's lock
+        std::mutex lock;
+        PageEntry *directory[1u << DIRECTORY_BITS]; // only the owner's is used
+        TLBEntry readTLB[TLB_SIZE];
+        TLBEntry writeTLB[TLB_SIZE];
+        size_t allocatedPages;
+        std::vector<uint32_t> dirtyPages;
+        std::vector<Mapping> mappings;
+        std::vector<std::shared_ptr<ForkedPages>> forked;
 };
 
-#endif // MEMORY_H
\ No newline at end of file
+// read 32-bit word from memory in little endian format
+inline int32_t Memory::read(uint32_t address) {
+    uint32_t page = address >> PAGE_BITS;
+    const TLBEntry &entry = readTLB[page & (TLB_SIZE - 1)];
+    if (entry.tag == page && (address & PAGE_MASK) <= PAGE_SIZE - 4) {
+        int32_t data;
+        memcpy(&data, entry.host + (address & PAGE_MASK), 4);
+        return data;
+    }
+    return readSlow(address);
+}
+
+// read single byte from memory for unsigned byte loads
+inline uint8_t Memory::readByte(uint32_t address) {
+    uint32_t page = address >> PAGE_BITS;
+    const TLBEntry &entry = readTLB[page & (TLB_SIZE - 1)];
+    if (entry.tag == page) {
+        return entry.host[address & PAGE_MASK];
+    }
+    return *hostAddress(address, false);
+}
+
+// read 16-bit halfword from memory in little endian format
+inline uint16_t Memory::readHalf(uint32_t address) {
+    uint32_t page = address >> PAGE_BITS;
+    const TLBEntry &entry = readTLB[page & (TLB_SIZE - 1)];
+    if (entry.tag == page && (address & PAGE_MASK) <= PAGE_SIZE - 2) {
+        uint16_t data;
+        memcpy(&data, entry.host + (address & PAGE_MASK), 2);
+        return data;
+    }
+    return readHalfSlow(address);
+}
+
+// write 32-bit word to memory in little endian format
+inline void Memory::write(uint32_t address, int32_t data) {
+    uint32_t page = address >> PAGE_BITS;
+    const TLBEntry &entry = writeTLB[page & (TLB_SIZE - 1)];
+    if (entry.tag == page && (address & PAGE_MASK) <= PAGE_SIZE - 4) {
+        memcpy(entry.host + (address & PAGE_MASK), &data, 4);
+        return;
+    }
+    writeSlow(address, data);
+}
+
+// write single byte to memory
+inline void Memory::writeByte(uint32_t address, uint8_t data) {
+    uint32_t page = address >> PAGE_BITS;
+    const TLBEntry &entry = writeTLB[page & (TLB_SIZE - 1)];
+    if (entry.tag == page) {
+        entry.host[address & PAGE_MASK] = data;
+        return;
+    }
+    *hostAddress(address, true) = data;
+}
+
+// write 16-bit halfword to memory in little endian format
+inline void Memory::writeHalf(uint32_t address, uint16_t data) {
+    uint32_t page = address >> PAGE_BITS;
+    const TLBEntry &entry = writeTLB[page & (TLB_SIZE - 1)];
+    if (entry.tag == page && (address & PAGE_MASK) <= PAGE_SIZE - 2) {
+        memcpy(entry.host + (address & PAGE_MASK), &data, 2);
+        return;
+    }
+    writeHalfSlow(address, data);
+}
+
+// aligned words never cross a page, so the write tlb gives the host word
+inline int32_t *Memory::atomicWord(uint32_t address) {
+    uint32_t page = address >> PAGE_BITS;
+    const TLBEntry &entry = writeTLB[page & (TLB_SIZE - 1)];
+    uint8_t *host = entry.tag == page ? entry.host + (address & PAGE_MASK) : hostAddress(address, true);
+    return reinterpret_cast<int32_t *>(host);
+}
+
+#endif // MEMORY_H
@@ -0,0 +1,89 @@
+#include "MultiHart.h"
+#include <chrono>
+#include <thread>
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+MultiHart::MultiHart(unsigned harts, Engine engine) {
+    for (unsigned i = 0; i < harts; i++) {
+        this->harts.emplace_back(new CPU(memory));
+        simulators.emplace_back(new Simulator(*this->harts.back(), engine));
+    }
+    quantum = 1000;
+    seconds = 0;
+}
+
+bool MultiHart::load(const char *path) {
+    if (!Loader::load(path, memory, program)) {
+        return false;
+    }
+    for (unsigned i = 0; i < harts.size(); i++) {
+        harts[i]->setPC(program.entry);
+        harts[i]->writeRegister(10, i);
+        harts[i]->writeRegister(11, harts.size());
+    }
+    return true;
+}
+
+void MultiHart::run(Schedule schedule) {
+    Clock::time_point start = Clock::now();
+    if (schedule == SCHEDULE_PARALLEL) {
+        runParallel();
+    } else {
+        runRoundRobin();
+    }
+    seconds += chrono::duration<double>(Clock::now() - start).count();
+}
+
+// give each live hart quantum instructions in turn until all have stopped
+void MultiHart::runRoundRobin() {
+    vector<bool> live(harts.size(), true);
+    size_t running = harts.size();
+    while (running) {
+        for (size_t i = 0; i < harts.size(); i++) {
+            if (!live[i]) {
+                continue;
+            }
+            Simulator &simulator = *simulators[i];
+            simulator.setStop(simulator.getRetired() + quantum, Simulator::NO_STOP);
+            simulator.run(program);
+            if (!simulator.stoppedEarly()) {
+                live[i] = false;
+                running--;
+            }
+        }
+    }
+}
+
+// every hart runs to completion on its own thread; guest atomics are host
+// atomics, so harts only synchronize where the guest program does
+void MultiHart::runParallel() {
+    vector<thread> threads;
+    for (size_t i = 0; i < harts.size(); i++) {
+        Simulator *simulator = simulators[i].get();
+        const Program *program = &this->program;
+        simulator->setStop(Simulator::NO_STOP, Simulator::NO_STOP);
+        threads.emplace_back([simulator, program] { simulator->run(*program); });
+    }
+    for (thread &worker : threads) {
+        worker.join();
+    }
+}
+
+// totals, then each hart's own engine statistics
+void MultiHart::printStats(ostream &out) {
+    uint64_t retired = 0;
+    for (unique_ptr<Simulator> &simulator : simulators) {
+        retired += simulator->getRetired();
+    }
+    out << "harts: " << harts.size() << ", " << retired << " instructions in " << seconds << " s";
+    if (seconds > 0) {
+        out << " (" << retired / seconds / 1e6 << " MIPS)";
+    }
+    out << endl;
+    for (size_t i = 0; i < simulators.size(); i++) {
+        out << "hart " << i << ":" << endl;
+        simulators[i]->printStats(out);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef MULTIHART_H
+#define MULTIHART_H
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "CPU.h"
+#include "Loader.h"
+#include "Simulator.h"
+
+// runs one program on several harts that share its memory. every hart starts
+// at the entry point with its hart id in a0 and the hart count in a1, the
+// way boot firmware hands them over. a hart stops like a single cpu does, by
+// running past the program or hitting an invalid instruction
+class MultiHart {
+    public:
+        enum Schedule {
+            SCHEDULE_ROUND_ROBIN, // one host thread, harts take turns of a fixed length
+            SCHEDULE_PARALLEL,    // one host thread per hart
+        };
+
+        MultiHart(unsigned harts, Engine engine);
+        bool load(const char *path);
+        // instructions per turn in round robin runs. the same quantum always
+        // gives the same interleaving, so runs are reproducible
+        void setQuantum(uint64_t instructions) { quantum = instructions ? instructions : 1; }
+        void run(Schedule schedule);
+        unsigned size() { return harts.size(); }
+        CPU &getHart(unsigned hart) { return *harts[hart]; }
+        Memory &getMemory() { return memory; } // the harts' shared pages, e.g. to map files into before run
+        void printStats(std::ostream &out);
+    private:
+        void runRoundRobin();
+        void runParallel();
+
+        Memory memory; // declared first so the harts' views go before it
+        Program program;
+        std::vector<std::unique_ptr<CPU>> harts;
+        std::vector<std::unique_ptr<Simulator>> simulators;
+        uint64_t quantum;
+        double seconds;
+};
+
+#endif // MULTIHART_H
@@ -0,0 +1,327 @@
+#include "PhaseProfiler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <random>
+using namespace std;
+
+// projected vectors closer than about 0.001 are the same phase. without a
+// floor, clusters of identical intervals have no variance and the bic of
+// every extra cluster that isolates one more of them is unbounded
+static const double MIN_VARIANCE = 1e-6;
+
+PhaseProfiler::PhaseProfiler(uint64_t interval, unsigned maxClusters, uint64_t seed, const string &outputPrefix)
+    : interval(interval), maxClusters(maxClusters), seed(seed), outputPrefix(outputPrefix) {
+    blockStart = 0;
+    blockLength = 0;
+    intervalLength = 0;
+}
+
+// a whole number with an optional k or m suffix
+static bool parseCount(const string &text, uint64_t &value) {
+    char *end;
+    value = strtoull(text.c_str(), &end, 10);
+    if (end == text.c_str()) {
+        return false;
+    }
+    if (*end == 'k' || *end == 'K') {
+        value <<= 10;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        value <<= 20;
+        end++;
+    }
+    return *end == '\0';
+}
+
+unique_ptr<PhaseProfiler> PhaseProfiler::create(const string &spec, string &error) {
+    uint64_t interval = 1000000;
+    uint64_t maxClusters = 10;
+    uint64_t seed = 1;
+    string outputPrefix;
+
+    size_t start = 0;
+    while (spec != "default" && start <= spec.size()) {
+        size_t comma = spec.find(',', start);
+        string item = spec.substr(start, comma - start);
+        start = comma == string::npos ? spec.size() + 1 : comma + 1;
+        size_t equals = item.find('=');
+        string key = item.substr(0, equals);
+        string value = equals == string::npos ? "" : item.substr(equals + 1);
+        if (key == "interval" && parseCount(value, interval) && interval > 0) {
+            continue;
+        }
+        if (key == "k" && parseCount(value, maxClusters) && maxClusters > 0 && maxClusters <= 100) {
+            continue;
+        }
+        if (key == "seed" && parseCount(value, seed)) {
+            continue;
+        }
+        if (key == "out" && !value.empty()) {
+            outputPrefix = value;
+            continue;
+        }
+        error = "bad phase option " + item + "; expected interval=<instructions>, k=<1 to 100>, "
+            "seed=<n> or out=<prefix>";
+        return nullptr;
+    }
+    return unique_ptr<PhaseProfiler>(new PhaseProfiler(interval, maxClusters, seed, outputPrefix));
+}
+
+// a block runs up to and including a control transfer. one that straddles
+// an interval boundary is split there, and its second part counts as a
+// block of its own
+void PhaseProfiler::retire(const TraceRecord &record) {
+    if (blockLength == 0) {
+        blockStart = record.pc;
+    }
+    blockLength++;
+    intervalLength++;
+    const bool *signals = record.decoded->signals;
+    if (signals[ControlSignals::Branch] || signals[ControlSignals::Jump] || signals[ControlSignals::Link]) {
+        endBlock();
+    }
+    if (intervalLength == interval) {
+        endInterval();
+    }
+}
+
+void PhaseProfiler::endBlock() {
+    if (blockLength == 0) {
+        return;
+    }
+    auto found = blocks.find(blockStart);
+    if (found == blocks.end()) {
+        found = blocks.emplace(blockStart, blocks.size()).first;
+    }
+    current[found->second] += blockLength;
+    blockLength = 0;
+}
+
+// normalize the interval's vector and project it
+void PhaseProfiler::endInterval() {
+    endBlock();
+    if (intervalLength == 0) {
+        return;
+    }
+    vector<pair<uint32_t, uint64_t>> counts(current.begin(), current.end());
+    sort(counts.begin(), counts.end());
+    Point point(DIMENSIONS, 0.0);
+    for (const pair<uint32_t, uint64_t> &count : counts) {
+        double share = double(count.second) / intervalLength;
+        for (int dimension = 0; dimension < DIMENSIONS; dimension++) {
+            point[dimension] += share * projection(count.first, dimension);
+        }
+    }
+    if (!outputPrefix.empty()) {
+        vectors.push_back(counts);
+    }
+    points.push_back(point);
+    lengths.push_back(intervalLength);
+    current.clear();
+    intervalLength = 0;
+}
+
+// entry of the random projection matrix, uniform in [-1, 1] and the same for
+// a block every time it is asked for
+double PhaseProfiler::projection(uint32_t block, int dimension) {
+    uint64_t x = seed ^ (uint64_t(block) << 8 | dimension);
+    // splitmix64 finalizer
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return double(x >> 11) / double(1ull << 52) - 1.0;
+}
+
+static double squaredDistance(const vector<double> &a, const vector<double> &b) {
+    double sum = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        sum += (a[i] - b[i]) * (a[i] - b[i]);
+    }
+    return sum;
+}
+
+// best of TRIES k-means runs, each seeded with k-means++
+PhaseProfiler::Clustering PhaseProfiler::cluster(unsigned clusters) {
+    Clustering best;
+    best.distortion = numeric_limits<double>::infinity();
+    size_t count = points.size();
+    for (int attempt = 0; attempt < TRIES; attempt++) {
+        mt19937_64 random(seed * 1000003 + clusters * TRIES + attempt);
+        Clustering result;
+        result.clusters = clusters;
+        result.centres.push_back(points[random() % count]);
+        vector<double> nearest(count);
+        while (result.centres.size() < clusters) {
+            double total = 0;
+            for (size_t i = 0; i < count; i++) {
+                nearest[i] = numeric_limits<double>::infinity();
+                for (const Point &centre : result.centres) {
+                    nearest[i] = min(nearest[i], squaredDistance(points[i], centre));
+                }
+                total += nearest[i];
+            }
+            double pick = uniform_real_distribution<double>(0, total)(random);
+            size_t chosen = 0;
+            while (chosen + 1 < count && (pick -= nearest[chosen]) > 0) {
+                chosen++;
+            }
+            result.centres.push_back(points[chosen]);
+        }
+
+        result.assignment.assign(count, 0);
+        for (int iteration = 0; iteration < MAX_ITERATIONS; iteration++) {
+            bool changed = iteration == 0;
+            result.distortion = 0;
+            for (size_t i = 0; i < count; i++) {
+                double closest = numeric_limits<double>::infinity();
+                unsigned which = 0;
+                for (unsigned c = 0; c < clusters; c++) {
+                    double distance = squaredDistance(points[i], result.centres[c]);
+                    if (distance < closest) {
+                        closest = distance;
+                        which = c;
+                    }
+                }
+                changed |= which != result.assignment[i];
+                result.assignment[i] = which;
+                result.distortion += closest;
+            }
+            if (!changed) {
+                break;
+            }
+            vector<Point> sums(clusters, Point(DIMENSIONS, 0.0));
+            vector<size_t> members(clusters, 0);
+            for (size_t i = 0; i < count; i++) {
+                for (int d = 0; d < DIMENSIONS; d++) {
+                    sums[result.assignment[i]][d] += points[i][d];
+                }
+                members[result.assignment[i]]++;
+            }
+            for (unsigned c = 0; c < clusters; c++) {
+                for (int d = 0; d < DIMENSIONS && members[c]; d++) {
+                    result.centres[c][d] = sums[c][d] / members[c]; // empty clusters keep their centre
+                }
+            }
+        }
+        if (result.distortion < best.distortion) {
+            best = result;
+        }
+    }
+    best.bic = bic(best);
+    return best;
+}
+
+// the x-means bic of a clustering under identical spherical gaussians
+double PhaseProfiler::bic(const Clustering &clustering) {
+    double r = points.size();
+    double k = clustering.clusters;
+    double m = DIMENSIONS;
+    double variance = r > k ? clustering.distortion / (m * (r - k)) : 0;
+    variance = max(variance, MIN_VARIANCE);
+    vector<double> members(clustering.clusters, 0);
+    for (unsigned which : clustering.assignment) {
+        members[which]++;
+    }
+    double likelihood = 0;
+    for (double ri : members) {
+        if (ri > 0) {
+            likelihood += -ri / 2 * log(2 * M_PI) - ri * m / 2 * log(variance) - (ri - k) / 2
+                + ri * log(ri) - ri * log(r);
+        }
+    }
+    double parameters = (k - 1) + m * k + 1;
+    return likelihood - parameters / 2 * log(r);
+}
+
+bool PhaseProfiler::finish(ostream &out) {
+    // the last, partial interval counts if it is at least half an interval,
+    // or all there is
+    endBlock();
+    if (intervalLength * 2 >= interval || points.empty()) {
+        endInterval();
+    }
+    if (points.empty()) {
+        out << "phases: no instructions retired" << endl;
+        return true;
+    }
+
+    // the smallest cluster count scoring within 90% of the best bic
+    vector<Clustering> tried;
+    for (unsigned k = 1; k <= maxClusters && k <= points.size(); k++) {
+        tried.push_back(cluster(k));
+    }
+    double lowest = tried[0].bic, highest = tried[0].bic;
+    for (const Clustering &clustering : tried) {
+        lowest = min(lowest, clustering.bic);
+        highest = max(highest, clustering.bic);
+    }
+    const Clustering *chosen = &tried.back();
+    for (const Clustering &clustering : tried) {
+        if (clustering.bic >= lowest + 0.9 * (highest - lowest)) {
+            chosen = &clustering;
+            break;
+        }
+    }
+
+    // each cluster's point is its interval closest to the centre
+    uint64_t total = 0;
+    for (uint64_t length : lengths) {
+        total += length;
+    }
+    vector<size_t> representative(chosen->clusters, points.size());
+    vector<double> closest(chosen->clusters, numeric_limits<double>::infinity());
+    vector<uint64_t> covered(chosen->clusters, 0);
+    for (size_t i = 0; i < points.size(); i++) {
+        unsigned which = chosen->assignment[i];
+        double distance = squaredDistance(points[i], chosen->centres[which]);
+        if (distance < closest[which]) {
+            closest[which] = distance;
+            representative[which] = i;
+        }
+        covered[which] += lengths[i];
+    }
+
+    ios::fmtflags flags = out.flags();
+    streamsize precision = out.precision();
+    out << "phases: " << points.size() << " intervals of " << interval << " instructions, " << blocks.size()
+        << " basic blocks, k " << chosen->clusters << " (tried 1-" << tried.size() << ")" << endl;
+    for (unsigned c = 0; c < chosen->clusters; c++) {
+        if (representative[c] == points.size()) {
+            continue;
+        }
+        out << "simpoint " << c << ": interval " << representative[c] << " from instruction "
+            << representative[c] * interval << ", weight " << fixed << setprecision(4)
+            << double(covered[c]) / total << endl;
+    }
+    out.flags(flags);
+    out.precision(precision);
+
+    if (outputPrefix.empty()) {
+        return true;
+    }
+    ofstream bb(outputPrefix + ".bb");
+    for (const vector<pair<uint32_t, uint64_t>> &counts : vectors) {
+        bb << "T";
+        for (const pair<uint32_t, uint64_t> &count : counts) {
+            bb << ":" << count.first + 1 << ":" << count.second << " "; // simpoint numbers blocks from 1
+        }
+        bb << "\n";
+    }
+    ofstream simpoints(outputPrefix + ".simpoints");
+    ofstream weights(outputPrefix + ".weights");
+    for (unsigned c = 0; c < chosen->clusters; c++) {
+        if (representative[c] != points.size()) {
+            simpoints << representative[c] << " " << c << "\n";
+            weights << double(covered[c]) / total << " " << c << "\n";
+        }
+    }
+    bb.close();
+    simpoints.close();
+    weights.close();
+    return bb && simpoints && weights;
+}
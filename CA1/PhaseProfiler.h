@@ -0,0 +1,72 @@
+#ifndef PHASEPROFILER_H
+#define PHASEPROFILER_H
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "TraceSink.h"
+
+// simpoint style phase analysis. every interval of instructions gets a
+// basic block vector, how many instructions ran in each block, and the
+// vectors are normalized, randomly projected down to a few dimensions and
+// clustered with k-means. the number of clusters is the smallest whose bic
+// score comes within 90% of the best one tried. the interval nearest each
+// cluster's centre is a simulation point, weighted by the share of the run's
+// instructions its cluster covers, so timing just those intervals in detail
+// and weighting the results estimates the whole run
+class PhaseProfiler {
+    public:
+        PhaseProfiler(uint64_t interval, unsigned maxClusters, uint64_t seed, const std::string &outputPrefix);
+
+        // spec is "default" or comma separated overrides: interval=<instructions>,
+        // k=<most clusters to try>, seed=<n> and out=<prefix> to write
+        // prefix.bb, prefix.simpoints and prefix.weights in simpoint's
+        // formats. nullptr with a message in error for a bad spec
+        static std::unique_ptr<PhaseProfiler> create(const std::string &spec, std::string &error);
+
+        void retire(const TraceRecord &record);
+        // cluster the intervals and report the simulation points; false if
+        // an output file couldn't be written
+        bool finish(std::ostream &out);
+    private:
+        static const int DIMENSIONS = 15; // as in simpoint
+        static const int TRIES = 5;       // k-means restarts per cluster count
+        static const int MAX_ITERATIONS = 100;
+
+        typedef std::vector<double> Point;
+
+        struct Clustering {
+            unsigned clusters;
+            std::vector<unsigned> assignment; // cluster of each interval
+            std::vector<Point> centres;
+            double distortion;                // sum of squared distances to the centres
+            double bic;
+        };
+
+        void endBlock();
+        void endInterval();
+        double projection(uint32_t block, int dimension);
+        Clustering cluster(unsigned clusters);
+        double bic(const Clustering &clustering);
+
+        uint64_t interval;
+        unsigned maxClusters;
+        uint64_t seed;
+        std::string outputPrefix;
+
+        std::unordered_map<uint32_t, uint32_t> blocks; // first pc to block id
+        uint32_t blockStart;
+        uint64_t blockLength;
+        std::unordered_map<uint32_t, uint64_t> current; // block id to instructions this interval
+        uint64_t intervalLength;
+
+        std::vector<std::vector<std::pair<uint32_t, uint64_t>>> vectors; // per interval, for prefix.bb
+        std::vector<uint64_t> lengths;                                   // instructions per interval
+        std::vector<Point> points;                                       // projected vectors
+};
+
+#endif // PHASEPROFILER_H
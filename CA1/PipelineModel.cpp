@@ -0,0 +1,240 @@
+#include "PipelineModel.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+using namespace std;
+
+static const uint32_t DEFAULT_BTB_ENTRIES = 512;
+static const uint32_t EMPTY_BTB_TAG = 1; // instructions are 4 byte aligned, so no pc matches it
+
+PipelineModel::PipelineModel(unique_ptr<BranchPredictor> predictor, uint32_t btbEntries, bool forwarding)
+    : predictor(move(predictor)), forwarding(forwarding) {
+    btbMask = btbEntries ? btbEntries - 1 : 0;
+    btbTags.assign(btbEntries, EMPTY_BTB_TAG);
+    btbTargets.assign(btbEntries, 0);
+    caches = nullptr;
+    for (int side = 0; side < CacheHierarchy::NUM_SIDES; side++) {
+        seenRequests[side] = seenCycles[side] = 0;
+    }
+    // the first instruction is fetched in cycle 0
+    for (int stage = 0; stage < NUM_STAGES; stage++) {
+        last[stage] = 0;
+        busy[stage] = 0;
+    }
+    redirect = 0;
+    for (int reg = 0; reg < 32; reg++) {
+        ready[reg] = 0;
+        fromLoad[reg] = false;
+    }
+    instructions = 0;
+    for (int stall = 0; stall < NUM_STALLS; stall++) {
+        stalls[stall] = 0;
+    }
+    branches = mispredicts = jumps = btbMisses = 0;
+}
+
+unique_ptr<PipelineModel> PipelineModel::create(const string &spec, string &error) {
+    size_t comma = spec.find(',');
+    string predictorSpec = spec.substr(0, comma);
+    unique_ptr<BranchPredictor> predictor = BranchPredictor::create(predictorSpec);
+    if (!predictor) {
+        error = "unknown branch predictor " + predictorSpec;
+        return nullptr;
+    }
+    uint32_t btbEntries = DEFAULT_BTB_ENTRIES;
+    bool forwarding = true;
+    while (comma != string::npos) {
+        size_t start = comma + 1;
+        comma = spec.find(',', start);
+        string item = spec.substr(start, comma - start);
+        if (item == "noforward") {
+            forwarding = false;
+        } else if (item.compare(0, 4, "btb=") == 0) {
+            char *end;
+            unsigned long entries = strtoul(item.c_str() + 4, &end, 10);
+            if (end == item.c_str() + 4 || *end != '\0' || entries > (1u << 20) || (entries & (entries - 1))) {
+                error = "btb entries must be a power of two up to 1m or 0 in " + item;
+                return nullptr;
+            }
+            btbEntries = entries;
+        } else {
+            error = "unknown pipeline option " + item;
+            return nullptr;
+        }
+    }
+    return unique_ptr<PipelineModel>(new PipelineModel(move(predictor), btbEntries, forwarding));
+}
+
+void PipelineModel::setCaches(CacheHierarchy *caches) {
+    this->caches = caches;
+    if (caches) {
+        for (int side = 0; side < CacheHierarchy::NUM_SIDES; side++) {
+            seenRequests[side] = caches->getRequests(CacheHierarchy::Side(side));
+            seenCycles[side] = caches->getCycles(CacheHierarchy::Side(side));
+        }
+    }
+}
+
+// cycles the accesses since the last call took beyond l1 hits
+uint64_t PipelineModel::missCycles(CacheHierarchy::Side side, uint64_t &requests, uint64_t &cycles) {
+    uint64_t newRequests = caches->getRequests(side) - requests;
+    uint64_t newCycles = caches->getCycles(side) - cycles;
+    requests += newRequests;
+    cycles += newCycles;
+    uint64_t hits = newRequests * caches->getHitLatency(side);
+    return newCycles > hits ? newCycles - hits : 0;
+}
+
+void PipelineModel::schedule(uint64_t fetchAt, uint64_t fetchCycles, uint64_t operandsAt, uint64_t memoryCycles,
+    uint64_t (&times)[NUM_STAGES]) {
+    times[IF] = max(last[ID], fetchAt);
+    times[ID] = max(times[IF] + fetchCycles, last[EX]);
+    times[EX] = max(max(times[ID] + 1, last[MEM]), operandsAt);
+    times[MEM] = max(times[EX] + 1, last[WB]);
+    times[WB] = times[MEM] + memoryCycles;
+}
+
+void PipelineModel::retire(const TraceRecord &record) {
+    const DecodedInstruction &decoded = *record.decoded;
+    const InstructionParts &parts = decoded.parts;
+    const bool *signals = decoded.signals;
+
+    uint64_t fetchCycles = 1;
+    uint64_t memoryCycles = 1;
+    if (caches) {
+        fetchCycles += missCycles(CacheHierarchy::INSTRUCTION, seenRequests[CacheHierarchy::INSTRUCTION],
+            seenCycles[CacheHierarchy::INSTRUCTION]);
+        memoryCycles += missCycles(CacheHierarchy::DATA, seenRequests[CacheHierarchy::DATA],
+            seenCycles[CacheHierarchy::DATA]);
+    }
+
+    // which registers the instruction reads
+    bool readsRs1 = true;
+    bool readsRs2 = !signals[ControlSignals::AluSrc] || signals[ControlSignals::MemWrite];
+    switch (decoded.id) {
+        case INST_LUI: case INST_AUIPC: case INST_JAL: case INST_FENCE: case INST_SYSTEM:
+            readsRs1 = readsRs2 = false;
+            break;
+        case INST_LR_W:
+            readsRs2 = false;
+            break;
+        default:
+            break;
+    }
+    uint64_t operandsAt = 0;
+    bool loadUse = false;
+    if (readsRs1 && parts.rs1 != 0) {
+        operandsAt = ready[parts.rs1];
+        loadUse = fromLoad[parts.rs1];
+    }
+    if (readsRs2 && parts.rs2 != 0 && ready[parts.rs2] >= operandsAt) {
+        loadUse = ready[parts.rs2] > operandsAt ? fromLoad[parts.rs2] : loadUse || fromLoad[parts.rs2];
+        operandsAt = ready[parts.rs2];
+    }
+
+    // add the hazards one at a time, charging each with the writeback it delays
+    uint64_t times[NUM_STAGES];
+    schedule(0, 1, 0, 1, times);
+    uint64_t writeback = times[WB];
+    schedule(redirect, 1, 0, 1, times);
+    stalls[STALL_CONTROL] += times[WB] - writeback;
+    writeback = times[WB];
+    schedule(redirect, fetchCycles, 0, 1, times);
+    stalls[STALL_FETCH] += times[WB] - writeback;
+    writeback = times[WB];
+    schedule(redirect, fetchCycles, operandsAt, 1, times);
+    stalls[forwarding && loadUse ? STALL_LOAD_USE : STALL_DATA] += times[WB] - writeback;
+    writeback = times[WB];
+    schedule(redirect, fetchCycles, operandsAt, memoryCycles, times);
+    stalls[STALL_MEMORY] += times[WB] - writeback;
+
+    for (int stage = IF; stage < WB; stage++) {
+        busy[stage] += times[stage + 1] - times[stage];
+    }
+    busy[WB]++;
+
+    if (signals[ControlSignals::RegWrite] && parts.rd != 0) {
+        bool load = signals[ControlSignals::MemRead];
+        if (!forwarding) {
+            ready[parts.rd] = times[WB] + 1;
+        } else {
+            ready[parts.rd] = load ? times[WB] : times[EX] + 1;
+        }
+        fromLoad[parts.rd] = load;
+    }
+    redirect = resolve(record, times);
+    for (int stage = 0; stage < NUM_STAGES; stage++) {
+        last[stage] = times[stage];
+    }
+    instructions++;
+}
+
+uint64_t PipelineModel::resolve(const TraceRecord &record, const uint64_t (&times)[NUM_STAGES]) {
+    const DecodedInstruction &decoded = *record.decoded;
+    const bool *signals = decoded.signals;
+    bool branch = signals[ControlSignals::Branch];
+    bool jal = signals[ControlSignals::Jump];
+    bool jalr = signals[ControlSignals::Link];
+    if (!branch && !jal && !jalr) {
+        return 0;
+    }
+
+    uint32_t slot = (record.pc >> 2) & btbMask;
+    bool hit = !btbTags.empty() && btbTags[slot] == record.pc;
+    if (record.taken && !btbTags.empty()) {
+        btbTags[slot] = record.pc;
+        btbTargets[slot] = record.nextPC;
+    }
+
+    uint64_t fetchAt = 0;
+    if (branch) {
+        branches++;
+        bool predicted = predictor->predict(record.pc, record.pc + decoded.parts.immediate);
+        predictor->update(record.pc, record.taken);
+        if (predicted != record.taken) {
+            mispredicts++;
+            fetchAt = times[EX] + 1;
+        } else if (record.taken && !hit) {
+            btbMisses++;
+            fetchAt = times[ID] + 1;
+        }
+    } else {
+        jumps++;
+        if (jal && !hit) {
+            btbMisses++;
+            fetchAt = times[ID] + 1;
+        } else if (jalr && !(hit && btbTargets[slot] == record.nextPC)) {
+            btbMisses++;
+            fetchAt = times[EX] + 1;
+        }
+    }
+    return fetchAt;
+}
+
+// cpi, where the lost cycles went and how busy each stage was
+void PipelineModel::printStats(ostream &out) {
+    static const char *const STAGE_NAMES[] = {"if", "id", "ex", "mem", "wb"};
+    ios::fmtflags flags = out.flags();
+    streamsize precision = out.precision();
+    uint64_t cycles = instructions ? last[WB] + 1 : 0;
+    out << "pipeline: 5 stages, " << predictor->getName() << " predictor, " << btbTags.size() << " entry btb, "
+        << (forwarding ? "forwarding" : "no forwarding") << endl;
+    out << "cycles: " << cycles << ", " << instructions << " instructions, cpi " << fixed << setprecision(3)
+        << (instructions ? double(cycles) / instructions : 0.0) << endl;
+    out << "stalls: " << stalls[STALL_CONTROL] << " control, " << stalls[STALL_FETCH] << " fetch, "
+        << stalls[STALL_DATA] << " data, " << stalls[STALL_LOAD_USE] << " load-use, "
+        << stalls[STALL_MEMORY] << " memory" << endl;
+    out << "branches: " << branches << " conditional, " << mispredicts << " mispredicted";
+    if (branches) {
+        out << " (" << setprecision(2) << 100.0 * mispredicts / branches << "%)";
+    }
+    out << ", " << jumps << " jumps, " << btbMisses << " btb misses" << endl;
+    out << "occupancy:";
+    for (int stage = 0; stage < NUM_STAGES; stage++) {
+        out << (stage ? ", " : " ") << STAGE_NAMES[stage] << " " << setprecision(1)
+            << (cycles ? 100.0 * busy[stage] / cycles : 0.0) << "%";
+    }
+    out << endl;
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,93 @@
+#ifndef PIPELINEMODEL_H
+#define PIPELINEMODEL_H
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "BranchPredictor.h"
+#include "CacheModel.h"
+#include "TraceSink.h"
+
+// cycle timing of a classic in-order IF/ID/EX/MEM/WB pipeline, driven by
+// the instructions the functional datapath retires. each stage holds one
+// instruction, so an instruction enters a stage once the one ahead of it has
+// left, and the cycle it enters every stage follows from that and the
+// hazards:
+//
+// - data: an operand is ready for EX the cycle after the producer's EX, or
+//   after its MEM for a load, with forwarding; without it, the cycle after
+//   the producer's WB, since ID reads what WB writes in the same cycle
+// - control: fetch looks the pc up in a btb and asks the predictor about
+//   conditional branches. a taken branch or jal that misses the btb fetches
+//   its target after ID, and a mispredicted branch or jalr after EX
+// - memory: with a cache model attached, IF and MEM stay busy for whatever
+//   an access cost beyond an l1 hit
+//
+// lost cycles are charged to the hazard that delayed each instruction's
+// writeback, so the stall counts add up to cycles minus the ideal of one
+// instruction per cycle after the pipeline fills
+class PipelineModel {
+    public:
+        enum Stage {
+            IF,
+            ID,
+            EX,
+            MEM,
+            WB,
+            NUM_STAGES,
+        };
+
+        PipelineModel(std::unique_ptr<BranchPredictor> predictor, uint32_t btbEntries, bool forwarding);
+
+        // spec is the predictor, as for BranchPredictor::create, followed by
+        // optional ",btb=<entries>" (a power of two, default 512, 0 for none)
+        // and ",noforward". nullptr with a message in error for a bad spec
+        static std::unique_ptr<PipelineModel> create(const std::string &spec, std::string &error);
+
+        // charge cache misses to IF and MEM; nullptr to treat every access as an l1 hit
+        void setCaches(CacheHierarchy *caches);
+        void retire(const TraceRecord &record);
+        void printStats(std::ostream &out);
+    private:
+        enum Stall {
+            STALL_CONTROL,  // waiting on a redirected fetch
+            STALL_FETCH,    // instruction cache misses
+            STALL_DATA,     // operands not yet written back or forwarded
+            STALL_LOAD_USE, // an operand forwarded from a load's MEM
+            STALL_MEMORY,   // data cache misses
+            NUM_STALLS,
+        };
+
+        // the cycle each stage is entered, given the earliest fetch, the
+        // cycles IF and MEM take and the earliest EX the operands allow
+        void schedule(uint64_t fetchAt, uint64_t fetchCycles, uint64_t operandsAt, uint64_t memoryCycles,
+            uint64_t (&times)[NUM_STAGES]);
+        // what fetch would have done for a control transfer, and the cycle
+        // the right path can be fetched from if it was wrong
+        uint64_t resolve(const TraceRecord &record, const uint64_t (&times)[NUM_STAGES]);
+        uint64_t missCycles(CacheHierarchy::Side side, uint64_t &requests, uint64_t &cycles);
+
+        std::unique_ptr<BranchPredictor> predictor;
+        bool forwarding;
+        uint32_t btbMask;
+        std::vector<uint32_t> btbTags;    // pc of the control transfer, or 1 when empty
+        std::vector<uint32_t> btbTargets;
+        CacheHierarchy *caches;
+        uint64_t seenRequests[CacheHierarchy::NUM_SIDES];
+        uint64_t seenCycles[CacheHierarchy::NUM_SIDES];
+
+        uint64_t last[NUM_STAGES]; // when the previous instruction entered each stage
+        uint64_t redirect;         // earliest fetch of the next instruction
+        uint64_t ready[32];        // earliest EX of an instruction reading each register
+        bool fromLoad[32];         // the register's last writer was a load
+
+        uint64_t instructions;
+        uint64_t stalls[NUM_STALLS];
+        uint64_t busy[NUM_STAGES]; // cycles each stage held an instruction
+        uint64_t branches, mispredicts;
+        uint64_t jumps, btbMisses;
+};
+
+#endif // PIPELINEMODEL_H
@@ -0,0 +1,150 @@
+#include "Profiler.h"
+#include "InstructionTable.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+using namespace std;
+
+static const char *const ALU_OPERATION_NAMES[ALU_INVALID + 1] = {
+    "add", "sub", "and", "or", "xor", "sll", "srl", "sra", "slt", "sltu", "copy_imm", "invalid",
+};
+
+Profiler::Profiler() {
+    instructions = 0;
+    memset(opcodes, 0, sizeof(opcodes));
+    current = 0;
+    pending = TRANSFER_NONE;
+    memset(phaseNanos, 0, sizeof(phaseNanos));
+    memset(phaseTimed, 0, sizeof(phaseTimed));
+    runSeconds = 0;
+}
+
+// apply the pending call or return now that pc is the instruction after it
+void Profiler::enterFunction(uint32_t pc) {
+    if (nodes.empty()) {
+        nodes.push_back(CallNode{pc, 0, 0, {}});
+        return;
+    }
+    if ((pending == TRANSFER_RETURN || pending == TRANSFER_RETURN_CALL) && current != 0) {
+        current = nodes[current].parent; // a return from the outermost function is ignored
+    }
+    if (pending == TRANSFER_CALL || pending == TRANSFER_RETURN_CALL) {
+        auto child = nodes[current].children.find(pc);
+        if (child != nodes[current].children.end()) {
+            current = child->second;
+        } else {
+            uint32_t node = nodes.size();
+            nodes[current].children[pc] = node;
+            nodes.push_back(CallNode{pc, current, 0, {}});
+            current = node;
+        }
+    }
+    pending = TRANSFER_NONE;
+}
+
+// count with its share of the total
+static void printCount(ostream &out, const char *name, uint64_t count, uint64_t total) {
+    out << "  " << left << setw(10) << name << right << setw(14) << count
+        << "  " << fixed << setprecision(2) << setw(6) << (total ? 100.0 * count / total : 0.0) << "%" << endl;
+}
+
+// instruction mix, host timing and the hottest pcs
+void Profiler::printReport(ostream &out, size_t hotPCs) {
+    ios::fmtflags flags = out.flags();
+    streamsize precision = out.precision();
+
+    out << "profile: " << instructions << " instructions in " << fixed << setprecision(3) << runSeconds << " s";
+    if (runSeconds > 0) {
+        out << " (" << setprecision(2) << instructions / runSeconds / 1e6 << " MIPS)";
+    }
+    out << endl;
+    if (phaseTimed[PHASE_DECODE] || phaseTimed[PHASE_EXECUTE]) {
+        // only the stepping engines separate the phases, and only the
+        // reference engine fetches apart from decoding
+        static const char *const names[NUM_PHASES] = {"fetch", "decode", "execute"};
+        out << "host time, sampled 1 in " << PHASE_SAMPLE_INTERVAL << " instructions:";
+        const char *separator = " ";
+        for (int phase = 0; phase < NUM_PHASES; phase++) {
+            if (phaseTimed[phase]) {
+                out << separator << names[phase] << " " << setprecision(3) << phaseNanos[phase] / 1e9 << " s";
+                separator = ", ";
+            }
+        }
+        out << endl;
+    }
+
+    // instructions, most frequent first
+    vector<pair<uint64_t, int>> byCount;
+    uint64_t aluOperations[ALU_INVALID + 1] = {};
+    for (const InstructionSpec &spec : RV32I) {
+        if (opcodes[spec.id]) {
+            byCount.push_back({opcodes[spec.id], spec.id});
+            aluOperations[spec.aluOperation] += opcodes[spec.id];
+        }
+    }
+    for (const AtomicSpec &spec : RV32A) {
+        if (opcodes[spec.id]) {
+            // the alu adds the zero offset to rs1 for the address
+            byCount.push_back({opcodes[spec.id], spec.id});
+            aluOperations[ALU_ADD] += opcodes[spec.id];
+        }
+    }
+    sort(byCount.rbegin(), byCount.rend());
+    out << "instructions:" << endl;
+    for (const auto &entry : byCount) {
+        printCount(out, instructionName(static_cast<InstructionId>(entry.second)), entry.first, instructions);
+    }
+
+    // alu operations follow from the instruction mix
+    byCount.clear();
+    for (int operation = 0; operation <= ALU_INVALID; operation++) {
+        if (aluOperations[operation]) {
+            byCount.push_back({aluOperations[operation], operation});
+        }
+    }
+    sort(byCount.rbegin(), byCount.rend());
+    out << "alu operations:" << endl;
+    for (const auto &entry : byCount) {
+        printCount(out, ALU_OPERATION_NAMES[entry.second], entry.first, instructions);
+    }
+
+    vector<pair<uint64_t, uint32_t>> hot;
+    hot.reserve(pcs.size());
+    for (const auto &entry : pcs) {
+        hot.push_back({entry.second.count, entry.first});
+    }
+    size_t shown = min(hotPCs, hot.size());
+    partial_sort(hot.begin(), hot.begin() + shown, hot.end(), greater<pair<uint64_t, uint32_t>>());
+    out << "hot pcs (" << shown << " of " << hot.size() << "):" << endl;
+    for (size_t i = 0; i < shown; i++) {
+        out << "  0x" << hex << setw(8) << setfill('0') << hot[i].second << dec << setfill(' ') << "  ";
+        printCount(out, instructionName(pcs[hot[i].second].id), hot[i].first, instructions);
+    }
+
+    out.flags(flags);
+    out.precision(precision);
+}
+
+// semicolon separated function addresses from the outermost call down
+void Profiler::writeStack(ostream &out, uint32_t node) {
+    if (node != 0) {
+        writeStack(out, nodes[node].parent);
+        out << ';';
+    }
+    out << "0x" << hex << setw(8) << setfill('0') << nodes[node].function << dec;
+}
+
+bool Profiler::writeFoldedStacks(const string &path) {
+    ofstream out(path);
+    if (!out) {
+        return false;
+    }
+    for (uint32_t node = 0; node < nodes.size(); node++) {
+        if (nodes[node].instructions) {
+            writeStack(out, node);
+            out << ' ' << nodes[node].instructions << '\n';
+        }
+    }
+    return static_cast<bool>(out);
+}
@@ -0,0 +1,105 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Controller.h"
+
+// execution profile of a guest program: how often each instruction and alu
+// operation ran, where the hot pcs are, and a call graph rebuilt from the
+// standard link register conventions. engines only call record() from their
+// profiled template instantiations, so unprofiled runs pay nothing
+class Profiler {
+    public:
+        enum Phase {
+            PHASE_FETCH,
+            PHASE_DECODE,
+            PHASE_EXECUTE,
+            NUM_PHASES,
+        };
+
+        // the stepping engines time the phases of one instruction in this many
+        // and scale the times up, so the clock reads stay off the common path
+        static const uint64_t PHASE_SAMPLE_INTERVAL = 1024;
+
+        Profiler();
+        // one retired instruction, called before it executes
+        void record(uint32_t pc, InstructionId id, uint32_t rd, uint32_t rs1);
+        void addPhaseTime(Phase phase, uint64_t nanoseconds) {
+            phaseNanos[phase] += nanoseconds;
+            phaseTimed[phase] = true;
+        }
+        void addRunTime(double seconds) { runSeconds += seconds; }
+        uint64_t getInstructions() { return instructions; }
+
+        void printReport(std::ostream &out, size_t hotPCs = 20);
+        // one line per call stack: "0x00010074;0x000100b0 1234", flame graph input
+        bool writeFoldedStacks(const std::string &path);
+    private:
+        // one distinct call stack; the function is the first pc executed after the call
+        struct CallNode {
+            uint32_t function;
+            uint32_t parent;
+            uint64_t instructions;
+            std::unordered_map<uint32_t, uint32_t> children; // function to node index
+        };
+
+        struct PCStats {
+            uint64_t count;
+            InstructionId id;
+        };
+
+        enum Transfer {
+            TRANSFER_NONE,
+            TRANSFER_CALL,
+            TRANSFER_RETURN,
+            TRANSFER_RETURN_CALL, // jalr between two different link registers
+        };
+
+        static bool isLink(uint32_t reg) { return reg == 1 || reg == 5; } // ra and t0
+        void enterFunction(uint32_t pc);
+        void writeStack(std::ostream &out, uint32_t node);
+
+        uint64_t instructions;
+        uint64_t opcodes[INST_COUNT];
+        std::unordered_map<uint32_t, PCStats> pcs;
+        std::vector<CallNode> nodes; // node 0 is the function the run started in
+        uint32_t current;
+        Transfer pending; // control transfer made by the previous instruction
+        uint64_t phaseNanos[NUM_PHASES];
+        bool phaseTimed[NUM_PHASES]; // the cached engine never times fetch on its own
+        double runSeconds;
+};
+
+// the call graph is updated one instruction late, once the target is known
+inline void Profiler::record(uint32_t pc, InstructionId id, uint32_t rd, uint32_t rs1) {
+    if (id == INST_INVALID || id == INST_SYSTEM) {
+        return; // these end the run without retiring
+    }
+    if (pending != TRANSFER_NONE || nodes.empty()) {
+        enterFunction(pc);
+    }
+    instructions++;
+    opcodes[id]++;
+    PCStats &stats = pcs[pc];
+    stats.count++;
+    stats.id = id;
+    nodes[current].instructions++;
+
+    // riscv calling convention hints: a jump that writes a link register is a
+    // call, a jalr through a link register that doesn't write one is a return
+    if (id == INST_JAL) {
+        pending = isLink(rd) ? TRANSFER_CALL : TRANSFER_NONE;
+    } else if (id == INST_JALR) {
+        if (isLink(rd)) {
+            pending = isLink(rs1) && rs1 != rd ? TRANSFER_RETURN_CALL : TRANSFER_CALL;
+        } else {
+            pending = isLink(rs1) ? TRANSFER_RETURN : TRANSFER_NONE;
+        }
+    }
+}
+
+#endif // PROFILER_H
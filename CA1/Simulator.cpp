@@ -0,0 +1,201 @@
+#include "Simulator.h"
+#include <chrono>
+#include <cstring>
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static uint64_t nanoseconds(Clock::time_point from, Clock::time_point to) {
+    return chrono::duration_cast<chrono::nanoseconds>(to - from).count();
+}
+
+// what one clock read adds to an interval, measured once. on some hosts it
+// is longer than the phase being timed
+static uint64_t clockOverhead() {
+    static const uint64_t overhead = [] {
+        const int reads = 1000;
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < reads - 1; i++) {
+            Clock::now();
+        }
+        return nanoseconds(start, Clock::now()) / reads;
+    }();
+    return overhead;
+}
+
+// an interval between two reads with the cost of the second taken out
+static uint64_t phaseNanoseconds(Clock::time_point from, Clock::time_point to) {
+    uint64_t elapsed = nanoseconds(from, to);
+    return elapsed > clockOverhead() ? elapsed - clockOverhead() : 0;
+}
+
+// map an engine name from the command line to its enum value
+bool parseEngine(const char *name, Engine &engine) {
+    if (strcmp(name, "ref") == 0) {
+        engine = ENGINE_REF;
+    } else if (strcmp(name, "cached") == 0) {
+        engine = ENGINE_CACHED;
+    } else if (strcmp(name, "threaded") == 0) {
+        engine = ENGINE_THREADED;
+    } else if (strcmp(name, "jit") == 0) {
+        engine = ENGINE_JIT;
+    } else if (strcmp(name, "lanes") == 0) {
+        engine = ENGINE_LANES;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+Simulator::Simulator(CPU &cpu, Engine engine) : cpu(cpu), engine(engine), threaded(cpu), jit(cpu) {
+    profiler = nullptr;
+    retired = 0;
+    seconds = 0;
+    stopInstructions = NO_STOP;
+    stopPC = NO_STOP;
+    stopped = false;
+}
+
+void Simulator::setStop(uint64_t instructions, uint64_t pc) {
+    stopInstructions = instructions;
+    stopPC = pc;
+}
+
+void Simulator::setProfiler(Profiler *profiler) {
+    this->profiler = profiler;
+    threaded.setProfiler(profiler);
+}
+
+// run until an instruction fails to execute, the pc runs past the program or
+// a stop condition is met
+uint64_t Simulator::run(const Program &program) {
+    unsigned long maxPC = program.end;
+    bool bounded = stopInstructions != NO_STOP || stopPC != NO_STOP;
+    stopped = false;
+    Clock::time_point start = Clock::now();
+    // trace sinks, the cache and pipeline models, the locality analyzer and
+    // the phase profiler have to see every instruction, which only
+    // executeDecoded guarantees, so those runs use the cached engine in
+    // place of the threaded engine and the jit
+    bool traced = cpu.getTraceSink() || cpu.getCaches() || cpu.getPipeline() || cpu.getLocality()
+        || cpu.getPhases();
+    if (engine == ENGINE_JIT && JitEngine::supported() && !profiler && !traced) {
+        retired += jit.run(maxPC, stopInstructions > retired ? stopInstructions - retired : 0, stopPC);
+        stopped = jit.hitStop();
+    } else if ((engine == ENGINE_THREADED || engine == ENGINE_JIT) && !traced) {
+        // the threaded engine runs the whole program in one call
+        if (!bounded) {
+            retired += threaded.run(maxPC);
+        } else {
+            uint64_t budget = stopInstructions > retired ? stopInstructions - retired : 0;
+            retired += threaded.runUntil(maxPC, budget, stopPC);
+            stopped = threaded.hitStop();
+        }
+    } else if (profiler) {
+        stepLoop<true>(maxPC, bounded);
+    } else {
+        stepLoop<false>(maxPC, bounded);
+    }
+    double elapsed = nanoseconds(start, Clock::now()) / 1e9;
+    seconds += elapsed;
+    if (profiler) {
+        profiler->addRunTime(elapsed);
+    }
+    return retired;
+}
+
+// the reference and cached engines. Profiled compiles in the profiler hook and
+// sampled per phase host timing, so unprofiled runs never read the clock
+template <bool Profiled>
+void Simulator::stepLoop(unsigned long maxPC, bool bounded) {
+    uint64_t start = retired;
+
+    // main cpu simulation loop - each iteration represents one clock cycle
+    while (true) {
+        cpu.updateCurrentFromNext(); // update state at start of cycle
+
+        // check if pc exceeds program bounds
+        if (cpu.readPC() > maxPC) {
+            break;
+        }
+        if (bounded && (retired >= stopInstructions || (cpu.readPC() == stopPC && retired > start))) {
+            stopped = true;
+            break;
+        }
+
+        // fetch, decode, and execute instruction
+        bool ok;
+        if (!Profiled) {
+            if (engine != ENGINE_REF) {
+                ok = cpu.step();
+            } else {
+                uint32_t currentInstruction = cpu.fetch();
+                InstructionParts parts = cpu.decode(currentInstruction);
+                ok = cpu.execute(parts);
+            }
+        } else {
+            // only one instruction in PHASE_SAMPLE_INTERVAL reads the clock
+            const uint64_t scale = Profiler::PHASE_SAMPLE_INTERVAL;
+            bool timed = retired % scale == 0;
+            Clock::time_point begin, decoded;
+            if (timed) {
+                begin = Clock::now();
+            }
+            DecodedInstruction uncached, *instruction = &uncached;
+            if (engine != ENGINE_REF) {
+                // a cache lookup counts as decode; fetch only happens on a miss
+                instruction = cpu.decodeCached();
+            } else {
+                uint32_t currentInstruction = cpu.fetch();
+                if (timed) {
+                    Clock::time_point fetched = Clock::now();
+                    profiler->addPhaseTime(Profiler::PHASE_FETCH, scale * phaseNanoseconds(begin, fetched));
+                    begin = fetched;
+                }
+                uncached = cpu.resolve(cpu.decode(currentInstruction));
+            }
+            if (timed) {
+                decoded = Clock::now();
+                profiler->addPhaseTime(Profiler::PHASE_DECODE, scale * phaseNanoseconds(begin, decoded));
+            }
+            const InstructionParts &parts = instruction->parts;
+            profiler->record(cpu.readPC(), instruction->id, parts.rd, parts.rs1);
+            ok = cpu.executeDecoded(*instruction);
+            if (timed) {
+                profiler->addPhaseTime(Profiler::PHASE_EXECUTE, scale * phaseNanoseconds(decoded, Clock::now()));
+            }
+        }
+        if (!ok) {
+            break; // stop execution on failure
+        }
+        retired++;
+    }
+}
+
+// instruction count and per-engine counters
+void Simulator::printStats(ostream &out) {
+    out << "instructions: " << retired << endl;
+    out << "host time: " << seconds << " s";
+    if (seconds > 0) {
+        out << " (" << retired / seconds / 1e6 << " MIPS)";
+    }
+    out << endl;
+    if (engine == ENGINE_THREADED) {
+        out << "threaded: " << threaded.getFallbacks() << " fallbacks, " << threaded.getFusions() << " fusions, "
+            << threaded.getSavedDispatches() << " dispatches saved" << endl;
+    }
+    if (engine == ENGINE_JIT) {
+        out << "jit: " << jit.getBlocks() << " blocks translated, " << jit.getFlushes() << " flushes, "
+            << jit.getFallbacks() << " interpreter fallbacks" << endl;
+    }
+    if (engine != ENGINE_REF) {
+        DecodeCache &cache = cpu.getDecodeCache();
+        uint64_t lookups = cache.getHits() + cache.getMisses();
+        out << "decode cache: " << cache.getHits() << " hits, " << cache.getMisses() << " misses, "
+            << cache.getInvalidations() << " invalidations";
+        if (lookups) {
+            out << " (" << (100.0 * cache.getHits() / lookups) << "% hit rate)";
+        }
+        out << endl;
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <cstdint>
+#include <iostream>
+#include "CPU.h"
+#include "Loader.h"
+#include "ThreadedEngine.h"
+#include "JitEngine.h"
+#include "Profiler.h"
+
+enum Engine {
+    ENGINE_REF,      // fetch, decode and execute every cycle
+    ENGINE_CACHED,   // skip decode through the decode cache
+    ENGINE_THREADED, // direct-threaded interpreter
+    ENGINE_JIT,      // x86-64 basic-block jit, threaded on other hosts or when profiling
+    ENGINE_LANES,    // batches run LaneEngine::LANES programs in lockstep; cached for single programs
+};
+
+bool parseEngine(const char *name, Engine &engine); // false for an unknown name
+
+// runs a loaded program on one cpu with the chosen execution engine
+class Simulator {
+    public:
+        Simulator(CPU &cpu, Engine engine);
+        static const uint64_t NO_STOP = UINT64_MAX;
+
+        uint64_t run(const Program &program); // returns instructions retired so far
+        // make run() return early once the retired count reaches instructions
+        // or before executing the instruction at pc; NO_STOP disables either
+        void setStop(uint64_t instructions, uint64_t pc);
+        bool stoppedEarly() { return stopped; } // last run() ended on a stop condition
+        uint64_t getRetired() { return retired; }
+        void setRetired(uint64_t count) { retired = count; } // e.g. after restoring a checkpoint
+        void setProfiler(Profiler *profiler); // nullptr to stop profiling
+        void printStats(std::ostream &out);
+    private:
+        template <bool Profiled>
+        void stepLoop(unsigned long maxPC, bool bounded);
+        CPU &cpu;
+        Engine engine;
+        ThreadedEngine threaded;
+        JitEngine jit;
+        Profiler *profiler;
+        uint64_t retired;
+        double seconds; // host time spent in run()
+        uint64_t stopInstructions;
+        uint64_t stopPC;
+        bool stopped;
+};
+
+#endif // SIMULATOR_H
@@ -0,0 +1,106 @@
+#include "ThreadPool.h"
+using namespace std;
+
+// start the workers, which sleep until tasks arrive
+ThreadPool::ThreadPool(unsigned threads) {
+    if (threads == 0) {
+        threads = thread::hardware_concurrency();
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+    queued = 0;
+    unfinished = 0;
+    nextWorker = 0;
+    stopping = false;
+    for (unsigned i = 0; i < threads; i++) {
+        workers.push_back(unique_ptr<Worker>(new Worker()));
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        this->threads.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+// finish outstanding work, then stop and join the workers
+ThreadPool::~ThreadPool() {
+    wait();
+    {
+        lock_guard<mutex> guard(stateLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (thread &t : threads) {
+        t.join();
+    }
+}
+
+// queue a task on the next worker's deque
+void ThreadPool::submit(function<void()> task) {
+    unsigned target;
+    {
+        lock_guard<mutex> guard(stateLock);
+        target = nextWorker;
+        nextWorker = (nextWorker + 1) % workers.size();
+        queued++;
+        unfinished++;
+    }
+    {
+        lock_guard<mutex> guard(workers[target]->lock);
+        workers[target]->tasks.push_back(move(task));
+    }
+    wake.notify_one();
+}
+
+// block until every submitted task has run
+void ThreadPool::wait() {
+    unique_lock<mutex> guard(stateLock);
+    idle.wait(guard, [this] { return unfinished == 0; });
+}
+
+// take the newest local task, or else the oldest task of another worker
+bool ThreadPool::popOrSteal(unsigned self, function<void()> &task) {
+    {
+        Worker &own = *workers[self];
+        lock_guard<mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            task = move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (unsigned i = 1; i < workers.size(); i++) {
+        Worker &victim = *workers[(self + i) % workers.size()];
+        lock_guard<mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+// run tasks until the pool is destroyed
+void ThreadPool::workerLoop(unsigned self) {
+    function<void()> task;
+    while (true) {
+        if (popOrSteal(self, task)) {
+            {
+                lock_guard<mutex> guard(stateLock);
+                queued--;
+            }
+            task();
+            task = nullptr;
+            lock_guard<mutex> guard(stateLock);
+            if (--unfinished == 0) {
+                idle.notify_all();
+            }
+            continue;
+        }
+        unique_lock<mutex> guard(stateLock);
+        wake.wait(guard, [this] { return stopping || queued > 0; });
+        if (stopping && queued == 0) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// fixed-size work-stealing thread pool. each worker owns a deque: it pops its
+// own newest task and, when empty, steals the oldest task from another worker
+class ThreadPool {
+    public:
+        ThreadPool(unsigned threads); // 0 means one per hardware thread
+        ~ThreadPool();
+        void submit(std::function<void()> task); // spread round robin over workers
+        void wait(); // block until every submitted task has finished
+        unsigned size() { return workers.size(); }
+    private:
+        struct Worker {
+            std::mutex lock;
+            std::deque<std::function<void()>> tasks;
+        };
+        bool popOrSteal(unsigned self, std::function<void()> &task);
+        void workerLoop(unsigned self);
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::vector<std::thread> threads;
+        std::mutex stateLock;
+        std::condition_variable wake; // tasks queued or stopping
+        std::condition_variable idle; // every task finished
+        size_t queued;                // tasks sitting in deques, guarded by stateLock
+        size_t unfinished;            // tasks submitted but not yet finished, guarded by stateLock
+        unsigned nextWorker;
+        bool stopping;
+};
+
+#endif // THREADPOOL_H
@@ -0,0 +1,301 @@
+#include "ThreadedEngine.h"
+
+ThreadedEngine::ThreadedEngine(CPU &cpu) : cpu(cpu) {
+    translateHandler = nullptr;
+    codeBase = 0;
+    fallbacks = 0;
+    fusions = 0;
+    savedDispatches = 0;
+    profiler = nullptr;
+    stopped = false;
+}
+
+// decode the instruction at pc and fill in the operands its handler uses
+InstructionId ThreadedEngine::translate(ThreadedOp &op, uint32_t pc) {
+    cpu.current_PC = pc;
+    DecodedInstruction decoded = cpu.resolve(cpu.decode(cpu.fetch()));
+    const InstructionParts &parts = decoded.parts;
+    op.rd = parts.rd == 0 ? 32 : parts.rd;
+    op.rs1 = parts.rs1;
+    op.rs2 = parts.rs2;
+    op.immediate = parts.immediate;
+    op.id = decoded.id;
+    return decoded.id;
+}
+
+// check whether the instruction at pc starts an idiom, translating the
+// operands of the instructions after it into their own slots
+int ThreadedEngine::fuse(uint32_t pc, unsigned long maxPC, InstructionId id) {
+    if (pc + 4 > maxPC || (id != INST_LUI && id != INST_AUIPC && id != INST_ADDI && id != INST_SLLI)) {
+        return id;
+    }
+    const ThreadedOp &first = slot(pc);
+    const ThreadedOp &second = slot(pc + 4);
+    InstructionId next = translate(slot(pc + 4), pc + 4);
+    int fused = id;
+    if ((id == INST_LUI || id == INST_AUIPC) && next == INST_ADDI && second.rs1 == first.rd && second.rd == first.rd) {
+        fused = id == INST_LUI ? FUSED_LUI_ADDI : FUSED_AUIPC_ADDI;
+    } else if (id == INST_AUIPC && next == INST_JALR && second.rs1 == first.rd) {
+        fused = FUSED_AUIPC_JALR;
+    } else if (id == INST_ADDI && next >= INST_BEQ && next <= INST_BGEU
+               && (second.rs1 == first.rd || second.rs2 == first.rd)) {
+        fused = FUSED_ADDI_BEQ + (next - INST_BEQ);
+    } else if (id == INST_SLLI && next == INST_ADD && pc + 8 <= maxPC
+               && (second.rs1 == first.rd || second.rs2 == first.rd)
+               && translate(slot(pc + 8), pc + 8) == INST_LW && slot(pc + 8).rs1 == second.rd) {
+        fused = FUSED_SLLI_ADD_LW;
+    }
+    if (fused != id) {
+        fusions++;
+    }
+    return fused;
+}
+
+// send the words touched by a store back through translation, along with any
+// superinstruction that could include them
+void ThreadedEngine::invalidate(uint32_t address) {
+    if (address + 3 < codeBase) {
+        return;
+    }
+    uint32_t first = address >= codeBase ? (address - codeBase) >> 2 : 0;
+    uint32_t last = (address + 3 - codeBase) >> 2;
+    for (uint32_t i = first >= 2 ? first - 2 : 0; i <= last && i < code.size(); i++) {
+        code[i].handler = translateHandler;
+    }
+}
+
+// the table starts at the page of the lowest pc run so far rather than at 0,
+// since a program linked high would otherwise need a slot for every word
+// below it
+void ThreadedEngine::cover(uint32_t pc, unsigned long maxPC) {
+    ThreadedOp blank{translateHandler, 0, 0, 0, 0, 0};
+    uint32_t base = pc & ~Memory::PAGE_MASK;
+    if (code.empty()) {
+        codeBase = base;
+    } else if (base < codeBase) {
+        code.insert(code.begin(), (codeBase - base) >> 2, blank);
+        codeBase = base;
+    }
+    if (maxPC >= codeBase && code.size() < ((maxPC - codeBase) >> 2) + 1) {
+        code.resize(((maxPC - codeBase) >> 2) + 1, blank);
+    }
+}
+
+// run from the cpu's next pc until an invalid instruction or the end of the
+// program. returns the number of instructions retired
+uint64_t ThreadedEngine::run(unsigned long maxPC) {
+    if (profiler) {
+        return runLoop<false, true>(maxPC, 0, 0);
+    }
+    return runLoop<false, false>(maxPC, 0, 0);
+}
+
+uint64_t ThreadedEngine::runUntil(unsigned long maxPC, uint64_t budget, uint64_t stopPC) {
+    if (profiler) {
+        return runLoop<true, true>(maxPC, budget, stopPC);
+    }
+    return runLoop<true, false>(maxPC, budget, stopPC);
+}
+
+// the interpreter proper. Bounded compiles in the stop checks and Profiled
+// the profiler hook, so that plain runs dispatch without either
+template <bool Bounded, bool Profiled>
+uint64_t ThreadedEngine::runLoop(unsigned long maxPC, uint64_t budget, uint64_t stopPC) {
+    // indexed by InstructionId
+    static const void *const handlers[FUSED_COUNT] = {
+        &&do_invalid,
+        &&do_lui, &&do_auipc, &&do_jal, &&do_jalr,
+        &&do_beq, &&do_bne, &&do_blt, &&do_bge, &&do_bltu, &&do_bgeu,
+        &&do_lb, &&do_lh, &&do_lw, &&do_lbu, &&do_lhu,
+        &&do_sb, &&do_sh, &&do_sw,
+        &&do_addi, &&do_slti, &&do_sltiu, &&do_xori, &&do_ori, &&do_andi,
+        &&do_slli, &&do_srli, &&do_srai,
+        &&do_add, &&do_sub, &&do_sll, &&do_slt, &&do_sltu,
+        &&do_xor, &&do_srl, &&do_sra, &&do_or, &&do_and,
+        &&do_fence, &&do_invalid,
+        &&do_atomic, &&do_atomic, &&do_atomic, &&do_atomic, &&do_atomic, &&do_atomic,
+        &&do_atomic, &&do_atomic, &&do_atomic, &&do_atomic, &&do_atomic,
+        &&do_lui_addi, &&do_auipc_addi, &&do_auipc_jalr,
+        &&do_addi_beq, &&do_addi_bne, &&do_addi_blt, &&do_addi_bge, &&do_addi_bltu, &&do_addi_bgeu,
+        &&do_slli_add_lw,
+    };
+    const bool fusing = !Bounded && !Profiled;
+    // label addresses differ between instantiations, so handlers translated
+    // by another one must not be reused
+    if (translateHandler != &&do_translate) {
+        translateHandler = &&do_translate;
+        code.assign(code.size(), ThreadedOp{translateHandler, 0, 0, 0, 0, 0});
+    }
+    uint32_t pc = cpu.next_PC;
+    cover(pc <= maxPC ? pc : maxPC, maxPC);
+    // pcs past maxPC or below codeBase both wrap above span
+    unsigned long span = maxPC - codeBase;
+
+    Memory &memory = cpu.memory;
+    for (int i = 0; i < 32; i++) {
+        regs[i] = cpu.regFile.read(i);
+    }
+    uint64_t executed = 0;
+    uint64_t saved = 0;
+    ThreadedOp *op;
+    stopped = false;
+
+// go to the handler for pc, leaving once pc runs past the program
+#define DISPATCH() \
+    do { \
+        if (U(pc - codeBase) > span) goto outside; \
+        if (Bounded && (executed >= budget || (pc == stopPC && executed))) goto bounded; \
+        if (pc & 3) goto do_generic; \
+        op = &code[(pc - codeBase) >> 2]; \
+        executed++; \
+        if (Profiled && op->handler != translateHandler) { \
+            profiler->record(pc, static_cast<InstructionId>(op->id), op->rd, op->rs1); \
+        } \
+        goto *op->handler; \
+    } while (0)
+#define NEXT() do { pc += 4; DISPATCH(); } while (0)
+#define RS1 regs[op->rs1]
+#define RS2 regs[op->rs2]
+#define RD regs[op->rd]
+#define U(x) static_cast<uint32_t>(x)
+#define BRANCH(condition) \
+    do { \
+        if (condition) { pc += op->immediate; DISPATCH(); } \
+        NEXT(); \
+    } while (0)
+// move on to the next part of a superinstruction without dispatching
+#define FUSED_NEXT() do { op++; pc += 4; executed++; saved++; } while (0)
+#define STORE(access) \
+    do { \
+        uint32_t address = RS1 + op->immediate; \
+        access; \
+        cpu.decodeCache.invalidate(address); \
+        invalidate(address); \
+        NEXT(); \
+    } while (0)
+
+    DISPATCH();
+
+outside:
+    // past the end of the program, or below the code seen so far
+    if (pc > maxPC) goto done;
+    cover(pc, maxPC);
+    span = maxPC - codeBase;
+    DISPATCH();
+
+do_translate: {
+    executed--; // counted again on redispatch
+    InstructionId id = translate(*op, pc);
+    op->handler = handlers[fusing ? fuse(pc, maxPC, id) : id];
+    DISPATCH();
+}
+
+do_atomic:
+    executed--; // counted again below
+    // fall through: atomics take the reference datapath too
+do_generic:
+    // a misaligned pc has no slot in the code array; use the reference
+    // datapath. these rare instructions are not profiled
+    executed++;
+    fallbacks++;
+    for (int i = 1; i < 32; i++) cpu.regFile.write(i, regs[i]);
+    cpu.current_PC = pc;
+    if (!cpu.step()) {
+        executed--;
+        goto stop;
+    }
+    for (int i = 1; i < 32; i++) regs[i] = cpu.regFile.read(i);
+    pc = cpu.next_PC;
+    DISPATCH();
+
+do_lui:   RD = op->immediate; NEXT();
+do_auipc: RD = pc + op->immediate; NEXT();
+do_jal:   RD = pc + 4; pc += op->immediate; DISPATCH();
+do_jalr: {
+    uint32_t target = (RS1 + op->immediate) & ~1u;
+    RD = pc + 4;
+    pc = target;
+    DISPATCH();
+}
+
+do_beq:  BRANCH(RS1 == RS2);
+do_bne:  BRANCH(RS1 != RS2);
+do_blt:  BRANCH(RS1 < RS2);
+do_bge:  BRANCH(RS1 >= RS2);
+do_bltu: BRANCH(U(RS1) < U(RS2));
+do_bgeu: BRANCH(U(RS1) >= U(RS2));
+
+do_lb:  RD = static_cast<int8_t>(memory.readByte(RS1 + op->immediate)); NEXT();
+do_lh:  RD = static_cast<int16_t>(memory.readHalf(RS1 + op->immediate)); NEXT();
+do_lw:  RD = memory.read(RS1 + op->immediate); NEXT();
+do_lbu: RD = memory.readByte(RS1 + op->immediate); NEXT();
+do_lhu: RD = memory.readHalf(RS1 + op->immediate); NEXT();
+
+do_sb: STORE(memory.writeByte(address, RS2 & 0xFF));
+do_sh: STORE(memory.writeHalf(address, RS2 & 0xFFFF));
+do_sw: STORE(memory.write(address, RS2));
+
+do_addi:  RD = U(RS1) + U(op->immediate); NEXT();
+do_slti:  RD = RS1 < op->immediate; NEXT();
+do_sltiu: RD = U(RS1) < U(op->immediate); NEXT();
+do_xori:  RD = RS1 ^ op->immediate; NEXT();
+do_ori:   RD = RS1 | op->immediate; NEXT();
+do_andi:  RD = RS1 & op->immediate; NEXT();
+do_slli:  RD = U(RS1) << (op->immediate & 0x1F); NEXT();
+do_srli:  RD = U(RS1) >> (op->immediate & 0x1F); NEXT();
+do_srai:  RD = RS1 >> (op->immediate & 0x1F); NEXT();
+
+do_add:  RD = U(RS1) + U(RS2); NEXT();
+do_sub:  RD = U(RS1) - U(RS2); NEXT();
+do_sll:  RD = U(RS1) << (RS2 & 0x1F); NEXT();
+do_slt:  RD = RS1 < RS2; NEXT();
+do_sltu: RD = U(RS1) < U(RS2); NEXT();
+do_xor:  RD = RS1 ^ RS2; NEXT();
+do_srl:  RD = U(RS1) >> (RS2 & 0x1F); NEXT();
+do_sra:  RD = RS1 >> (RS2 & 0x1F); NEXT();
+do_or:   RD = RS1 | RS2; NEXT();
+do_and:  RD = RS1 & RS2; NEXT();
+
+do_fence: __atomic_thread_fence(__ATOMIC_SEQ_CST); NEXT();
+
+do_lui_addi:    RD = op->immediate; FUSED_NEXT(); goto do_addi;
+do_auipc_addi:  RD = pc + op->immediate; FUSED_NEXT(); goto do_addi;
+do_auipc_jalr:  RD = pc + op->immediate; FUSED_NEXT(); goto do_jalr;
+do_addi_beq:    RD = U(RS1) + U(op->immediate); FUSED_NEXT(); goto do_beq;
+do_addi_bne:    RD = U(RS1) + U(op->immediate); FUSED_NEXT(); goto do_bne;
+do_addi_blt:    RD = U(RS1) + U(op->immediate); FUSED_NEXT(); goto do_blt;
+do_addi_bge:    RD = U(RS1) + U(op->immediate); FUSED_NEXT(); goto do_bge;
+do_addi_bltu:   RD = U(RS1) + U(op->immediate); FUSED_NEXT(); goto do_bltu;
+do_addi_bgeu:   RD = U(RS1) + U(op->immediate); FUSED_NEXT(); goto do_bgeu;
+do_slli_add_lw:
+    RD = U(RS1) << (op->immediate & 0x1F); FUSED_NEXT();
+    RD = U(RS1) + U(RS2); FUSED_NEXT();
+    goto do_lw;
+
+do_invalid:
+    // the reference loop stops on the same instruction without changing state
+    executed--;
+    cpu.current_PC = pc;
+    goto stop;
+
+bounded:
+    stopped = true;
+done:
+    cpu.current_PC = pc;
+stop:
+#undef STORE
+#undef FUSED_NEXT
+#undef BRANCH
+#undef U
+#undef RD
+#undef RS2
+#undef RS1
+#undef NEXT
+#undef DISPATCH
+    for (int i = 1; i < 32; i++) {
+        cpu.regFile.write(i, regs[i]);
+    }
+    cpu.next_PC = pc;
+    savedDispatches += saved;
+    return executed;
+}
@@ -0,0 +1,73 @@
+#ifndef THREADEDENGINE_H
+#define THREADEDENGINE_H
+
+#include <cstdint>
+#include <vector>
+#include "CPU.h"
+#include "Profiler.h"
+
+// one translated instruction: the handler to jump to plus its operands
+struct ThreadedOp {
+    const void *handler;
+    uint8_t rd;          // 32 when the instruction writes x0
+    uint8_t rs1;
+    uint8_t rs2;
+    uint8_t id;          // InstructionId, for the profiler
+    int32_t immediate;
+};
+
+// superinstructions: common adjacent instruction idioms that are dispatched
+// once and then run their parts back to back
+enum FusedId {
+    FUSED_LUI_ADDI = INST_COUNT, // li of a 32-bit constant
+    FUSED_AUIPC_ADDI,            // la, pc-relative address
+    FUSED_AUIPC_JALR,            // call to a pc-relative target
+    FUSED_ADDI_BEQ,              // loop counter update and test, one per branch
+    FUSED_ADDI_BNE,
+    FUSED_ADDI_BLT,
+    FUSED_ADDI_BGE,
+    FUSED_ADDI_BLTU,
+    FUSED_ADDI_BGEU,
+    FUSED_SLLI_ADD_LW,           // indexed word load: base + (index << scale)
+    FUSED_COUNT,
+};
+
+// direct-threaded interpreter: each instruction is translated once into the
+// handler for its InstructionId and dispatched with computed goto. the rare
+// misaligned pc and the rv32a atomics go through CPU::step so semantics
+// match CPU::execute.
+// plain runs also fuse the idioms in FusedId; bounded and profiled runs
+// dispatch every instruction so they can stop or count between any two
+class ThreadedEngine {
+    public:
+        ThreadedEngine(CPU &cpu);
+        uint64_t run(unsigned long maxPC); // returns instructions retired
+        // same, but also stop after budget instructions or on reaching stopPC
+        // (other than where the run starts); stopPC above 32 bits disables it
+        uint64_t runUntil(unsigned long maxPC, uint64_t budget, uint64_t stopPC);
+        bool hitStop() { return stopped; } // last run ended on a runUntil condition
+        void invalidate(uint32_t address); // retranslate code overwritten by a store
+        uint64_t getFallbacks() { return fallbacks; }
+        uint64_t getFusions() { return fusions; } // superinstructions formed at translation
+        uint64_t getSavedDispatches() { return savedDispatches; }
+        void setProfiler(Profiler *profiler) { this->profiler = profiler; } // nullptr to stop profiling
+    private:
+        InstructionId translate(ThreadedOp &op, uint32_t pc);
+        int fuse(uint32_t pc, unsigned long maxPC, InstructionId id); // FusedId or id
+        void cover(uint32_t pc, unsigned long maxPC); // grow code to span pc's page up to maxPC
+        ThreadedOp &slot(uint32_t pc) { return code[(pc - codeBase) >> 2]; }
+        template <bool Bounded, bool Profiled>
+        uint64_t runLoop(unsigned long maxPC, uint64_t budget, uint64_t stopPC);
+        CPU &cpu;
+        std::vector<ThreadedOp> code; // indexed by (pc - codeBase) / 4
+        uint32_t codeBase;            // page aligned; programs may be linked anywhere
+        const void *translateHandler;
+        int32_t regs[33]; // register 32 is a sink for writes to x0
+        uint64_t fallbacks;
+        uint64_t fusions;
+        uint64_t savedDispatches;
+        Profiler *profiler;
+        bool stopped;
+};
+
+#endif // THREADEDENGINE_H
@@ -0,0 +1,103 @@
+#include "TraceOutput.h"
+using namespace std;
+
+#define GZIP_COMMAND "gzip -c > "
+#define BZIP2_COMMAND "bzip2 -c > "
+
+TraceOutput::TraceOutput() {
+    file = nullptr;
+    piped = false;
+    current = nullptr;
+    used = 0;
+    closing = false;
+    failed = false;
+}
+
+TraceOutput::~TraceOutput() {
+    close();
+}
+
+static bool endsWith(const string &text, const string &suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool TraceOutput::open(const string &path) {
+    if (file) {
+        return false;
+    }
+    piped = endsWith(path, ".gz") || endsWith(path, ".bz2");
+    if (piped) {
+        // single quotes keep the path literal for the shell
+        string quoted = "'";
+        for (char c : path) {
+            quoted += c == '\'' ? string("'\\''") : string(1, c);
+        }
+        quoted += "'";
+        file = popen(((endsWith(path, ".gz") ? GZIP_COMMAND : BZIP2_COMMAND) + quoted).c_str(), "w");
+    } else {
+        file = fopen(path.c_str(), "wb");
+    }
+    if (!file) {
+        return false;
+    }
+
+    buffers.assign(BUFFERS, vector<uint8_t>(BUFFER_SIZE));
+    free.clear();
+    for (int i = 1; i < BUFFERS; i++) {
+        free.push_back(buffers[i].data());
+    }
+    current = buffers[0].data();
+    used = 0;
+    closing = false;
+    failed = false;
+    writer = thread(&TraceOutput::writerLoop, this);
+    return true;
+}
+
+void TraceOutput::submit() {
+    unique_lock<mutex> guard(lock);
+    full.push_back({current, used});
+    changed.notify_all();
+    changed.wait(guard, [this] { return !free.empty(); });
+    current = free.back();
+    free.pop_back();
+    used = 0;
+}
+
+// write full buffers in order until closed and drained
+void TraceOutput::writerLoop() {
+    unique_lock<mutex> guard(lock);
+    while (true) {
+        changed.wait(guard, [this] { return !full.empty() || closing; });
+        if (full.empty()) {
+            return;
+        }
+        pair<uint8_t *, size_t> buffer = full.front();
+        full.pop_front();
+        guard.unlock();
+        bool ok = fwrite(buffer.first, 1, buffer.second, file) == buffer.second;
+        guard.lock();
+        failed = failed || !ok;
+        free.push_back(buffer.first);
+        changed.notify_all();
+    }
+}
+
+bool TraceOutput::close() {
+    if (!file) {
+        return false;
+    }
+    {
+        lock_guard<mutex> guard(lock);
+        if (used) {
+            full.push_back({current, used});
+        }
+        closing = true;
+    }
+    changed.notify_all();
+    writer.join();
+    int status = piped ? pclose(file) : fclose(file);
+    file = nullptr;
+    buffers.clear();
+    return !failed && status == 0;
+}
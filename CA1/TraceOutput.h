@@ -0,0 +1,65 @@
+#ifndef TRACEOUTPUT_H
+#define TRACEOUTPUT_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// streaming trace file writer. the producer fills one buffer while a
+// background thread writes full ones, so the simulation only blocks when the
+// disk or compressor falls behind. paths ending in .gz or .bz2 are piped
+// through gzip or bzip2, the same tools the CA2 trace reader decompresses with
+class TraceOutput {
+    public:
+        TraceOutput();
+        ~TraceOutput();
+        TraceOutput(const TraceOutput &) = delete;
+        TraceOutput &operator=(const TraceOutput &) = delete;
+
+        bool open(const std::string &path);
+        void write(const void *data, size_t size);
+        void put(uint8_t byte) { if (used == BUFFER_SIZE) submit(); current[used++] = byte; }
+        bool close(); // flush and wait for the writer; false if anything failed
+    private:
+        static const size_t BUFFER_SIZE = 1u << 20;
+        static const int BUFFERS = 4;
+
+        void submit(); // hand the current buffer to the writer and take a free one
+        void writerLoop();
+
+        FILE *file;
+        bool piped;
+        uint8_t *current;
+        size_t used;
+        std::vector<std::vector<uint8_t>> buffers;
+        std::thread writer;
+        std::mutex lock;
+        std::condition_variable changed;
+        std::deque<std::pair<uint8_t *, size_t>> full; // waiting to be written, guarded by lock
+        std::vector<uint8_t *> free;                    // guarded by lock
+        bool closing;
+        bool failed;
+};
+
+inline void TraceOutput::write(const void *data, size_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    while (size > 0) {
+        if (used == BUFFER_SIZE) {
+            submit();
+        }
+        size_t chunk = BUFFER_SIZE - used < size ? BUFFER_SIZE - used : size;
+        memcpy(current + used, bytes, chunk);
+        used += chunk;
+        bytes += chunk;
+        size -= chunk;
+    }
+}
+
+#endif // TRACEOUTPUT_H
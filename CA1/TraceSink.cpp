@@ -0,0 +1,141 @@
+#include "TraceSink.h"
+#include <cstdio>
+using namespace std;
+
+// CA2 trace record types, stored in the upper nibble of the code byte
+enum BranchType {
+    BRANCH_TAKEN = 1,
+    BRANCH_NOT_TAKEN = 2,
+    BRANCH_UNCONDITIONAL = 3,
+    BRANCH_INDIRECT = 4,
+    BRANCH_CALL = 5,
+    BRANCH_INDIRECT_CALL = 6,
+    BRANCH_RETURN = 7,
+};
+
+// x86 condition codes for the rv32 compares: e, ne, l, ge, b, ae
+static uint8_t conditionCode(InstructionId id) {
+    switch (id) {
+        case INST_BEQ: return 0x4;
+        case INST_BNE: return 0x5;
+        case INST_BLT: return 0xC;
+        case INST_BGE: return 0xD;
+        case INST_BLTU: return 0x2;
+        default: return 0x3; // bgeu
+    }
+}
+
+// x1 and x5 are the link registers of the standard calling convention
+static bool isLink(uint32_t reg) {
+    return reg == 1 || reg == 5;
+}
+
+unique_ptr<TraceSink> TraceSink::create(const string &spec) {
+    size_t colon = spec.find(':');
+    if (colon == string::npos || colon + 1 == spec.size()) {
+        return nullptr;
+    }
+    string format = spec.substr(0, colon);
+    string path = spec.substr(colon + 1);
+    if (format == "branch") {
+        unique_ptr<BranchTraceSink> sink(new BranchTraceSink());
+        return sink->open(path) ? move(sink) : nullptr;
+    }
+    if (format == "procsim") {
+        unique_ptr<ProcsimTraceSink> sink(new ProcsimTraceSink());
+        return sink->open(path) ? move(sink) : nullptr;
+    }
+    return nullptr;
+}
+
+void BranchTraceSink::retire(const TraceRecord &record) {
+    const InstructionParts &parts = record.decoded->parts;
+    uint8_t code;
+    uint32_t target;
+    switch (record.decoded->id) {
+        case INST_BEQ: case INST_BNE: case INST_BLT:
+        case INST_BGE: case INST_BLTU: case INST_BGEU:
+            target = record.pc + parts.immediate;
+            code = (record.taken ? BRANCH_TAKEN : BRANCH_NOT_TAKEN) << 4;
+            code |= conditionCode(record.decoded->id);
+            break;
+        case INST_JAL:
+            target = record.nextPC;
+            code = (isLink(parts.rd) ? BRANCH_CALL : BRANCH_UNCONDITIONAL) << 4;
+            break;
+        case INST_JALR:
+            target = record.nextPC;
+            if (isLink(parts.rd)) {
+                code = BRANCH_INDIRECT_CALL << 4;
+            } else if (isLink(parts.rs1)) {
+                code = BRANCH_RETURN << 4;
+            } else {
+                code = BRANCH_INDIRECT << 4;
+            }
+            break;
+        default:
+            return;
+    }
+    uint8_t bytes[9];
+    bytes[0] = code;
+    for (int i = 0; i < 4; i++) {
+        bytes[1 + i] = record.pc >> (8 * i);
+        bytes[5 + i] = target >> (8 * i);
+    }
+    output.write(bytes, sizeof(bytes));
+}
+
+void ProcsimTraceSink::retire(const TraceRecord &record) {
+    const DecodedInstruction &decoded = *record.decoded;
+    const InstructionParts &parts = decoded.parts;
+    int op, dest = -1, src0 = -1, src1 = -1;
+    switch (decoded.id) {
+        case INST_LUI: case INST_AUIPC:
+            op = 0;
+            break;
+        case INST_JAL:
+            op = 1;
+            break;
+        case INST_JALR:
+            op = 1;
+            src0 = parts.rs1;
+            break;
+        case INST_BEQ: case INST_BNE: case INST_BLT:
+        case INST_BGE: case INST_BLTU: case INST_BGEU:
+        case INST_SB: case INST_SH: case INST_SW:
+            op = decoded.signals[ControlSignals::MemWrite] ? 2 : 1;
+            src0 = parts.rs1;
+            src1 = parts.rs2;
+            break;
+        case INST_LB: case INST_LH: case INST_LW: case INST_LBU: case INST_LHU: case INST_LR_W:
+            op = 2;
+            src0 = parts.rs1;
+            break;
+        case INST_SC_W: case INST_AMOSWAP_W: case INST_AMOADD_W: case INST_AMOXOR_W: case INST_AMOAND_W:
+        case INST_AMOOR_W: case INST_AMOMIN_W: case INST_AMOMAX_W: case INST_AMOMINU_W: case INST_AMOMAXU_W:
+            op = 2;
+            src0 = parts.rs1;
+            src1 = parts.rs2;
+            break;
+        case INST_ADD: case INST_SUB: case INST_SLL: case INST_SLT: case INST_SLTU:
+        case INST_XOR: case INST_SRL: case INST_SRA: case INST_OR: case INST_AND:
+            op = 0;
+            src0 = parts.rs1;
+            src1 = parts.rs2;
+            break;
+        case INST_ADDI: case INST_SLTI: case INST_SLTIU: case INST_XORI: case INST_ORI:
+        case INST_ANDI: case INST_SLLI: case INST_SRLI: case INST_SRAI:
+            op = 0;
+            src0 = parts.rs1;
+            break;
+        default:
+            op = -1;
+            break;
+    }
+    if (decoded.signals[ControlSignals::RegWrite] && parts.rd != 0) {
+        dest = parts.rd;
+    }
+    char line[64];
+    int length = snprintf(line, sizeof(line), "%x %d %d %d %d\n", record.pc, op, dest, src0, src1);
+    output.write(line, length);
+}
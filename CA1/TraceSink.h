@@ -0,0 +1,57 @@
+#ifndef TRACESINK_H
+#define TRACESINK_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "DecodeCache.h"
+#include "TraceOutput.h"
+
+// one retired instruction as a trace sink sees it
+struct TraceRecord {
+    uint32_t pc;
+    uint32_t nextPC;  // where execution continues, so branch outcomes are known
+    uint32_t address; // effective address of loads and stores, alu result otherwise
+    bool taken;       // control left the fall through path
+    const DecodedInstruction *decoded;
+};
+
+// receives every retired instruction from CPU::executeDecoded. sinks turn
+// the stream into the trace formats other tools read
+class TraceSink {
+    public:
+        virtual ~TraceSink() {}
+        virtual void retire(const TraceRecord &record) = 0;
+        virtual bool finish() = 0; // flush and close; false if writing failed
+
+        // "branch:path" or "procsim:path"; nullptr for an unknown format or
+        // a path that can't be opened
+        static std::unique_ptr<TraceSink> create(const std::string &spec);
+};
+
+// the 9 byte records CA2's predict reads: a type and condition code byte,
+// then the little endian branch address and target. every control transfer
+// is written; conditional branches carry the x86 condition code closest to
+// the rv32 compare so predictors that key on it still see distinct kinds
+class BranchTraceSink : public TraceSink {
+    public:
+        bool open(const std::string &path) { return output.open(path); }
+        void retire(const TraceRecord &record) override;
+        bool finish() override { return output.close(); }
+    private:
+        TraceOutput output;
+};
+
+// CA3 procsim text lines: "address op dest src0 src1" with -1 for an unused
+// register. op 0 is alu work, 1 branches and jumps, 2 memory accesses and -1
+// anything else, matching the k0, k1 and k2 function unit classes
+class ProcsimTraceSink : public TraceSink {
+    public:
+        bool open(const std::string &path) { return output.open(path); }
+        void retire(const TraceRecord &record) override;
+        bool finish() override { return output.close(); }
+    private:
+        TraceOutput output;
+};
+
+#endif // TRACESINK_H
@@ -1,5 +1,18 @@
 #include "CPU.h"
 #include "InstructionParts.h"
+#include "Loader.h"
+#include "Simulator.h"
+#include "BatchRunner.h"
+#include "Checkpoint.h"
+#include "Profiler.h"
+#include "CoSimulator.h"
+#include "TraceSink.h"
+#include "CacheModel.h"
+#include "PipelineModel.h"
+#include "LocalityAnalyzer.h"
+#include "PhaseProfiler.h"
+#include "MultiHart.h"
+#include "ForkRunner.h"
 
 #include <iostream>
 #include <bitset>
@@ -8,6 +21,9 @@
 #include <string>
 #include<fstream>
 #include <sstream>
+#include <cstring>
+#include <unistd.h>
+#include <vector>
 using namespace std;
 
 /*
@@ -17,68 +33,428 @@ Add all the required standard and developed libraries here
 /*
 Put/Define any helper function/definitions you need here
 */
+// print command line usage and exit
+void printUsage(char *name) {
+	cerr << "usage: " << name << " [-e engine] [-s] [-M file@address] [-p stacks] [-t format:file] [-m caches] [-l pipeline] [-a locality] [-v phases] <program: instMem hex text, RV32 ELF or raw binary>" << endl;
+	cerr << "       " << name << " [-e engine] [-s] [-c i<count>|p<hexpc> -o prefix] -r <checkpoint>" << endl;
+	cerr << "       " << name << " [-e engine] [-s] [-M file@address] -n harts [-P | -q quantum] <program>" << endl;
+	cerr << "       " << name << " [-e engine] [-j threads] [-M file@address] -b <manifest>" << endl;
+	cerr << "       " << name << " [-e engine] [-j threads] [-c i<count>|p<hexpc>] [-r checkpoint] -f variants [program]" << endl;
+	cerr << "       " << name << " [-e engine] -d engine [-i interval] [-o prefix] [-r checkpoint] [program]" << endl;
+	cerr << "  -e ref|cached|threaded|jit|lanes\texecution engine (default cached); lanes runs -b" << endl;
+	cerr << "\t\tprograms 8 or 16 at a time in lockstep when built with -mavx2 or -mavx512f," << endl;
+	cerr << "\t\tthreaded without them, and is cached otherwise" << endl;
+	cerr << "  -s\t\tprint simulator statistics to stderr" << endl;
+	cerr << "  -M file@address[:ro|:cow]\tmmap file into guest memory at a page aligned address once" << endl;
+	cerr << "\t\tevery program is loaded or restored, without copying it; guest stores go to private" << endl;
+	cerr << "\t\tcopies of its pages, taken by the simulator (ro, the default) or the kernel (cow)." << endl;
+	cerr << "\t\tmay be repeated" << endl;
+	cerr << "  -p stacks\tprofile the run: report to stderr, folded call stacks to the stacks file" << endl;
+	cerr << "  -t branch:file\twrite a CA2 branch trace of the run (.gz and .bz2 are compressed)" << endl;
+	cerr << "  -t procsim:file\twrite a CA3 procsim instruction trace of the run" << endl;
+	cerr << "  -m caches\tmodel caches and report per level statistics and amat to stderr. caches is" << endl;
+	cerr << "\t\tdefault or overrides like l1d=16k/4/64/plru/wt/3,l2=none,mem=80, where a level" << endl;
+	cerr << "\t\tis size/ways/line[/lru|plru|rrip[/wb|wt[/latency]]]" << endl;
+	cerr << "  -l pipeline\tmodel a 5-stage in-order pipeline and report cpi, stalls and stage occupancy" << endl;
+	cerr << "\t\tto stderr. pipeline is nottaken|btfn|bimodal[:bits]|gshare[:bits] for the branch" << endl;
+	cerr << "\t\tpredictor, then optionally ,btb=<entries> and ,noforward; cache misses from -m stall it" << endl;
+	cerr << "  -a locality\treport reuse distances, the lru miss ratio curve and working sets to stderr." << endl;
+	cerr << "\t\tlocality is default or options like line=64,interval=1m,fetch,intervals=<csv file>" << endl;
+	cerr << "  -v phases\tcluster basic block vectors and report simulation points and weights to stderr." << endl;
+	cerr << "\t\tphases is default or options like interval=1m,k=10,seed=1,out=<prefix> for simpoint" << endl;
+	cerr << "\t\tfiles. -c i<interval>, with the same interval (the default is 1000000), then" << endl;
+	cerr << "\t\tcheckpoints the start of every interval, point n in prefix.n.ckpt" << endl;
+	cerr << "  -n harts\trun harts copies of the program on shared memory, hart id in a0 and the" << endl;
+	cerr << "\t\thart count in a1; prints each hart's result on its own line" << endl;
+	cerr << "  -q quantum\tinstructions per turn when harts take turns on one thread (default 1000)" << endl;
+	cerr << "  -P\t\trun each hart on its own host thread instead of taking turns" << endl;
+	cerr << "  -b manifest\trun every program listed in manifest, one JSON result line each" << endl;
+	cerr << "  -j threads\tworker threads for -b and -f (default one per hardware thread)" << endl;
+	cerr << "  -f variants\trun the program once up to the -c stop (or not at all), then fork it once" << endl;
+	cerr << "\t\tper line of variants, each line setting x<n>=value registers and <address>=value" << endl;
+	cerr << "\t\tmemory words before running to the end; one JSON result line each" << endl;
+	cerr << "  -c i<count>\tcheckpoint every count instructions; k and m multiply by 1024 and 1048576" << endl;
+	cerr << "  -c p<hexpc>\tcheckpoint once, the first time pc is reached" << endl;
+	cerr << "  -o prefix\tcheckpoint files are prefix.1.ckpt, prefix.2.ckpt, ... (default checkpoint)" << endl;
+	cerr << "  -r file\trestore a checkpoint and continue from it instead of loading a program" << endl;
+	cerr << "  -d engine\tcheck the -e engine against this one in lockstep; on divergence" << endl;
+	cerr << "\t\twrite prefix.diverge.ckpt and exit with status 1" << endl;
+	cerr << "  -i count\tinstructions between lockstep state comparisons (default 65536)" << endl;
+	exit(-1);
+}
+
+// a whole number with an optional k or m suffix, read like -a and -v read theirs
+bool parseCount(const char *text, uint64_t &value) {
+	char *end;
+	value = strtoull(text, &end, 10);
+	if (end == text) {
+		return false;
+	}
+	if (*end == 'k' || *end == 'K') {
+		value <<= 10;
+		end++;
+	} else if (*end == 'm' || *end == 'M') {
+		value <<= 20;
+		end++;
+	}
+	return *end == '\0';
+}
+
+// map each file@address[:ro|:cow] into memory; false after reporting a bad one
+bool mapFiles(const vector<const char *> &specs, Memory &memory) {
+	for (const char *spec : specs) {
+		string error;
+		if (!Loader::mapSpec(spec, memory, error)) {
+			cerr << error << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
 // main cpu simulator function
 int main(int argc, char* argv[]) {
 	// load instruction file into memory and execute cpu simulation
 
-	char instMem[4096];
+	// parse command line options
+	Engine engine = ENGINE_CACHED;
+	bool printStats = false;
+	const char *manifest = nullptr;
+	unsigned threads = 0;
+	uint64_t checkpointEvery = 0;
+	uint64_t checkpointPC = Simulator::NO_STOP;
+	string checkpointPrefix = "checkpoint";
+	const char *restoreFrom = nullptr;
+	const char *foldedStacks = nullptr;
+	const char *traceSpec = nullptr;
+	const char *cacheSpec = nullptr;
+	const char *pipelineSpec = nullptr;
+	const char *variantsPath = nullptr;
+	const char *localitySpec = nullptr;
+	const char *phaseSpec = nullptr;
+	vector<const char *> mapSpecs;
+	unsigned harts = 0;
+	uint64_t quantum = 1000;
+	bool parallel = false;
+	bool cosim = false;
+	Engine referenceEngine = ENGINE_REF;
+	uint64_t cosimInterval = 1u << 16;
+	int opt;
+	while ((opt = getopt(argc, argv, "e:sM:b:j:c:o:r:p:t:m:l:a:v:f:n:q:Pd:i:")) != -1) {
+		switch (opt) {
+			case 'e':
+				if (!parseEngine(optarg, engine)) {
+					printUsage(argv[0]);
+				}
+				break;
+			case 's':
+				printStats = true;
+				break;
+			case 'M':
+				mapSpecs.push_back(optarg);
+				break;
+			case 'b':
+				manifest = optarg;
+				break;
+			case 'j':
+				threads = atoi(optarg);
+				break;
+			case 'c':
+				if (optarg[0] == 'i') {
+					if (!parseCount(optarg + 1, checkpointEvery) || checkpointEvery == 0) {
+						printUsage(argv[0]);
+					}
+				} else if (optarg[0] == 'p') {
+					char *end;
+					checkpointPC = strtoull(optarg + 1, &end, 16);
+					if (end == optarg + 1 || *end != '\0' || checkpointPC > 0xFFFFFFFFull) {
+						printUsage(argv[0]);
+					}
+				} else {
+					printUsage(argv[0]);
+				}
+				break;
+			case 'o':
+				checkpointPrefix = optarg;
+				break;
+			case 'r':
+				restoreFrom = optarg;
+				break;
+			case 'p':
+				foldedStacks = optarg;
+				break;
+			case 't':
+				traceSpec = optarg;
+				break;
+			case 'm':
+				cacheSpec = optarg;
+				break;
+			case 'l':
+				pipelineSpec = optarg;
+				break;
+			case 'a':
+				localitySpec = optarg;
+				break;
+			case 'v':
+				phaseSpec = optarg;
+				break;
+			case 'f':
+				variantsPath = optarg;
+				break;
+			case 'n':
+				harts = atoi(optarg);
+				if (harts == 0) {
+					printUsage(argv[0]);
+				}
+				break;
+			case 'q':
+				quantum = strtoull(optarg, nullptr, 10);
+				break;
+			case 'P':
+				parallel = true;
+				break;
+			case 'd':
+				if (!parseEngine(optarg, referenceEngine)) {
+					printUsage(argv[0]);
+				}
+				cosim = true;
+				break;
+			case 'i':
+				cosimInterval = strtoull(optarg, nullptr, 10);
+				break;
+			default:
+				printUsage(argv[0]);
+		}
+	}
+
+	// batch mode runs many independent programs and exits
+	if (manifest) {
+		BatchRunner batch(engine, threads);
+		if (!batch.readManifest(manifest)) {
+			cout<<"error opening file\n";
+			return 0;
+		}
+		// report a bad map once here rather than as every program's load error
+		Memory scratch;
+		if (!mapFiles(mapSpecs, scratch)) {
+			return 0;
+		}
+		batch.setMaps(mapSpecs);
+		batch.run(cout);
+		return 0;
+	}
 
 	// check for command line argument
-	if (argc < 2) {
+	if (optind >= argc && !restoreFrom) {
 		return -1;
 	}
 
-	// open and read instruction file
-	ifstream infile(argv[1]);
-	if (!(infile.is_open() && infile.good())) {
-		cout<<"error opening file\n";
-		return 0; 
-	}
-	
-	// load instructions into memory as bytes
-	string line; 
-	int i = 0;
-	while (infile >> line) {
-		stringstream line2(line);
-		int x; 
-		line2 >> hex >> x;
-		instMem[i] = x;
-		i++;
+	// several harts on one shared memory
+	if (harts) {
+		if (optind >= argc) {
+			printUsage(argv[0]);
+		}
+		MultiHart multiHart(harts, engine);
+		if (!multiHart.load(argv[optind])) {
+			cout<<"error opening file\n";
+			return 0;
+		}
+		if (!mapFiles(mapSpecs, multiHart.getMemory())) {
+			return 0;
+		}
+		multiHart.setQuantum(quantum);
+		multiHart.run(parallel ? MultiHart::SCHEDULE_PARALLEL : MultiHart::SCHEDULE_ROUND_ROBIN);
+		for (unsigned i = 0; i < multiHart.size(); i++) {
+			CPU &hart = multiHart.getHart(i);
+			cout << "(" << hart.readRegister(10) << "," << hart.readRegister(11) << ")" << endl;
+		}
+		if (printStats) {
+			multiHart.printStats(cerr);
+		}
+		return 0;
 	}
-	int maxPC= i; 
 
-	// create cpu instance and initialize simulation variables
+	// lockstep run of two engines from the same starting state
+	if (cosim) {
+		const char *path = restoreFrom ? nullptr : argv[optind];
+		CoSimulator::Setup setup = [&](CPU &cpu, Program &program, uint64_t &instructions) {
+			if (restoreFrom) {
+				if (!Checkpoint::restore(restoreFrom, cpu, program, instructions)) {
+					return false;
+				}
+			} else {
+				instructions = 0;
+				if (!Loader::load(path, cpu.getMemory(), program)) {
+					return false;
+				}
+				cpu.setPC(program.entry);
+			}
+			return mapFiles(mapSpecs, cpu.getMemory());
+		};
+		CoSimulator cosimulator(referenceEngine, engine, setup);
+		cosimulator.setInterval(cosimInterval);
+		cosimulator.setReproducer(checkpointPrefix + ".diverge.ckpt", restoreFrom ? restoreFrom : "");
+		if (!cosimulator.run(cerr)) {
+			return 1;
+		}
+		CPU &reference = cosimulator.getReference();
+		cout << "(" << reference.readRegister(10) << "," << reference.readRegister(11) << ")" << endl;
+		return 0;
+	}
 
+	// create cpu instance and load the program, or a saved state, into its memory
 	CPU myCPU = CPU();
-	
-	int a0 =0;
-	int a1 =0;  
-
-	bool done = true;
-	// main cpu simulation loop - each iteration represents one clock cycle
-	while (done) {
-		myCPU.updateCurrentFromNext(); // update state at start of cycle
-
-		// fetch, decode, and execute instruction
-		uint32_t currentInstruction = myCPU.fetch(instMem);
-		InstructionParts parts = myCPU.decode(currentInstruction);
-		
-		if (myCPU.execute(parts)) {
-			// execution successful
-		} else {
-			done = false; // stop execution on failure
-		}
-		
-		// check if pc exceeds program bounds
-		if (myCPU.readPC() > maxPC)
-			break;
+	Program program;
+	Simulator simulator(myCPU, engine);
+	string parent;
+	Profiler profiler;
+	if (foldedStacks) {
+		simulator.setProfiler(&profiler);
+	}
+	unique_ptr<TraceSink> traceSink;
+	if (traceSpec) {
+		traceSink = TraceSink::create(traceSpec);
+		if (!traceSink) {
+			cerr << "error opening trace " << traceSpec << endl;
+			return 0;
+		}
+		myCPU.setTraceSink(traceSink.get());
+	}
+	unique_ptr<CacheHierarchy> caches;
+	if (cacheSpec) {
+		string error;
+		caches = CacheHierarchy::create(cacheSpec, error);
+		if (!caches) {
+			cerr << error << endl;
+			printUsage(argv[0]);
+		}
+		myCPU.setCaches(caches.get());
+	}
+	unique_ptr<PipelineModel> pipeline;
+	if (pipelineSpec) {
+		string error;
+		pipeline = PipelineModel::create(pipelineSpec, error);
+		if (!pipeline) {
+			cerr << error << endl;
+			printUsage(argv[0]);
+		}
+		pipeline->setCaches(caches.get());
+		myCPU.setPipeline(pipeline.get());
+	}
+	unique_ptr<LocalityAnalyzer> locality;
+	if (localitySpec) {
+		string error;
+		locality = LocalityAnalyzer::create(localitySpec, error);
+		if (!locality) {
+			cerr << error << endl;
+			printUsage(argv[0]);
+		}
+		myCPU.setLocality(locality.get());
+	}
+	unique_ptr<PhaseProfiler> phases;
+	if (phaseSpec) {
+		string error;
+		phases = PhaseProfiler::create(phaseSpec, error);
+		if (!phases) {
+			cerr << error << endl;
+			printUsage(argv[0]);
+		}
+		myCPU.setPhases(phases.get());
+	}
+	if (restoreFrom) {
+		uint64_t instructions;
+		if (!Checkpoint::restore(restoreFrom, myCPU, program, instructions)) {
+			cout<<"error opening file\n";
+			return 0;
+		}
+		simulator.setRetired(instructions);
+		parent = restoreFrom;
+	} else {
+		if (!Loader::load(argv[optind], myCPU.getMemory(), program)) {
+			cout<<"error opening file\n";
+			return 0; 
+		}
+		myCPU.setPC(program.entry);
+	}
+	if (!mapFiles(mapSpecs, myCPU.getMemory())) {
+		return 0;
+	}
 
-		// read final register values for output
-		a0 = myCPU.readRegister(10); // read register a0 (x10)
-		a1 = myCPU.readRegister(11); // read register a1 (x11)
+	// run the shared prefix once, up to the -c stop if there is one, then
+	// every variant from its own copy-on-write fork of where it stopped
+	if (variantsPath) {
+		ForkRunner forkRunner(engine, threads);
+		string error;
+		if (!forkRunner.readVariants(variantsPath, error)) {
+			cerr << error << endl;
+			return 0;
+		}
+		if (checkpointEvery || checkpointPC != Simulator::NO_STOP) {
+			uint64_t stopAt = checkpointEvery ? simulator.getRetired() + checkpointEvery : Simulator::NO_STOP;
+			simulator.setStop(stopAt, checkpointPC);
+			simulator.run(program);
+		}
+		forkRunner.run(myCPU, program, simulator.getRetired(), cout);
+		return 0;
 	}
+
+	// run until the program ends or hits an invalid instruction, pausing to
+	// write a checkpoint at each stop. every checkpoint after the first only
+	// holds the pages written since the one before it, apart from a full one
+	// every Checkpoint::MAX_CHAIN
+	int checkpoints = 0;
+	while (true) {
+		uint64_t stopAt = checkpointEvery ? simulator.getRetired() + checkpointEvery : Simulator::NO_STOP;
+		simulator.setStop(stopAt, checkpointPC);
+		simulator.run(program);
+		if (!simulator.stoppedEarly()) {
+			break;
+		}
+		string path = checkpointPrefix + "." + to_string(++checkpoints) + ".ckpt";
+		if (!Checkpoint::save(path, myCPU, program, simulator.getRetired(), parent)) {
+			cerr << "error writing checkpoint " << path << endl;
+			return 0;
+		}
+		parent = path;
+		if (checkpointPC != Simulator::NO_STOP && simulator.getRetired() != stopAt) {
+			checkpointPC = Simulator::NO_STOP; // a pc checkpoint is only taken once
+		}
+	}
+
+	// read final register values for output
+	int a0 = myCPU.readRegister(10); // read register a0 (x10)
+	int a1 = myCPU.readRegister(11); // read register a1 (x11)
+
 	// print final results in required format
 	cout << "(" << a0 << "," << a1 << ")" << endl;
+
+	if (printStats) {
+		simulator.printStats(cerr);
+	}
+	if (foldedStacks) {
+		profiler.printReport(cerr);
+		if (!profiler.writeFoldedStacks(foldedStacks)) {
+			cerr << "error writing " << foldedStacks << endl;
+		}
+	}
+	if (caches) {
+		caches->printStats(cerr);
+	}
+	if (pipeline) {
+		pipeline->printStats(cerr);
+	}
+	if (locality) {
+		locality->printStats(cerr);
+	}
+	if (phases && !phases->finish(cerr)) {
+		cerr << "error writing simulation points" << endl;
+	}
+	if (traceSink) {
+		myCPU.setTraceSink(nullptr);
+		if (!traceSink->finish()) {
+			cerr << "error writing trace " << traceSpec << endl;
+		}
+	}
 	
 	return 0;
-}
\ No newline at end of file
+}
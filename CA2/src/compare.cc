@@ -0,0 +1,234 @@
+// compare.cc
+// This file contains a driver that runs several branch predictors side by
+// side.  Each trace is decoded once and handed out in batches small enough
+// to stay in the cache: every predictor runs through a batch before the
+// next one is needed, so comparing N predictors costs one decode instead of
+// N.  With -j, the predictors are split over that many threads, which run
+// one batch while the main thread reads the next.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "branch.h"
+#include "trace.h"
+#include "predictor.h"
+#include "my_predictor.h"
+#include "predictors.h"
+
+// traces per batch; 4096 of them take 80 KB
+
+#define BATCH	4096
+
+// a predictor being compared and its mispredictions on the current trace
+
+struct contender {
+	std::string name;
+	branch_predictor *p;
+	long long int dmiss, tmiss;
+};
+
+// run a predictor over a batch, counting as predict.cc does
+
+static void run_batch (contender & c, const trace *batch, int n) {
+	for (int i=0; i<n; i++) {
+		const trace & t = batch[i];
+
+		// each predictor gets its own copy in case it changes it
+
+		branch_info bi = t.bi;
+		branch_update *u = c.p->predict (bi);
+		if (t.bi.br_flags & BR_CONDITIONAL) {
+			c.dmiss += u->direction_prediction () != t.taken;
+			c.tmiss += u->target_prediction () != t.target;
+		}
+		c.p->update (u, t.taken, t.target);
+	}
+}
+
+// threads that each run a fixed share of the predictors over a batch
+
+class workers {
+public:
+	workers (std::vector<contender> & all, int n_threads) :
+		all(all), batch(NULL), n(0), round(0), busy(0), quitting(false) {
+		for (int i=0; i<n_threads; i++)
+			threads.push_back (std::thread (&workers::work, this, i));
+	}
+
+	~workers (void) {
+		{
+			std::lock_guard<std::mutex> guard (lock);
+			quitting = true;
+			changed.notify_all ();
+		}
+		for (size_t i=0; i<threads.size (); i++) threads[i].join ();
+	}
+
+	// start every thread on a batch
+
+	void start (const trace *b, int count) {
+		std::lock_guard<std::mutex> guard (lock);
+		batch = b;
+		n = count;
+		busy = threads.size ();
+		round++;
+		changed.notify_all ();
+	}
+
+	// wait until they have all finished it
+
+	void wait (void) {
+		std::unique_lock<std::mutex> guard (lock);
+		changed.wait (guard, [this] { return busy == 0; });
+	}
+
+private:
+	void work (int id) {
+		unsigned long long seen = 0;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> guard (lock);
+				changed.wait (guard, [&] { return round != seen || quitting; });
+				if (quitting) return;
+				seen = round;
+			}
+			for (size_t i=id; i<all.size (); i+=threads.size ())
+				run_batch (all[i], batch, n);
+			std::lock_guard<std::mutex> guard (lock);
+			if (--busy == 0) changed.notify_all ();
+		}
+	}
+
+	std::vector<contender> & all;
+	std::vector<std::thread> threads;
+	std::mutex lock;
+	std::condition_variable changed;
+	const trace *batch;
+	int n;
+	unsigned long long round;	// bumped for every batch
+	int busy;			// threads still working on this round
+	bool quitting;
+};
+
+// read up to BATCH traces; fewer means the end of the trace file
+
+static int read_batch (trace *batch) {
+	int n = 0;
+	while (n < BATCH) {
+		trace *t = read_trace ();
+		if (!t) break;
+		batch[n++] = *t;
+	}
+	return n;
+}
+
+static void usage (char *name) {
+	fprintf (stderr, "Usage: %s [-j threads] [-p predictor,...] <filename> ...\n", name);
+	fprintf (stderr, "predictors are my, gshare[:bits], bimodal[:bits] and taken;\n");
+	fprintf (stderr, "the default is my,gshare,bimodal\n");
+	fprintf (stderr, "set CA2_TRACE_CACHE to a directory to cache decoded traces there\n");
+	exit (1);
+}
+
+int main (int argc, char *argv[]) {
+	int n_threads = 1;
+	std::string names = "my,gshare,bimodal";
+	int opt;
+	while ((opt = getopt (argc, argv, "j:p:")) != -1) {
+		switch (opt) {
+		case 'j': n_threads = atoi (optarg); break;
+		case 'p': names = optarg; break;
+		default: usage (argv[0]);
+		}
+	}
+	if (optind >= argc || n_threads < 1) usage (argv[0]);
+
+	// check the predictor names before reading any traces
+
+	std::vector<contender> all;
+	size_t start = 0;
+	while (start <= names.size ()) {
+		size_t comma = names.find (',', start);
+		contender c;
+		c.name = names.substr (start, comma - start);
+		c.p = make_predictor (c.name);
+		if (!c.p) {
+			fprintf (stderr, "unknown predictor %s\n", c.name.c_str ());
+			usage (argv[0]);
+		}
+		delete c.p;
+		c.p = NULL;
+		all.push_back (c);
+		start = comma == std::string::npos ? names.size () + 1 : comma + 1;
+	}
+
+	// the main thread reads one batch while the workers run the other
+
+	workers *pool = n_threads > 1 ? new workers (all, n_threads) : NULL;
+	std::vector<trace> batches[2];
+	batches[0].resize (BATCH);
+	batches[1].resize (BATCH);
+	std::vector<std::vector<double> > mpki;
+
+	printf ("%-40s", "trace");
+	for (size_t i=0; i<all.size (); i++) printf (" %12s", all[i].name.c_str ());
+	printf ("\n");
+	for (int f=optind; f<argc; f++) {
+
+		// every trace starts with fresh predictors, as with predict
+
+		for (size_t i=0; i<all.size (); i++) {
+			all[i].p = make_predictor (all[i].name);
+			all[i].dmiss = all[i].tmiss = 0;
+		}
+		init_trace (argv[f]);
+		int cur = 0;
+		int n = read_batch (&batches[cur][0]);
+		while (n > 0) {
+			int next;
+			if (pool) {
+				pool->start (&batches[cur][0], n);
+				next = read_batch (&batches[cur^1][0]);
+				pool->wait ();
+			} else {
+				for (size_t i=0; i<all.size (); i++) run_batch (all[i], &batches[cur][0], n);
+				next = read_batch (&batches[cur^1][0]);
+			}
+			cur ^= 1;
+			n = next;
+		}
+		end_trace ();
+
+		// each trace represents exactly 100 million instructions
+
+		std::vector<double> row;
+		printf ("%-40s", argv[f]);
+		for (size_t i=0; i<all.size (); i++) {
+			row.push_back (1000.0 * (all[i].dmiss / 1e8));
+			printf (" %12.3f", row.back ());
+			delete all[i].p;
+			all[i].p = NULL;
+		}
+		printf ("\n");
+		fflush (stdout);
+		mpki.push_back (row);
+	}
+	if (mpki.size () > 1) {
+		printf ("%-40s", "average");
+		for (size_t i=0; i<all.size (); i++) {
+			double sum = 0;
+			for (size_t j=0; j<mpki.size (); j++) sum += mpki[j][i];
+			printf (" %12.3f", sum / mpki.size ());
+		}
+		printf ("\n");
+	}
+	delete pool;
+	exit (0);
+}
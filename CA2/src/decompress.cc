@@ -0,0 +1,233 @@
+// decompress.cc
+// This file contains the in-process trace decompressor.  gzip goes through
+// zlib's gzread, which also reads concatenated members; bzip2 and zstd are
+// decompressed a buffer of input at a time so that concatenated streams
+// work too, as they do with bzip2 -dc and zstd -dc.
+
+#include <string.h>
+
+#include "decompress.h"
+
+#define GZIP_MAGIC	"\037\213"
+#define BZIP2_MAGIC	"BZh"
+#define ZSTD_MAGIC	"\050\265\057\375"
+
+decompressor::decompressor (void) {
+	for (int i=0; i<N_CHUNKS; i++) {
+		chunks[i].data = new unsigned char[CHUNK_SIZE];
+		chunks[i].size = 0;
+	}
+	in = new unsigned char[IN_SIZE];
+	fp = NULL;
+	gz = NULL;
+#ifdef HAVE_ZSTD
+	zs = NULL;
+#endif
+	memset (&bz, 0, sizeof (bz));
+	fmt = PLAIN;
+}
+
+decompressor::~decompressor (void) {
+	close ();
+	for (int i=0; i<N_CHUNKS; i++) delete[] chunks[i].data;
+	delete[] in;
+}
+
+// figure out the compression method from the magic number and start the
+// thread that decompresses into the ring
+
+bool decompressor::open (const char *fname) {
+	close ();
+	error.clear ();
+	fp = fopen (fname, "rb");
+	if (!fp) return false;
+	unsigned char magic[4] = { 0, 0, 0, 0 };
+	size_t n = fread (magic, 1, 4, fp);
+	rewind (fp);
+	if (n >= 2 && memcmp (magic, GZIP_MAGIC, 2) == 0) {
+		fmt = GZIP;
+		fclose (fp);
+		fp = NULL;
+		gz = gzopen (fname, "rb");
+		if (!gz) return false;
+		gzbuffer (gz, IN_SIZE);
+	} else if (n >= 3 && memcmp (magic, BZIP2_MAGIC, 3) == 0) {
+		fmt = BZIP2;
+		memset (&bz, 0, sizeof (bz));
+		BZ2_bzDecompressInit (&bz, 0, 0);
+	} else if (n == 4 && memcmp (magic, ZSTD_MAGIC, 4) == 0) {
+		fmt = ZSTD;
+#ifdef HAVE_ZSTD
+		zs = ZSTD_createDStream ();
+		ZSTD_initDStream (zs);
+#else
+		error = "zstd support is not built in";
+		return false;
+#endif
+	} else
+		fmt = PLAIN;
+	in_pos = in_size = 0;
+	stream_end = false;
+	tail = ready = 0;
+	holding = false;
+	stopping = false;
+	producer = std::thread (&decompressor::produce, this);
+	return true;
+}
+
+// fill free chunks until the end of the file, or until close
+
+void decompressor::produce (void) {
+	for (;;) {
+		unsigned int index;
+		{
+			std::unique_lock<std::mutex> guard (lock);
+			changed.wait (guard, [this] { return ready < N_CHUNKS || stopping; });
+			if (stopping) return;
+			index = (tail + ready) % N_CHUNKS;
+		}
+
+		// decompress without the lock; the consumer never looks at
+		// a chunk that isn't ready
+
+		unsigned int size = fill (chunks[index].data, CHUNK_SIZE);
+		std::lock_guard<std::mutex> guard (lock);
+		chunks[index].size = size;
+		ready++;
+		changed.notify_all ();
+
+		// an empty chunk marks the end of the file
+
+		if (size == 0) return;
+	}
+}
+
+// read more compressed input; false at the end of the file
+
+bool decompressor::refill_input (void) {
+	in_pos = 0;
+	in_size = fread (in, 1, IN_SIZE, fp);
+	return in_size > 0;
+}
+
+// decompress up to size bytes into data.  anything short of size means
+// the end of the file
+
+unsigned int decompressor::fill (unsigned char *data, unsigned int size) {
+	unsigned int got = 0;
+	switch (fmt) {
+	case PLAIN:
+		while (got < size) {
+			size_t n = fread (data + got, 1, size - got, fp);
+			if (n == 0) break;
+			got += n;
+		}
+		return got;
+	case GZIP:
+		while (got < size) {
+			int n = gzread (gz, data + got, size - got);
+			int err;
+			gzerror (gz, &err);
+			if (err == Z_BUF_ERROR) return fail ("unexpected end of file");
+			if (n < 0 || (err != Z_OK && err != Z_STREAM_END)) return fail ("corrupt gzip data");
+			if (n == 0) break;
+			got += n;
+		}
+		return got;
+	case BZIP2:
+		while (got < size) {
+			if (in_pos == in_size && !refill_input ()) break;
+			if (stream_end) {
+				// another stream follows the one that ended
+
+				BZ2_bzDecompressEnd (&bz);
+				BZ2_bzDecompressInit (&bz, 0, 0);
+				stream_end = false;
+			}
+			bz.next_in = (char *) in + in_pos;
+			bz.avail_in = in_size - in_pos;
+			bz.next_out = (char *) data + got;
+			bz.avail_out = size - got;
+			int ret = BZ2_bzDecompress (&bz);
+			if (ret != BZ_OK && ret != BZ_STREAM_END) return fail ("corrupt bzip2 data");
+			in_pos = in_size - bz.avail_in;
+			got = size - bz.avail_out;
+			stream_end = ret == BZ_STREAM_END;
+		}
+		break;
+	case ZSTD:
+#ifdef HAVE_ZSTD
+		while (got < size) {
+			if (in_pos == in_size && !refill_input ()) break;
+			ZSTD_inBuffer input = { in, in_size, in_pos };
+			ZSTD_outBuffer output = { data, size, got };
+			size_t ret = ZSTD_decompressStream (zs, &output, &input);
+			if (ZSTD_isError (ret)) return fail (ZSTD_getErrorName (ret));
+			in_pos = input.pos;
+			got = output.pos;
+			stream_end = ret == 0;
+		}
+#endif
+		break;
+	}
+
+	// input ran out in the middle of a stream
+
+	if (got < size && !stream_end) return fail ("unexpected end of file");
+	return got;
+}
+
+// note why decompression stopped and end the file here
+
+unsigned int decompressor::fail (const char *why) {
+	error = why;
+	return 0;
+}
+
+// the consumer is done with the chunk it has; wait for the next one.  the
+// empty chunk at the end of the file is kept, so reading past the end
+// keeps returning 0
+
+unsigned int decompressor::next_chunk (unsigned char *&data) {
+	std::unique_lock<std::mutex> guard (lock);
+	if (holding) {
+		if (chunks[tail].size == 0) {
+			data = chunks[tail].data;
+			return 0;
+		}
+		tail = (tail + 1) % N_CHUNKS;
+		ready--;
+		holding = false;
+		changed.notify_all ();
+	}
+	changed.wait (guard, [this] { return ready > 0; });
+	holding = true;
+	data = chunks[tail].data;
+	return chunks[tail].size;
+}
+
+void decompressor::close (void) {
+	if (producer.joinable ()) {
+		{
+			std::lock_guard<std::mutex> guard (lock);
+			stopping = true;
+			changed.notify_all ();
+		}
+		producer.join ();
+	}
+	if (fmt == BZIP2 && fp) BZ2_bzDecompressEnd (&bz);
+#ifdef HAVE_ZSTD
+	if (zs) {
+		ZSTD_freeDStream (zs);
+		zs = NULL;
+	}
+#endif
+	if (gz) {
+		gzclose (gz);
+		gz = NULL;
+	}
+	if (fp) {
+		fclose (fp);
+		fp = NULL;
+	}
+}
@@ -0,0 +1,87 @@
+// decompress.h
+// This file declares a reader that decompresses a trace file in-process
+// on a thread of its own.  The thread fills a small ring of large chunks
+// ahead of the consumer, so decompression overlaps with prediction.
+
+#include <stdio.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <zlib.h>
+#include <bzlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+class decompressor {
+public:
+	decompressor (void);
+	~decompressor (void);
+
+	// open a gzip, bzip2, zstd or plain file and start decompressing it.
+	// false if the file can't be opened; failure or else errno says why
+
+	bool open (const char *fname);
+
+	// hand back the chunk returned by the last call and get the next one.
+	// returns its size, or 0 at the end of the file or on an error
+
+	unsigned int next_chunk (unsigned char *&data);
+
+	// why the file couldn't be opened or was cut short; empty if it
+	// wasn't
+
+	const std::string & failure (void) { return error; }
+
+	// stop the thread and close the file; open may be called again
+
+	void close (void);
+
+private:
+	// 4 chunks of 1 MB: the consumer works on one while the thread
+	// fills the rest
+
+#define N_CHUNKS	4
+#define CHUNK_SIZE	(1<<20)
+#define IN_SIZE		(1<<16)
+
+	enum format { PLAIN, GZIP, BZIP2, ZSTD };
+
+	struct chunk {
+		unsigned char *data;
+		unsigned int size;
+	};
+
+	void produce (void);
+	unsigned int fill (unsigned char *data, unsigned int size);
+	unsigned int fail (const char *why);
+	bool refill_input (void);
+
+	format fmt;
+	FILE *fp;
+	gzFile gz;
+	bz_stream bz;
+#ifdef HAVE_ZSTD
+	ZSTD_DStream *zs;
+#endif
+	bool stream_end;	// a bzip2 or zstd stream has ended; another may follow
+	std::string error;	// why the thread stopped early
+
+	// compressed input for bzip2 and zstd
+
+	unsigned char *in;
+	unsigned int in_pos, in_size;
+
+	// the ring: ready chunks start at tail, the first being the one the
+	// consumer holds once it has taken it
+
+	chunk chunks[N_CHUNKS];
+	unsigned int tail, ready;
+	bool holding;		// the consumer has the chunk at tail
+	bool stopping;		// close was called before the end of the file
+	std::mutex lock;
+	std::condition_variable changed;
+	std::thread producer;
+};
@@ -2,6 +2,12 @@
 // Advanced Multi-History Hybrid Predictor
 // Inspired by adaptive history length selection for different branch patterns
 // Uses multiple specialized predictors with different history lengths
+//
+// The history lengths and table sizes come from a configuration class.
+// fixed_config makes them compile time constants, so my_predictor folds
+// them into its shifts and masks as it did when they were #defines;
+// runtime_config keeps them in the predictor, so the sweep program can
+// try many configurations without a rebuild.
 
 class my_update : public branch_update {
 public:
@@ -14,22 +20,65 @@ public:
 	int predictor_used;
 };
 
-class my_predictor : public branch_predictor {
-public:
-// Multiple history lengths - maximizing capacity
-#define HISTORY_LENGTH_LONG   18    // Long correlations
-#define HISTORY_LENGTH_MEDIUM 11    // Medium-range correlations
-#define HISTORY_LENGTH_SHORT  6     // Short-range correlations
-#define HISTORY_LENGTH_MICRO  3     // Very short patterns
+#include <vector>
+
+template <unsigned int HISTORY_LENGTH_LONG,	// Long correlations
+	  unsigned int HISTORY_LENGTH_MEDIUM,	// Medium-range correlations
+	  unsigned int HISTORY_LENGTH_SHORT,	// Short-range correlations
+	  unsigned int HISTORY_LENGTH_MICRO,	// Very short patterns
+	  unsigned int TABLE_BITS_0,		// long history table
+	  unsigned int TABLE_BITS_1,		// medium history table
+	  unsigned int TABLE_BITS_2,		// short history table
+	  unsigned int TABLE_BITS_3,		// micro history table
+	  unsigned int LOCAL_HIST_BITS,		// local history entries
+	  unsigned int LOCAL_PRED_BITS,		// local prediction entries
+	  unsigned int CHOICE_BITS,		// meta-predictor entries
+	  unsigned int LOCAL_HISTORY_LENGTH>	// bits of history per local entry
+struct fixed_config {
+	static constexpr unsigned int history_length_long = HISTORY_LENGTH_LONG;
+	static constexpr unsigned int history_length_medium = HISTORY_LENGTH_MEDIUM;
+	static constexpr unsigned int history_length_short = HISTORY_LENGTH_SHORT;
+	static constexpr unsigned int history_length_micro = HISTORY_LENGTH_MICRO;
+	static constexpr unsigned int table_bits_0 = TABLE_BITS_0;
+	static constexpr unsigned int table_bits_1 = TABLE_BITS_1;
+	static constexpr unsigned int table_bits_2 = TABLE_BITS_2;
+	static constexpr unsigned int table_bits_3 = TABLE_BITS_3;
+	static constexpr unsigned int local_hist_bits = LOCAL_HIST_BITS;
+	static constexpr unsigned int local_pred_bits = LOCAL_PRED_BITS;
+	static constexpr unsigned int choice_bits = CHOICE_BITS;
+	static constexpr unsigned int local_history_length = LOCAL_HISTORY_LENGTH;
+};
+
+// the same fields, set at run time
+
+struct runtime_config {
+	unsigned int history_length_long, history_length_medium;
+	unsigned int history_length_short, history_length_micro;
+	unsigned int table_bits_0, table_bits_1, table_bits_2, table_bits_3;
+	unsigned int local_hist_bits, local_pred_bits, choice_bits;
+	unsigned int local_history_length;
+};
 
-#define TABLE_BITS_0  22    // 4M entries for long history
-#define TABLE_BITS_1  21    // 2M entries for medium history
-#define TABLE_BITS_2  20    // 1M entries for short history
-#define TABLE_BITS_3  19    // 512K entries for micro history
+// bits of predictor state a configuration needs in hardware: 3-bit
+// counters in every table but the local histories, plus the global
+// history registers
 
-#define LOCAL_HIST_BITS  14  // 16K local history entries
-#define LOCAL_PRED_BITS  18  // 256K local prediction entries
-#define CHOICE_BITS      19  // 512K meta-predictor entries
+template <class config>
+unsigned long long storage_bits (const config & c) {
+	unsigned long long counters =
+		  (1ull << c.table_bits_0) + (1ull << c.table_bits_1)
+		+ (1ull << c.table_bits_2) + (1ull << c.table_bits_3)
+		+ (1ull << c.local_pred_bits) + (1ull << c.choice_bits);
+	return 3 * counters
+		+ (1ull << c.local_hist_bits) * c.local_history_length
+		+ c.history_length_long + c.history_length_medium
+		+ c.history_length_short + c.history_length_micro;
+}
+
+template <class config>
+class hybrid_predictor : public branch_predictor {
+public:
+	config cfg;
 
 	my_update u;
 	branch_info bi;
@@ -41,27 +90,27 @@ public:
 	unsigned int history_micro;
 	
 	// Prediction tables with different history lengths (3-bit counters)
-	unsigned char tab0[1<<TABLE_BITS_0];  // Long history table
-	unsigned char tab1[1<<TABLE_BITS_1];  // Medium history table
-	unsigned char tab2[1<<TABLE_BITS_2];  // Short history table
-	unsigned char tab3[1<<TABLE_BITS_3];  // Micro history table
+	std::vector<unsigned char> tab0;  // Long history table
+	std::vector<unsigned char> tab1;  // Medium history table
+	std::vector<unsigned char> tab2;  // Short history table
+	std::vector<unsigned char> tab3;  // Micro history table
 	
 	// Local predictor components
-	unsigned short local_hist_tab[1<<LOCAL_HIST_BITS];
-	unsigned char local_pred_tab[1<<LOCAL_PRED_BITS];
+	std::vector<unsigned short> local_hist_tab;
+	std::vector<unsigned char> local_pred_tab;
 	
 	// Meta-predictor for selecting best predictor
-	unsigned char choice_tab[1<<CHOICE_BITS];
-
-	my_predictor (void) : history_long(0), history_medium(0), history_short(0), history_micro(0) { 
-		memset (tab0, 2, sizeof (tab0));  // Initialize to weakly not-taken
-		memset (tab1, 2, sizeof (tab1));
-		memset (tab2, 2, sizeof (tab2));
-		memset (tab3, 2, sizeof (tab3));
-		memset (local_hist_tab, 0, sizeof (local_hist_tab));
-		memset (local_pred_tab, 2, sizeof (local_pred_tab));
-		memset (choice_tab, 2, sizeof (choice_tab));  // Start neutral
-	}
+	std::vector<unsigned char> choice_tab;
+
+	hybrid_predictor (const config & c = config ()) : cfg(c),
+		history_long(0), history_medium(0), history_short(0), history_micro(0),
+		tab0(1<<cfg.table_bits_0, 2),  // Initialize to weakly not-taken
+		tab1(1<<cfg.table_bits_1, 2),
+		tab2(1<<cfg.table_bits_2, 2),
+		tab3(1<<cfg.table_bits_3, 2),
+		local_hist_tab(1<<cfg.local_hist_bits, 0),
+		local_pred_tab(1<<cfg.local_pred_bits, 2),
+		choice_tab(1<<cfg.choice_bits, 2) { }  // Start neutral
 
 
 	branch_update *predict (branch_info & b) {
@@ -72,29 +121,29 @@ public:
 			// Simple direct-mapped gshare-style indices
 			
 			// Predictor 0: Long history
-			u.index[0] = ((history_long << (TABLE_BITS_0 - HISTORY_LENGTH_LONG)) ^ pc) & ((1<<TABLE_BITS_0)-1);
+			u.index[0] = ((history_long << (cfg.table_bits_0 - cfg.history_length_long)) ^ pc) & ((1<<cfg.table_bits_0)-1);
 			u.pred[0] = (tab0[u.index[0]] >= 4);
 			
 			// Predictor 1: Medium history
-			u.index[1] = ((history_medium << (TABLE_BITS_1 - HISTORY_LENGTH_MEDIUM)) ^ pc) & ((1<<TABLE_BITS_1)-1);
+			u.index[1] = ((history_medium << (cfg.table_bits_1 - cfg.history_length_medium)) ^ pc) & ((1<<cfg.table_bits_1)-1);
 			u.pred[1] = (tab1[u.index[1]] >= 4);
 			
 			// Predictor 2: Short history
-			u.index[2] = ((history_short << (TABLE_BITS_2 - HISTORY_LENGTH_SHORT)) ^ pc) & ((1<<TABLE_BITS_2)-1);
+			u.index[2] = ((history_short << (cfg.table_bits_2 - cfg.history_length_short)) ^ pc) & ((1<<cfg.table_bits_2)-1);
 			u.pred[2] = (tab2[u.index[2]] >= 4);
 			
 			// Predictor 3: Micro history
-			u.index[3] = ((history_micro << (TABLE_BITS_3 - HISTORY_LENGTH_MICRO)) ^ pc) & ((1<<TABLE_BITS_3)-1);
+			u.index[3] = ((history_micro << (cfg.table_bits_3 - cfg.history_length_micro)) ^ pc) & ((1<<cfg.table_bits_3)-1);
 			u.pred[3] = (tab3[u.index[3]] >= 4);
 			
 			// Local predictor
-			u.local_history_index = pc & ((1<<LOCAL_HIST_BITS)-1);
+			u.local_history_index = pc & ((1<<cfg.local_hist_bits)-1);
 			unsigned int local_hist = local_hist_tab[u.local_history_index];
-			u.local_index = local_hist & ((1<<LOCAL_PRED_BITS)-1);
+			u.local_index = local_hist & ((1<<cfg.local_pred_bits)-1);
 			u.local_pred = (local_pred_tab[u.local_index] >= 4);
 			
 			// Meta-predictor
-			u.choice_index = (pc ^ history_long ^ (history_medium << 3)) & ((1<<CHOICE_BITS)-1);
+			u.choice_index = (pc ^ history_long ^ (history_medium << 3)) & ((1<<cfg.choice_bits)-1);
 			unsigned char choice_val = choice_tab[u.choice_index];
 			
 			// Simple selection logic
@@ -213,13 +262,20 @@ public:
 			
 			// Update local history for this branch
 			unsigned short *lh = &local_hist_tab[mu->local_history_index];
-			*lh = ((*lh << 1) | taken) & ((1<<12)-1);
+			*lh = ((*lh << 1) | taken) & ((1<<cfg.local_history_length)-1);
 			
 			// Update all global histories
-			history_long = ((history_long << 1) | taken) & ((1<<HISTORY_LENGTH_LONG)-1);
-			history_medium = ((history_medium << 1) | taken) & ((1<<HISTORY_LENGTH_MEDIUM)-1);
-			history_short = ((history_short << 1) | taken) & ((1<<HISTORY_LENGTH_SHORT)-1);
-			history_micro = ((history_micro << 1) | taken) & ((1<<HISTORY_LENGTH_MICRO)-1);
+			history_long = ((history_long << 1) | taken) & ((1<<cfg.history_length_long)-1);
+			history_medium = ((history_medium << 1) | taken) & ((1<<cfg.history_length_medium)-1);
+			history_short = ((history_short << 1) | taken) & ((1<<cfg.history_length_short)-1);
+			history_micro = ((history_micro << 1) | taken) & ((1<<cfg.history_length_micro)-1);
 		}
 	}
 };
+
+// the configuration the predictor was tuned with: 4M, 2M, 1M and 512K
+// entry global tables with 18, 11, 6 and 3 bits of history, 16K local
+// histories of 12 bits into 256K local counters, and a 512K entry choice
+// table
+
+typedef hybrid_predictor<fixed_config<18, 11, 6, 3, 22, 21, 20, 19, 14, 18, 19, 12> > my_predictor;
@@ -20,6 +20,7 @@ int main (int argc, char *argv[]) {
 
 	if (argc != 2) {
 		fprintf (stderr, "Usage: %s <filename>.gz\n", argv[0]);
+		fprintf (stderr, "set CA2_TRACE_CACHE to a directory to cache decoded traces there\n");
 		exit (1);
 	}
 
@@ -0,0 +1,92 @@
+// predictors.h
+// This file defines simple reference predictors to compare my_predictor
+// against, and make_predictor, which builds any of them by name.  The
+// gshare predictor is the example that came with the infrastructure,
+// with its table size as a parameter.
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+class table_update : public branch_update {
+public:
+	unsigned int index;
+};
+
+// a table of 2-bit counters indexed by the branch address xor the global
+// history; history_length 0 makes it bimodal
+
+class gshare_predictor : public branch_predictor {
+public:
+	table_update u;
+	branch_info bi;
+	unsigned int history;
+	unsigned int table_bits, history_length;
+	std::vector<unsigned char> tab;
+
+	gshare_predictor (unsigned int table_bits, unsigned int history_length) :
+		history(0), table_bits(table_bits), history_length(history_length),
+		tab(1<<table_bits, 0) { }
+
+	branch_update *predict (branch_info & b) {
+		bi = b;
+		if (b.br_flags & BR_CONDITIONAL) {
+			u.index =
+				  (history << (table_bits - history_length))
+				^ (b.address & ((1<<table_bits)-1));
+			u.direction_prediction (tab[u.index] >> 1);
+		} else {
+			u.direction_prediction (false);
+		}
+		u.target_prediction (0);
+		return &u;
+	}
+
+	void update (branch_update *u, bool taken, unsigned int target) {
+		if (bi.br_flags & BR_CONDITIONAL) {
+			unsigned char *c = &tab[((table_update*)u)->index];
+			if (taken) {
+				if (*c < 3) (*c)++;
+			} else {
+				if (*c > 0) (*c)--;
+			}
+			history <<= 1;
+			history |= taken;
+			history &= (1<<history_length)-1;
+		}
+	}
+};
+
+// always predict taken
+
+class taken_predictor : public branch_predictor {
+public:
+	branch_update u;
+
+	branch_update *predict (branch_info &) {
+		u.direction_prediction (true);
+		u.target_prediction (0);
+		return &u;
+	}
+};
+
+// build a predictor from a name: my, gshare[:bits], bimodal[:bits] or
+// taken.  gshare uses as many bits of history as it has index bits.
+// NULL for a name it doesn't know
+
+static branch_predictor *make_predictor (const std::string &name) {
+	size_t colon = name.find (':');
+	std::string kind = name.substr (0, colon);
+	unsigned int bits = 15;
+	if (colon != std::string::npos) {
+		char *end;
+		bits = strtoul (name.c_str () + colon + 1, &end, 10);
+		if (*end || end == name.c_str () + colon + 1 || bits < 1 || bits > 28) return NULL;
+	}
+	if (kind == "my" && colon == std::string::npos) return new my_predictor ();
+	if (kind == "gshare") return new gshare_predictor (bits, bits);
+	if (kind == "bimodal") return new gshare_predictor (bits, 0);
+	if (kind == "taken" && colon == std::string::npos) return new taken_predictor ();
+	return NULL;
+}
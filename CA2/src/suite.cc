@@ -0,0 +1,150 @@
+// suite.cc
+// This file contains a harness that evaluates a branch predictor on every
+// trace in a directory, like the run script, but in one process: each
+// trace gets its own trace_reader and predictor on a pool of threads, so
+// the whole suite takes about as long as its slowest trace.  Results are
+// JSON, one line per trace in sorted order and then a summary line.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "branch.h"
+#include "trace.h"
+#include "predictor.h"
+#include "my_predictor.h"
+#include "predictors.h"
+
+struct result {
+	std::string fname;
+	std::string error;	// empty if the trace was read
+	long long int branches, conditional, dmiss;
+	double mpki, seconds;
+};
+
+// run one trace through a fresh predictor, counting as predict.cc does
+
+static void evaluate (const std::string & name, result & r) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+	r.branches = r.conditional = r.dmiss = 0;
+	r.mpki = 0;
+	trace_reader reader;
+	if (!reader.open (r.fname.c_str ())) {
+		r.error = reader.error ();
+		return;
+	}
+	branch_predictor *p = make_predictor (name);
+	for (;;) {
+		trace *t = reader.read ();
+		if (!t) break;
+		branch_update *u = p->predict (t->bi);
+		r.branches++;
+		if (t->bi.br_flags & BR_CONDITIONAL) {
+			r.conditional++;
+			r.dmiss += u->direction_prediction () != t->taken;
+		}
+		p->update (u, t->taken, t->target);
+	}
+	r.error = reader.error ();
+	reader.close ();
+	delete p;
+
+	// each trace represents exactly 100 million instructions
+
+	r.mpki = 1000.0 * (r.dmiss / 1e8);
+	r.seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+}
+
+// print a string as a JSON string
+
+static void print_json_string (const std::string & s) {
+	putchar ('"');
+	for (size_t i=0; i<s.size (); i++) {
+		unsigned char c = s[i];
+		if (c == '"' || c == '\\') printf ("\\%c", c);
+		else if (c < 0x20) printf ("\\u%04x", c);
+		else putchar (c);
+	}
+	putchar ('"');
+}
+
+static void usage (char *name) {
+	fprintf (stderr, "Usage: %s [-j threads] [-p predictor] <trace-file-directory>\n", name);
+	fprintf (stderr, "the predictor is my (the default), gshare[:bits], bimodal[:bits] or taken;\n");
+	fprintf (stderr, "threads defaults to one per hardware thread\n");
+	fprintf (stderr, "set CA2_TRACE_CACHE to a directory to cache decoded traces there\n");
+	exit (1);
+}
+
+int main (int argc, char *argv[]) {
+	int n_threads = std::max (1u, std::thread::hardware_concurrency ());
+	std::string name = "my";
+	int opt;
+	while ((opt = getopt (argc, argv, "j:p:")) != -1) {
+		switch (opt) {
+		case 'j': n_threads = atoi (optarg); break;
+		case 'p': name = optarg; break;
+		default: usage (argv[0]);
+		}
+	}
+	if (optind + 1 != argc || n_threads < 1) usage (argv[0]);
+	branch_predictor *check = make_predictor (name);
+	if (!check) {
+		fprintf (stderr, "unknown predictor %s\n", name.c_str ());
+		usage (argv[0]);
+	}
+	delete check;
+
+	std::vector<std::string> traces;
+	find_traces (argv[optind], traces);
+	if (traces.empty ()) {
+		fprintf (stderr, "%s: no traces found\n", argv[optind]);
+		exit (1);
+	}
+	std::sort (traces.begin (), traces.end ());
+	std::vector<result> results (traces.size ());
+	for (size_t i=0; i<traces.size (); i++) results[i].fname = traces[i];
+
+	// each thread takes the next trace until there are none left
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+	std::atomic<size_t> next (0);
+	std::vector<std::thread> threads;
+	for (int i=0; i<n_threads && i<(int) traces.size (); i++)
+		threads.push_back (std::thread ([&] {
+			size_t j;
+			while ((j = next++) < traces.size ()) evaluate (name, results[j]);
+		}));
+	for (size_t i=0; i<threads.size (); i++) threads[i].join ();
+	double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+
+	double sum = 0;
+	int n = 0;
+	for (size_t i=0; i<results.size (); i++) {
+		result & r = results[i];
+		printf ("{\"trace\":");
+		print_json_string (r.fname);
+		if (!r.error.empty ()) {
+			printf (",\"status\":\"error\",\"error\":");
+			print_json_string (r.error);
+			printf ("}\n");
+			continue;
+		}
+		printf (",\"status\":\"ok\",\"branches\":%lld,\"conditional\":%lld,\"mispredictions\":%lld,"
+			"\"mpki\":%0.3f,\"seconds\":%0.3f}\n", r.branches, r.conditional, r.dmiss, r.mpki, r.seconds);
+		sum += r.mpki;
+		n++;
+	}
+	printf ("{\"predictor\":");
+	print_json_string (name);
+	printf (",\"traces\":%d,\"failed\":%d,\"average_mpki\":%0.3f,\"threads\":%d,\"seconds\":%0.3f}\n",
+		n, (int) results.size () - n, n ? sum / n : 0.0, (int) threads.size (), seconds);
+	exit (n == (int) results.size () ? 0 : 1);
+}
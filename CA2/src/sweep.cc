@@ -0,0 +1,324 @@
+// sweep.cc
+// This file contains a design-space sweep of my_predictor.  It takes the
+// cross product of a list of values for each configuration field, drops
+// configurations that don't fit a storage budget, runs every one that is
+// left over every trace on a pool of threads, and reports each
+// configuration's storage and average MPKI, marking the Pareto front: the
+// configurations that no smaller one beats.  Every trace is decoded
+// once, into the trace cache, before the sweep starts, and every run reads
+// the same mapped columns.  Without $CA2_TRACE_CACHE the cache is a
+// private temporary directory, emptied as soon as the columns are mapped.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "branch.h"
+#include "trace.h"
+#include "predictor.h"
+#include "my_predictor.h"
+
+// a configuration field, its name on the command line and the values to
+// try, by default those around my_predictor's
+
+struct dimension {
+	const char *name;
+	unsigned int runtime_config::*field;
+	std::vector<unsigned int> values;
+};
+
+static std::vector<dimension> dimensions = {
+	{ "long", &runtime_config::history_length_long, { 18 } },
+	{ "medium", &runtime_config::history_length_medium, { 11 } },
+	{ "short", &runtime_config::history_length_short, { 6 } },
+	{ "micro", &runtime_config::history_length_micro, { 3 } },
+	{ "t0", &runtime_config::table_bits_0, { 16, 19, 22 } },
+	{ "t1", &runtime_config::table_bits_1, { 15, 18, 21 } },
+	{ "t2", &runtime_config::table_bits_2, { 14, 17, 20 } },
+	{ "t3", &runtime_config::table_bits_3, { 13, 16, 19 } },
+	{ "lhist", &runtime_config::local_hist_bits, { 14 } },
+	{ "lpred", &runtime_config::local_pred_bits, { 18 } },
+	{ "choice", &runtime_config::choice_bits, { 19 } },
+	{ "llen", &runtime_config::local_history_length, { 12 } },
+};
+
+// the largest table a field may ask for, 2^MAX_BITS entries
+
+#define MAX_BITS	26
+
+struct point {
+	runtime_config cfg;
+	unsigned long long bytes;
+	std::vector<long long int> dmiss;	// per trace
+	double mpki;
+	bool pareto;
+};
+
+// a number with an optional k or m suffix
+
+static bool parse_size (const char *s, unsigned long long & value) {
+	char *end;
+	value = strtoull (s, &end, 10);
+	if (end == s) return false;
+	if (*end == 'k' || *end == 'K') {
+		value <<= 10;
+		end++;
+	} else if (*end == 'm' || *end == 'M') {
+		value <<= 20;
+		end++;
+	}
+	return *end == '\0';
+}
+
+// set a field's values from a list like 12,14-16
+
+static bool parse_dimension (const char *spec) {
+	const char *equals = strchr (spec, '=');
+	if (!equals) return false;
+	std::string name (spec, equals - spec);
+	for (size_t i=0; i<dimensions.size (); i++) {
+		if (name != dimensions[i].name) continue;
+		std::vector<unsigned int> values;
+		const char *p = equals + 1;
+		for (;;) {
+			char *end;
+			unsigned long low = strtoul (p, &end, 10), high = low;
+			if (end == p) return false;
+			if (*end == '-') {
+				p = end + 1;
+				high = strtoul (p, &end, 10);
+				if (end == p || high < low) return false;
+			}
+			if (high > MAX_BITS) return false;
+			for (unsigned long v=low; v<=high; v++) values.push_back (v);
+			if (*end == '\0') break;
+			if (*end != ',') return false;
+			p = end + 1;
+		}
+		dimensions[i].values = values;
+		return true;
+	}
+	return false;
+}
+
+// a configuration works if every history fits the index it is shifted
+// into and the local histories fit their 16-bit entries
+
+static bool valid (const runtime_config & c) {
+	return c.history_length_long <= c.table_bits_0
+	    && c.history_length_medium <= c.table_bits_1
+	    && c.history_length_short <= c.table_bits_2
+	    && c.history_length_micro <= c.table_bits_3
+	    && c.local_history_length <= 16;
+}
+
+// run one configuration over one trace, from its mapped columns if it
+// has them or else by decoding the file again
+
+static long long int evaluate (const runtime_config & cfg, const std::string & fname, const trace_columns *cols) {
+	trace_reader reader;
+	if (!cols && !reader.open (fname.c_str ())) {
+		fprintf (stderr, "%s: %s\n", fname.c_str (), reader.error ().c_str ());
+		exit (1);
+	}
+	hybrid_predictor<runtime_config> *p = new hybrid_predictor<runtime_config> (cfg);
+	long long int dmiss = 0;
+	trace column_trace;
+	for (unsigned long long i=0;; i++) {
+		trace *t = &column_trace;
+		if (!cols)
+			t = reader.read ();
+		else if (i < cols->count) {
+			t->bi.address = cols->address[i];
+			t->bi.opcode = cols->opcode[i];
+			t->bi.br_flags = cols->flags[i];
+			t->target = cols->target[i];
+			t->taken = cols->taken[i];
+		} else
+			t = NULL;
+		if (!t) break;
+		branch_update *u = p->predict (t->bi);
+		if (t->bi.br_flags & BR_CONDITIONAL)
+			dmiss += u->direction_prediction () != t->taken;
+		p->update (u, t->taken, t->target);
+	}
+	delete p;
+	return dmiss;
+}
+
+// a private directory to cache decoded traces in; empty if it can't be made
+
+static std::string private_cache (void) {
+	const char *tmp = getenv ("TMPDIR");
+	std::string dir = std::string (tmp && *tmp ? tmp : "/tmp") + "/ca2sweep.XXXXXX";
+	if (!mkdtemp (&dir[0])) return "";
+	return dir;
+}
+
+// remove the files in a private cache directory and the directory; the
+// traces already mapped from them stay readable
+
+static void remove_cache (const std::string & dir) {
+	DIR *d = opendir (dir.c_str ());
+	if (d) {
+		struct dirent *e;
+		while ((e = readdir (d)) != NULL)
+			if (strcmp (e->d_name, ".") && strcmp (e->d_name, ".."))
+				unlink ((dir + "/" + e->d_name).c_str ());
+		closedir (d);
+	}
+	rmdir (dir.c_str ());
+}
+
+static void usage (char *name) {
+	fprintf (stderr, "Usage: %s [-j threads] [-b bytes] [-g field=values] ... <trace file or directory> ...\n", name);
+	fprintf (stderr, "  -b bytes\tskip configurations needing more storage; k and m suffixes work\n");
+	fprintf (stderr, "  -g field=values\tvalues to try for a field, like t0=16,18-20. fields and\n");
+	fprintf (stderr, "\t\tdefaults:");
+	for (size_t i=0; i<dimensions.size (); i++) {
+		fprintf (stderr, " %s=", dimensions[i].name);
+		for (size_t j=0; j<dimensions[i].values.size (); j++)
+			fprintf (stderr, "%s%u", j ? "," : "", dimensions[i].values[j]);
+	}
+	fprintf (stderr, "\n");
+	fprintf (stderr, "\t\tlong, medium, short and micro are global history lengths for tables t0 to t3,\n");
+	fprintf (stderr, "\t\twhich like lhist, lpred and choice are log2 entries; llen is local history bits\n");
+	fprintf (stderr, "each trace is decoded once, for every configuration; set CA2_TRACE_CACHE to a\n");
+	fprintf (stderr, "directory to keep the decoded traces there for later runs\n");
+	exit (1);
+}
+
+int main (int argc, char *argv[]) {
+	int n_threads = std::max (1u, std::thread::hardware_concurrency ());
+	unsigned long long budget = 0;
+	int opt;
+	while ((opt = getopt (argc, argv, "j:b:g:")) != -1) {
+		switch (opt) {
+		case 'j': n_threads = atoi (optarg); break;
+		case 'b': if (!parse_size (optarg, budget)) usage (argv[0]); break;
+		case 'g':
+			if (!parse_dimension (optarg)) {
+				fprintf (stderr, "bad field values %s\n", optarg);
+				usage (argv[0]);
+			}
+			break;
+		default: usage (argv[0]);
+		}
+	}
+	if (optind >= argc || n_threads < 1) usage (argv[0]);
+
+	std::vector<std::string> traces;
+	for (int i=optind; i<argc; i++) {
+		size_t before = traces.size ();
+		find_traces (argv[i], traces);
+		if (traces.size () == before) traces.push_back (argv[i]);
+	}
+	std::sort (traces.begin (), traces.end ());
+
+	// the grid, counting through the values of every field like an odometer
+
+	std::vector<point> points;
+	std::vector<size_t> at (dimensions.size (), 0);
+	size_t skipped = 0;
+	for (;;) {
+		point p;
+		for (size_t i=0; i<dimensions.size (); i++)
+			p.cfg.*dimensions[i].field = dimensions[i].values[at[i]];
+		p.bytes = (storage_bits (p.cfg) + 7) / 8;
+		if (valid (p.cfg) && (!budget || p.bytes <= budget)) {
+			p.dmiss.assign (traces.size (), 0);
+			points.push_back (p);
+		} else
+			skipped++;
+		size_t i = 0;
+		while (i < dimensions.size () && ++at[i] == dimensions[i].values.size ()) at[i++] = 0;
+		if (i == dimensions.size ()) break;
+	}
+	if (points.empty ()) {
+		fprintf (stderr, "no valid configuration fits the budget\n");
+		exit (1);
+	}
+	fprintf (stderr, "sweeping %d configurations over %d traces, %d skipped\n",
+		(int) points.size (), (int) traces.size (), (int) skipped);
+
+	// decode every trace into the cache now and map it, so the runs share
+	// one copy of its columns.  a trace that can't be cached is decoded
+	// again by every run
+
+	const char *env = getenv ("CA2_TRACE_CACHE");
+	std::string temp_cache;
+	if (!env || !*env) {
+		temp_cache = private_cache ();
+		if (!temp_cache.empty ()) setenv ("CA2_TRACE_CACHE", temp_cache.c_str (), 1);
+	}
+	std::vector<trace_cache> caches (traces.size ());
+	std::vector<const trace_columns *> cols (traces.size (), NULL);
+	for (size_t i=0; i<traces.size (); i++) {
+		trace_reader reader;
+		if (!reader.open (traces[i].c_str ())) {
+			fprintf (stderr, "%s: %s\n", traces[i].c_str (), reader.error ().c_str ());
+			if (!temp_cache.empty ()) remove_cache (temp_cache);
+			exit (1);
+		}
+		reader.close ();
+		if (caches[i].open (traces[i].c_str ())) cols[i] = &caches[i].columns ();
+	}
+	if (!temp_cache.empty ()) remove_cache (temp_cache);
+
+	// each thread takes the next configuration and trace pair
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+	size_t jobs = points.size () * traces.size ();
+	std::atomic<size_t> next (0);
+	std::vector<std::thread> threads;
+	for (int i=0; i<n_threads && i<(int) jobs; i++)
+		threads.push_back (std::thread ([&] {
+			size_t j;
+			while ((j = next++) < jobs) {
+				point & p = points[j / traces.size ()];
+				p.dmiss[j % traces.size ()] = evaluate (p.cfg, traces[j % traces.size ()], cols[j % traces.size ()]);
+			}
+		}));
+	for (size_t i=0; i<threads.size (); i++) threads[i].join ();
+	double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+
+	// each trace represents exactly 100 million instructions.  sorted by
+	// size, a configuration is on the front if it beats every one before it
+
+	for (size_t i=0; i<points.size (); i++) {
+		double sum = 0;
+		for (size_t j=0; j<traces.size (); j++) sum += 1000.0 * (points[i].dmiss[j] / 1e8);
+		points[i].mpki = sum / traces.size ();
+	}
+	std::sort (points.begin (), points.end (), [] (const point & a, const point & b) {
+		return a.bytes != b.bytes ? a.bytes < b.bytes : a.mpki < b.mpki;
+	});
+	int front = 0;
+	double best = 0;
+	for (size_t i=0; i<points.size (); i++) {
+		points[i].pareto = front == 0 || points[i].mpki < best;
+		if (points[i].pareto) {
+			best = points[i].mpki;
+			front++;
+		}
+	}
+
+	for (size_t i=0; i<points.size (); i++) {
+		printf ("{\"config\":{");
+		for (size_t j=0; j<dimensions.size (); j++)
+			printf ("%s\"%s\":%u", j ? "," : "", dimensions[j].name, points[i].cfg.*dimensions[j].field);
+		printf ("},\"bytes\":%llu,\"mpki\":%0.3f,\"pareto\":%s}\n",
+			points[i].bytes, points[i].mpki, points[i].pareto ? "true" : "false");
+	}
+	printf ("{\"configs\":%d,\"traces\":%d,\"budget\":%llu,\"pareto\":%d,\"threads\":%d,\"seconds\":%0.3f}\n",
+		(int) points.size (), (int) traces.size (), budget, front, (int) threads.size (), seconds);
+	exit (0);
+}
@@ -9,6 +9,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 #include "branch.h"
 #include "trace.h"
@@ -30,11 +33,11 @@
 // - A four byte little-endian branch target.  This is the address in memory 
 // where the branch jumped.
 //
-// The input file is usually compressed either with gzip or bzip2 and this
-// file contains code to support reading from these formats by piping the
-// output of the decompressors.  However, this file s does another kind of
-// decompression on the traces after they have been decompressed by gzip
-// or bzip2.  If the upper four bits of the first byte read are either
+// The input file is usually compressed with gzip, bzip2 or zstd, and this
+// file reads these formats through a decompressor that runs in-process on
+// its own thread (see decompress.cc).  However, this file also does
+// another kind of decompression on the traces after they have been
+// decompressed by gzip or bzip2.  If the upper four bits of the first byte read are either
 // 0 or 8 then the byte indicates that the trace has been compressed
 // from the 9 byte representation to a 1 or 2 byte representation.  This
 // compression is faciliated with prediction described below.  The compression
@@ -42,41 +45,18 @@
 // the purpose is to allow the stream of bytes fed to gzip or bzip2 to be
 // much more redundant and hence more compressible.
 
-// number of bytes to read at once from the decompressor
-
-#define BUFSIZE	10000
-
-// file pointer for the pipe from the decompressor
-
-FILE *tracefp;
-
-// buffer to read bytes into
-
-unsigned char buf[BUFSIZE];
-
-// current position in buffer
-unsigned int bufpos;
-
-// number of bytes read into buffer
-
-unsigned int bufsize;
-
-// true when end of file is reached
-
-bool end_of_file;
-
 // read a single byte from the trace file
 
-unsigned char read_byte (void) {
+unsigned char trace_reader::read_byte (void) {
 
 	// if the buffer is empty...
 
 	if (bufpos == bufsize) {
 
-		// get a BUFSIZE-sized chunk of bytes from the input
+		// get the next chunk of bytes from the decompressor
 
 		bufpos = 0;
-		bufsize = fread (buf, 1, BUFSIZE, tracefp);
+		bufsize = input.next_chunk (buf);
 
 		// nothing to read?  we must be done.
 
@@ -93,7 +73,7 @@ unsigned char read_byte (void) {
 
 // read an unsigned integer in little endian format from the trace file
 
-unsigned int read_uint (void) {
+unsigned int trace_reader::read_uint (void) {
 	unsigned int x0, x1, x2, x3;
 
 	x0 = read_byte ();
@@ -103,62 +83,26 @@ unsigned int read_uint (void) {
 	return x0 | (x1 << 8) | (x2 << 16) | (x3 << 24);
 }
 
-// these "remember" structs and functions handle decompressing certain traces
+// these "remember" structs (see trace.h) and functions handle decompressing certain traces
 // using prediction.  the compression is a simple table-based predictor that
 // also uses a return address stack for predicting return addresses.  
 // obviously this is a space win, but it is also a measurable performance 
 // win since there are fewer bytes to read.
 
-struct remember {
-	bool taken;
-	unsigned char code; 
-	unsigned int address, target;
-	unsigned int lru_time;
-
-	// constructor
-
-	remember (void) {
-		code = 0;
-		address = 0;
-		target = 0;
-		taken = 0;
-		lru_time = 0;
-	}
-
-	// return true if two remember structs are equivalent.  optionally
-	// ignore the target since it might have been correctly predicted
-	// by the return address stack
-
-	bool equal (remember *r, bool ignore_target) {
-		return
-		   r->code == code
-		&& r->taken == taken
-		&& r->address == address 
-		&& (ignore_target || r->target == target);
-	}
-};
-
-// a return address stack
-                                                                                
-#define RAS_SIZE        100
-                                                                                
-unsigned int ras[RAS_SIZE];
-int ras_top = RAS_SIZE;
-
 // (re)initialize the return address stack
-void init_ras (void) {
+void trace_reader::init_ras (void) {
 	ras_top = RAS_SIZE;
 }
 
 // push a target onto the return address stack
 
-void push_ras (unsigned int a) {
+void trace_reader::push_ras (unsigned int a) {
 	if (ras_top) ras[--ras_top] = a;
 }
 
 // pop a target from the return address stack
 
-unsigned int pop_ras (void) {
+unsigned int trace_reader::pop_ras (void) {
 	if (ras_top < RAS_SIZE) return ras[ras_top++];
 	return 0;
 }
@@ -168,35 +112,35 @@ unsigned int pop_ras (void) {
 #define N_REMEMBER	(1<<16)
 #define ASSOC		8
 
-// the predictor table; a 64k-entry 8-way set associative memory.
+// the predictor table, rtab, is a 64k-entry 8-way set associative memory.
 // a hash table with probing would probably be more space-efficient
 // but I think this is a little faster (neither has good locality).
 // we can only remember up to 8 possible predictions per branch target
 // because we're squeezing set indices into a 3-bit code so having
 // a fixed set size is OK.  in practice, most branches need only 1 or 2
 // possible predictions, but some traces benefit from higher associativity.
+// it is only allocated once a trace has to be decoded.
 
-remember rtab[N_REMEMBER][ASSOC];
-
-// this int keeps time for the LRU algorithm
-
-static unsigned int now = 0; 
+// (re)initialize the predictor table, for decoding a trace from the start
 
-// last trace seen
-
-static remember last_one; 
+void trace_reader::init_remember (void) {
+	if (!rtab) rtab = new remember[N_REMEMBER * ASSOC];
+	for (int i=0; i<N_REMEMBER*ASSOC; i++) rtab[i] = remember ();
+	now = 0;
+	last_one = remember ();
+}
 
 // predict a trace
 
-remember *predict_remember (void) {
+remember *trace_reader::predict_remember (void) {
 	unsigned int index = last_one.target & (N_REMEMBER-1);
-	remember *r = &rtab[index][0];
+	remember *r = &rtab[index * ASSOC];
 	return r;
 }
 
 // update the predictor
 
-void update_remember (remember & me, remember *r, bool correct, int index) {
+void trace_reader::update_remember (remember & me, remember *r, bool correct, int index) {
 	if (correct) {
 		r[index].lru_time = now++;
 	} else {
@@ -210,10 +154,9 @@ void update_remember (remember & me, remember *r, bool correct, int index) {
 	last_one = me;
 }
 
-// read a single trace from the file
+// decode a single trace from the file
 
-trace *read_trace (void) {
-	static trace t;
+trace *trace_reader::decode (void) {
 	bool ras_correct, ras_offby2, ras_offby3, correct;
 
 	// read the next byte; it will either be a code, a set index for
@@ -413,49 +356,135 @@ trace *read_trace (void) {
 	return & t;
 }
 
-// open the trace file for reading
+trace_reader::trace_reader (void) {
+	rtab = NULL;
+	cached = false;
+	cache_pos = 0;
+	bufpos = bufsize = 0;
+	end_of_file = true;
+}
 
-#define GZIP_MAGIC     "\037\213"
-#define BZIP2_MAGIC	"BZ"
+trace_reader::~trace_reader (void) {
+	close ();
+	delete[] rtab;
+}
 
-void init_trace (char *fname) {
-	char *dc;
-	char s[2] = { 0, 0 };
-	char cmd[1000];
+// start decoding the trace file from the beginning; the decompressor works
+// out the compression method from the magic number
 
-	// figure out the compression method from the magic number
+bool trace_reader::open_stream (const char *fname) {
+	if (!input.open (fname)) {
+		failure = input.failure ().empty () ? strerror (errno) : input.failure ();
+		return false;
+	}
+	bufpos = 0;
+	bufsize = 0;
+	end_of_file = false;
+	init_ras ();
+	init_remember ();
+	return true;
+}
 
-	FILE *f = fopen (fname, "r");
-	if (!f) {
-		perror (fname);
+// open the trace file for reading.  the first time a trace file is seen,
+// all of it is decoded into the cache before the first trace is returned
+
+bool trace_reader::open (const char *fname) {
+	failure.clear ();
+	cached = cache.open (fname);
+	if (!cached) {
+		if (!open_stream (fname)) return false;
+		if (cache.create ()) {
+			trace *p;
+			while ((p = decode ())) cache.append (p);
+			if (!input.failure ().empty ()) {
+				failure = input.failure ();
+				close ();
+				return false;
+			}
+			input.close ();
+			cached = cache.finish ();
+
+			// if the cache couldn't be written, decode it again
+			// as we go
+
+			if (!cached && !open_stream (fname)) return false;
+		}
 	}
-	fread (s, 1, 2, f);
-	fclose (f);
-	if (strncmp (s, GZIP_MAGIC, 2) == 0) 
-		dc = ZCAT;
-	else if (strncmp (s, BZIP2_MAGIC, 2) == 0)
-		dc = BZCAT;
-	else
-		dc = CAT;
+	cache_pos = 0;
+	return true;
+}
+
+// read a single trace, from the cache or the file
+
+trace *trace_reader::read (void) {
+	if (!cached) {
+		trace *p = decode ();
+		if (!p) failure = input.failure ();
+		return p;
+	}
+	const trace_columns &c = cache.columns ();
+	if (cache_pos == c.count) return NULL;
+	t.bi.address = c.address[cache_pos];
+	t.bi.opcode = c.opcode[cache_pos];
+	t.bi.br_flags = c.flags[cache_pos];
+	t.target = c.target[cache_pos];
+	t.taken = c.taken[cache_pos];
+	cache_pos++;
+	return &t;
+}
+
+// close the trace file
 
-	// make a command that will decompress the file to stdout
+void trace_reader::close (void) {
+	input.close ();
+	cache.close ();
+	cached = false;
+}
 
-	sprintf (cmd, "%s %s", dc, fname);
+// the reader behind init_trace, read_trace and end_trace, which give up
+// on the whole program if the trace file can't be read
 
-	// pipe that stdout to tracefp
+static trace_reader default_reader;
+static const char *default_name;
 
-	tracefp = popen (cmd, "r");
-	if (!tracefp) {
-		perror (fname);
+void init_trace (char *fname) {
+	default_name = fname;
+	if (!default_reader.open (fname)) {
+		fprintf (stderr, "%s: %s\n", fname, default_reader.error ().c_str ());
 		exit (1);
 	}
-	bufpos = 0;
-	bufsize = 0;
-	end_of_file = false;
 }
 
-// close the trace file
+trace *read_trace (void) {
+	trace *t = default_reader.read ();
+	if (!t && !default_reader.error ().empty ()) {
+		fprintf (stderr, "%s: %s\n", default_name, default_reader.error ().c_str ());
+		exit (1);
+	}
+	return t;
+}
 
 void end_trace (void) {
-	fclose (tracefp);
+	default_reader.close ();
+}
+
+// add every file under dir whose name contains ".trace.", as the run
+// script's find does
+
+void find_traces (const std::string & dir, std::vector<std::string> & found) {
+	DIR *d = opendir (dir.c_str ());
+	if (!d) return;
+	struct dirent *e;
+	while ((e = readdir (d)) != NULL) {
+		if (e->d_name[0] == '.' && (!e->d_name[1] || (e->d_name[1] == '.' && !e->d_name[2])))
+			continue;
+		std::string path = dir + "/" + e->d_name;
+		struct stat st;
+		if (stat (path.c_str (), &st) != 0) continue;
+		if (S_ISDIR (st.st_mode))
+			find_traces (path, found);
+		else if (strstr (e->d_name, ".trace."))
+			found.push_back (path);
+	}
+	closedir (d);
 }
@@ -1,13 +1,6 @@
 // trace.h
-// This file declares functions and a struct for reading trace files.
-
-// these #define the Unix commands for decompressing gzip, bzip2, and
-// plain files.  If they are somewhere else on your system, change these
-// definitions.
-
-#define ZCAT            "/bin/gzip -dc"
-#define BZCAT           "/usr/bin/bzip2 -dc"
-#define CAT             "/bin/cat"
+// This file declares functions, a struct and a reader class for reading
+// trace files.
 
 struct trace {
 	bool	taken;
@@ -15,6 +8,112 @@ struct trace {
 	branch_info bi;
 };
 
+#include "decompress.h"
+#include "trace_cache.h"
+
+// a trace as remembered by the decoder's predictor table; see trace.cc
+
+struct remember {
+	bool taken;
+	unsigned char code; 
+	unsigned int address, target;
+	unsigned int lru_time;
+
+	// constructor
+
+	remember (void) {
+		code = 0;
+		address = 0;
+		target = 0;
+		taken = 0;
+		lru_time = 0;
+	}
+
+	// return true if two remember structs are equivalent.  optionally
+	// ignore the target since it might have been correctly predicted
+	// by the return address stack
+
+	bool equal (remember *r, bool ignore_target) {
+		return
+		   r->code == code
+		&& r->taken == taken
+		&& r->address == address 
+		&& (ignore_target || r->target == target);
+	}
+};
+
+// reads one trace file.  readers share nothing, so each thread can read a
+// different trace file with its own
+
+class trace_reader {
+public:
+	trace_reader (void);
+	~trace_reader (void);
+
+	// open a trace file; false if it can't be opened
+
+	bool open (const char *fname);
+
+	// the next trace, or NULL at the end of the file.  the trace is
+	// overwritten by the next call
+
+	trace *read (void);
+
+	// why open failed or read ended early; empty if neither did
+
+	const std::string & error (void) { return failure; }
+
+	void close (void);
+
+private:
+#define RAS_SIZE	100
+
+	bool open_stream (const char *fname);
+	trace *decode (void);
+	unsigned char read_byte (void);
+	unsigned int read_uint (void);
+	void init_ras (void);
+	void push_ras (unsigned int a);
+	unsigned int pop_ras (void);
+	void init_remember (void);
+	remember *predict_remember (void);
+	void update_remember (remember & me, remember *r, bool correct, int index);
+
+	// the decompressor, which hands over the trace a chunk at a time
+
+	decompressor input;
+	unsigned char *buf;	// the chunk being read
+	unsigned int bufpos;	// current position in buffer
+	unsigned int bufsize;	// number of bytes in buffer
+	bool end_of_file;
+
+	// the return address stack
+
+	unsigned int ras[RAS_SIZE];
+	int ras_top;
+
+	// the predictor table, its clock for LRU and the last trace seen
+
+	remember *rtab;
+	unsigned int now;
+	remember last_one;
+
+	// decoded traces, if the trace file has been decoded before
+
+	trace_cache cache;
+	bool cached;			// traces come from the cache
+	unsigned long long cache_pos;	// the next trace in the cache
+
+	trace t;			// the trace read returns
+	std::string failure;
+};
+
+// read a trace file with one shared reader
+
 void init_trace (char *);
 trace *read_trace (void);
 void end_trace (void);
+
+// add the trace files under a directory to found
+
+void find_traces (const std::string & dir, std::vector<std::string> & found);
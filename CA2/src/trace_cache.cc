@@ -0,0 +1,242 @@
+// trace_cache.cc
+// This file contains the cache of decoded traces.  A cache file is a
+// header followed by the columns: count branch addresses, count targets,
+// then count bytes each of br_flags, taken and opcode.
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "branch.h"
+#include "trace.h"
+
+#define CACHE_MAGIC	"CA2COLS1"
+
+struct cache_header {
+	char magic[8];
+	unsigned long long hash;	// of the trace file's contents
+	unsigned long long count;	// traces in each column
+};
+
+// bytes per trace in all the columns together
+
+#define TRACE_BYTES	11
+
+// 64-bit FNV-1a hash of a whole file; false if it can't be read
+
+static bool hash_file (const char *fname, unsigned long long &hash) {
+	int fd = ::open (fname, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat (fd, &st) != 0) {
+		::close (fd);
+		return false;
+	}
+	hash = 0xcbf29ce484222325ull;
+	if (st.st_size == 0) {
+		::close (fd);
+		return true;
+	}
+	void *data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close (fd);
+	if (data == MAP_FAILED) return false;
+	const unsigned char *p = (const unsigned char *) data;
+	for (off_t i=0; i<st.st_size; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ull;
+	}
+	munmap (data, st.st_size);
+	return true;
+}
+
+// the cache directory, created if need be; empty if caching is off
+
+static std::string cache_directory (void) {
+	const char *env = getenv ("CA2_TRACE_CACHE");
+	if (!env || !*env) return "";
+	mkdir (env, 0755);
+	struct stat st;
+	if (stat (env, &st) != 0 || !S_ISDIR (st.st_mode)) return "";
+	return env;
+}
+
+trace_cache::trace_cache (void) {
+	mapped = NULL;
+	mapped_size = 0;
+	memset (&cols, 0, sizeof (cols));
+	for (int i=0; i<COLUMNS; i++) column[i] = NULL;
+	appended = 0;
+}
+
+trace_cache::~trace_cache (void) {
+	close ();
+}
+
+bool trace_cache::open (const char *fname) {
+	close ();
+	path.clear ();
+	std::string dir = cache_directory ();
+	if (dir.empty () || !hash_file (fname, hash)) return false;
+	char name[32];
+	sprintf (name, "/%016llx.cols", hash);
+	path = dir + name;
+	return map ();
+}
+
+// map the cache file at path; a missing one, or one with the wrong hash
+// or size, isn't used
+
+bool trace_cache::map (void) {
+	int fd = ::open (path.c_str (), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat (fd, &st) != 0 || (size_t) st.st_size < sizeof (cache_header)) {
+		::close (fd);
+		return false;
+	}
+	void *data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close (fd);
+	if (data == MAP_FAILED) return false;
+
+	const cache_header *h = (const cache_header *) data;
+	if (memcmp (h->magic, CACHE_MAGIC, 8) != 0 || h->hash != hash
+	 || h->count > ((size_t) st.st_size - sizeof (cache_header)) / TRACE_BYTES
+	 || sizeof (cache_header) + h->count * TRACE_BYTES != (size_t) st.st_size) {
+		munmap (data, st.st_size);
+		return false;
+	}
+	madvise (data, st.st_size, MADV_SEQUENTIAL);
+	mapped = data;
+	mapped_size = st.st_size;
+
+	const unsigned char *p = (const unsigned char *) data + sizeof (cache_header);
+	cols.count = h->count;
+	cols.address = (const unsigned int *) p;
+	p += h->count * 4;
+	cols.target = (const unsigned int *) p;
+	p += h->count * 4;
+	cols.flags = p;
+	p += h->count;
+	cols.taken = p;
+	p += h->count;
+	cols.opcode = p;
+	return true;
+}
+
+// a temporary file named from the template in name, open for reading
+// and writing; NULL if it can't be made
+
+static FILE *temp_file (std::string &name) {
+	int fd = mkstemp (&name[0]);
+	if (fd < 0) return NULL;
+	FILE *f = fdopen (fd, "w+b");
+	if (!f) {
+		::close (fd);
+		unlink (name.c_str ());
+	}
+	return f;
+}
+
+// open the temporary cache file, leaving room for its header, and a file
+// for each of the other columns
+
+bool trace_cache::create (void) {
+	release ();
+	appended = 0;
+	if (path.empty ()) return false;
+	temp = path + ".XXXXXX";
+	column[0] = temp_file (temp);
+	if (!column[0] || fseek (column[0], sizeof (cache_header), SEEK_SET) != 0) {
+		release ();
+		return false;
+	}
+	for (int i=1; i<COLUMNS; i++) {
+		std::string name = path + ".XXXXXX";
+		column[i] = temp_file (name);
+		if (!column[i]) {
+			release ();
+			return false;
+		}
+		unlink (name.c_str ());
+	}
+	return true;
+}
+
+// put a little endian word like the host's into a column
+
+static inline void put_word (unsigned int w, FILE *f) {
+	putc_unlocked (w, f);
+	putc_unlocked (w >> 8, f);
+	putc_unlocked (w >> 16, f);
+	putc_unlocked (w >> 24, f);
+}
+
+// stdio buffers the writes, and only this thread uses the files, so they
+// skip its locking; errors show up at finish
+
+void trace_cache::append (const trace *t) {
+	put_word (t->bi.address, column[0]);
+	put_word (t->target, column[1]);
+	putc_unlocked (t->bi.br_flags, column[2]);
+	putc_unlocked (t->taken, column[3]);
+	putc_unlocked (t->bi.opcode, column[4]);
+	appended++;
+}
+
+// copy the other columns onto the end of the first, write the header
+// and rename the file into place, so a cache is either whole or absent.
+// mkstemp's 0600 is relaxed so other users of the directory can read it
+
+bool trace_cache::finish (void) {
+	FILE *out = column[0];
+	bool ok = out != NULL;
+	char buf[1 << 16];
+	for (int i=1; ok && i<COLUMNS; i++) {
+		ok = fflush (column[i]) == 0 && fseek (column[i], 0, SEEK_SET) == 0;
+		size_t n;
+		while (ok && (n = fread (buf, 1, sizeof (buf), column[i])) > 0)
+			ok = fwrite (buf, 1, n, out) == n;
+		ok = ok && !ferror (column[i]);
+	}
+	if (ok) {
+		cache_header h;
+		memcpy (h.magic, CACHE_MAGIC, 8);
+		h.hash = hash;
+		h.count = appended;
+		ok = fseek (out, 0, SEEK_SET) == 0 && fwrite (&h, sizeof (h), 1, out) == 1
+		  && fflush (out) == 0 && fchmod (fileno (out), 0644) == 0;
+	}
+	if (out) ok = fclose (out) == 0 && ok;
+	column[0] = NULL;
+	release ();
+	ok = ok && rename (temp.c_str (), path.c_str ()) == 0;
+	if (!ok) {
+		if (out) unlink (temp.c_str ());
+		return false;
+	}
+	return map ();
+}
+
+// close the columns being written, removing an unfinished cache file
+
+void trace_cache::release (void) {
+	if (column[0]) {
+		fclose (column[0]);
+		unlink (temp.c_str ());
+	}
+	for (int i=0; i<COLUMNS; i++) {
+		if (i && column[i]) fclose (column[i]);
+		column[i] = NULL;
+	}
+}
+
+void trace_cache::close (void) {
+	if (mapped) munmap (mapped, mapped_size);
+	mapped = NULL;
+	mapped_size = 0;
+	memset (&cols, 0, sizeof (cols));
+	release ();
+}
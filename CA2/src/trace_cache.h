@@ -0,0 +1,73 @@
+// trace_cache.h
+// This file declares a cache of decoded traces.  Decoding a trace file
+// means decompressing it and replaying the remember table and return
+// address stack in trace.cc, which gives the same traces every time, so
+// the first run writes them out as columns and later runs just mmap them.
+//
+// A cache file is named after a hash of the trace file's contents, so a
+// trace that changes gets a new cache and a stale one is never used.  Caching
+// is off unless $CA2_TRACE_CACHE names a directory to keep the files in.
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// the decoded traces, one array per field
+
+struct trace_columns {
+	unsigned long long count;
+	const unsigned int *address;
+	const unsigned int *target;
+	const unsigned char *flags;	// br_flags
+	const unsigned char *taken;
+	const unsigned char *opcode;
+};
+
+class trace_cache {
+public:
+	trace_cache (void);
+	~trace_cache (void);
+
+	// map the cache of this trace file; false if there isn't one yet
+
+	bool open (const char *fname);
+
+	// start writing the cache of the trace file last passed to open;
+	// false if caching is off or the cache directory can't be written
+
+	bool create (void);
+
+	// add the next trace to the cache being written
+
+	void append (const trace *t);
+
+	// finish the cache being written and map it; false if writing failed
+
+	bool finish (void);
+
+	// the mapped traces
+
+	const trace_columns &columns (void) { return cols; }
+
+	void close (void);
+
+private:
+	bool map (void);
+	void release (void);
+
+	std::string path;	// the cache file, empty if caching is off
+	unsigned long long hash;
+	void *mapped;
+	size_t mapped_size;
+	trace_columns cols;
+
+	// the columns being written, in the order they are stored.  the
+	// first goes straight into the temporary cache file after room for
+	// the header and the rest into unlinked files of their own, copied
+	// onto its end by finish, so a trace is never held in memory whole
+
+	enum { COLUMNS = 5 };
+	std::string temp;		// the temporary cache file's name
+	FILE *column[COLUMNS];
+	unsigned long long appended;
+};